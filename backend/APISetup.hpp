@@ -1,23 +1,77 @@
 #ifndef APISETUP_HPP
 #define APISETUP_HPP
 
-#include"RestAPI.hpp"
+#include"AdmissionControl.hpp"
+#include"GameEngine.hpp"
+#include"Leaderboard.hpp"
+#include"LiveUpdates.hpp"
+#include"SearchIndex.hpp"
 
 #define SCHEME "htpp"
 #define HOST "127.0.0.1"
 #define PORT 12345
+#define DATA_DIR "data"
 
-//TODO ASK FOR AUTH?? CHANGE AUTH??
+//metrics series of a route, created once while the routes are registered
+static int RouteSeries(const QString &method, const QString &route)
+{
+    return MetricsRegistry::Instance().Series(method, route);
+}
+
+//offline conversion of a json asset into the snapshot the data directory is recovered from
+static bool ConvertAssetToSnapshot(const QString &type, const QString &jsonPath, const QString &snapshotPath)
+{
+    if(type == "categories")
+        return ConvertJSONToSnapshot<qint64, Category>(CategoryFactory{}, jsonPath, snapshotPath);
+    if(type == "questions")
+    {
+        //questions refer to categories, they are converted against the bundled ones
+        for(const auto &category: TryLoadFromFile<qint64, Category>(CategoryFactory{}, ":/assets/categories.json"))
+            CategoryDirectory::Instance().Apply(category.id, &category);
+        return ConvertJSONToSnapshot<qint64, Question>(QuestionFactory{}, jsonPath, snapshotPath);
+    }
+
+    qDebug() << "Unknown snapshot type" << type;
+    return false;
+}
+
+//K is not deduced from the nested type, callers name it
+template<typename K = qint64>
+std::optional<K> SessionIdOf(const std::optional<typename SessionAPI<K>::Session> &session)
+{
+    return session.has_value() ? std::optional<K>(session.value().id) : std::nullopt;
+}
+
+//admins read the secret fields (the right answers) too, everyone else gets the public form
+template<typename K = qint64>
+FieldMask VisibleFields(const std::optional<typename SessionAPI<K>::Session> &session)
+{
+    return session.has_value() && session.value().admin ? ALL_FIELDS : PUBLIC_FIELDS;
+}
+
+//401 without a session, 403 for a player's
+static QHttpServerResponse WriteRefusal(bool hasSession)
+{
+    return QHttpServerResponse(hasSession ? QHttpServerResponder::StatusCode::Forbidden : QHttpServerResponder::StatusCode::Unauthorized);
+}
 
 template<typename K = qint64, typename T = void, typename = enable_if_t<std::conjunction_v<std::is_base_of<JSONable, T>, std::is_base_of<Updatable, T>>>>
-void AddCRUDRoutes(QHttpServer &httpServer, const QString &apiPath, CRUDAPI<K, T> &api, const SessionAPI<K> &sessionApi)
+void AddCRUDRoutes(QHttpServer &httpServer, const QString &apiPath, CRUDAPI<K, T> &api, const SessionAPI<K> &sessionApi, CRUDGuards &guards)
 {
-    //GET paginated data list
+    //GET paginated data list, or the items of ?ids=1,2,3
     httpServer.route
         (
             QString("%1").arg(apiPath), //apiPath?
             QHttpServerRequest::Method::Get,
-            [&api](const QHttpServerRequest &request) {return api.GetPaginatedDataList(request);}
+            [&api, &sessionApi, &guards, series = RouteSeries("GET", QString("%1").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.reads.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), [&api, &request, &session]()
+                {
+                    return api.GetPaginatedDataList(request, VisibleFields<K>(session));
+                });
+            }
         );
 
     //GET single item
@@ -25,19 +79,68 @@ void AddCRUDRoutes(QHttpServer &httpServer, const QString &apiPath, CRUDAPI<K, T
         (
             QString("%1").arg(apiPath), //apiPath?
             QHttpServerRequest::Method::Get,
-            [&api](K itemId) {return api.GetItem(itemId);}
+            [&api, &sessionApi, &guards, series = RouteSeries("GET", QString("%1<id>").arg(apiPath))](K itemId, const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.reads.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), [&api, itemId, &request, &session]()
+                {
+                    return api.GetItem(itemId, request, VisibleFields<K>(session));
+                });
+            }
+        );
+
+    //GET response cache statistics
+    httpServer.route
+        (
+            QString("%1cache").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&api, &sessionApi, &guards, series = RouteSeries("GET", QString("%1cache").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                return guards.reads.Admit(RouteGuard::ClientKey(request, sessionApi.FindSessionId(request)), [&api]()
+                {
+                    return QHttpServerResponse(api.GetCacheStats().ToJSON());
+                });
+            }
         );
 
+    //mutations are limited before authorization, so floods without a valid token are turned away by address
+    //a session's writes also count against its address, fresh sessions do not buy more
+    //only admin sessions may write, player sessions get 403
     //POST
     httpServer.route
         (
             QString("%1").arg(apiPath), //apiPath?
             QHttpServerRequest::Method::Post,
-            [&api, &sessionApi](const QHttpServerRequest &request)
+            [&api, &sessionApi, &guards, series = RouteSeries("POST", QString("%1").arg(apiPath))](const QHttpServerRequest &request)
             {
-                if(!sessionApi.Authorize(request))
-                    return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
-                return api.PostItem(request);
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.writes.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), RouteGuard::AddressKey(request), [&api, &request, &session]()
+                {
+                    if(!session.has_value() || !session.value().admin)
+                        return ReadyResponse(WriteRefusal(session.has_value()));
+                    return api.Commit(api.PostItem(request));
+                });
+            }
+        );
+
+    //POST batch of creates, updates and deletes, authorized once
+    httpServer.route
+        (
+            QString("%1batch").arg(apiPath),
+            QHttpServerRequest::Method::Post,
+            [&api, &sessionApi, &guards, series = RouteSeries("POST", QString("%1batch").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.writes.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), RouteGuard::AddressKey(request), [&api, &request, &session]()
+                {
+                    if(!session.has_value() || !session.value().admin)
+                        return ReadyResponse(WriteRefusal(session.has_value()));
+                    return api.Commit(api.BatchItems(request));
+                });
             }
         );
 
@@ -46,11 +149,16 @@ void AddCRUDRoutes(QHttpServer &httpServer, const QString &apiPath, CRUDAPI<K, T
         (
             QString("%1").arg(apiPath), //apiPath?
             QHttpServerRequest::Method::Put,
-            [&api, &sessionApi](K itemId, const QHttpServerRequest &request)
+            [&api, &sessionApi, &guards, series = RouteSeries("PUT", QString("%1<id>").arg(apiPath))](K itemId, const QHttpServerRequest &request)
             {
-                if(!sessionApi.Authorize(request))
-                    return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
-                return api.PutItem(itemId, request);
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.writes.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), RouteGuard::AddressKey(request), [&api, itemId, &request, &session]()
+                {
+                    if(!session.has_value() || !session.value().admin)
+                        return ReadyResponse(WriteRefusal(session.has_value()));
+                    return api.Commit(api.PutItem(itemId, request));
+                });
             }
         );
 
@@ -58,11 +166,16 @@ void AddCRUDRoutes(QHttpServer &httpServer, const QString &apiPath, CRUDAPI<K, T
         (
             QString("%1").arg(apiPath), //apiPath?
             QHttpServerRequest::Method::Patch,
-            [&api, &sessionApi](K itemId, const QHttpServerRequest &request)
+            [&api, &sessionApi, &guards, series = RouteSeries("PATCH", QString("%1<id>").arg(apiPath))](K itemId, const QHttpServerRequest &request)
             {
-                if(!sessionApi.Authorize(request))
-                    return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
-                return api.PutItemFields(itemId, request);
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.writes.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), RouteGuard::AddressKey(request), [&api, itemId, &request, &session]()
+                {
+                    if(!session.has_value() || !session.value().admin)
+                        return ReadyResponse(WriteRefusal(session.has_value()));
+                    return api.Commit(api.PutItemFields(itemId, request));
+                });
             }
         );
 
@@ -70,14 +183,215 @@ void AddCRUDRoutes(QHttpServer &httpServer, const QString &apiPath, CRUDAPI<K, T
     httpServer.route
         (
             QString("%1").arg(apiPath), //apiPath?
-            QHttpServerRequest::Method::Patch,
-            [&api, &sessionApi](K itemId, const QHttpServerRequest &request)
+            QHttpServerRequest::Method::Delete,
+            [&api, &sessionApi, &guards, series = RouteSeries("DELETE", QString("%1<id>").arg(apiPath))](K itemId, const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto session = sessionApi.FindSession(request);
+                return guards.writes.Admit(RouteGuard::ClientKey(request, SessionIdOf<K>(session)), RouteGuard::AddressKey(request), [&api, itemId, &session]()
+                {
+                    if(!session.has_value() || !session.value().admin)
+                        return ReadyResponse(WriteRefusal(session.has_value()));
+                    return api.Commit(api.DeleteItem(itemId));
+                });
+            }
+        );
+}
+
+static void AddQuizRoutes(QHttpServer &httpServer, const QString &apiPath, QuizAPI &api, const SessionAPI<qint64> &sessionApi)
+{
+    //GET random questions of a category, a token makes the draw repeat-free for that session
+    httpServer.route
+        (
+            QString("%1random").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&api, &sessionApi, series = RouteSeries("GET", QString("%1random").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                return api.GetRandomQuestions(request, sessionApi.FindSessionId(request));
+            }
+        );
+}
+
+template<typename T>
+void AddSearchRoutes(QHttpServer &httpServer, const QString &apiPath, const SearchAPI<T> &api)
+{
+    //GET page of the items whose text matches ?q=
+    httpServer.route
+        (
+            QString("%1search").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&api, series = RouteSeries("GET", QString("%1search").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                return api.Search(request);
+            }
+        );
+}
+
+template<typename K = qint64>
+void AddSessionRoutes(QHttpServer &httpServer, const QString &apiPath, SessionAPI<K> &sessionApi, RouteGuard &guard)
+{
+    //POST starts a player session and hands out its token, limited by address
+    httpServer.route
+        (
+            QString("%1").arg(apiPath),
+            QHttpServerRequest::Method::Post,
+            [&sessionApi, &guard, series = RouteSeries("POST", QString("%1").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                return guard.Admit(RouteGuard::ClientKey(request, std::nullopt), [&sessionApi, &request]()
+                {
+                    return sessionApi.RegisterSession(request);
+                });
+            }
+        );
+}
+
+static void AddGameRoutes(QHttpServer &httpServer, const QString &apiPath, GameEngine &engine, const SessionAPI<qint64> &sessionApi)
+{
+    //GET totals of the session
+    httpServer.route
+        (
+            QString("%1").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&engine, &sessionApi, series = RouteSeries("GET", QString("%1").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto sessionId = sessionApi.FindSessionId(request);
+                if(!sessionId.has_value())
+                    return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+                return engine.GetTotals(sessionId.value(), ResponseFormat(request.headers()));
+            }
+        );
+
+    //POST start a game
+    httpServer.route
+        (
+            QString("%1").arg(apiPath),
+            QHttpServerRequest::Method::Post,
+            [&engine, &sessionApi, series = RouteSeries("POST", QString("%1").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto sessionId = sessionApi.FindSessionId(request);
+                if(!sessionId.has_value())
+                    return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+                return engine.StartGame(sessionId.value(), request);
+            }
+        );
+
+    //POST answers of the running game
+    httpServer.route
+        (
+            QString("%1answers").arg(apiPath),
+            QHttpServerRequest::Method::Post,
+            [&engine, &sessionApi, series = RouteSeries("POST", QString("%1answers").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto sessionId = sessionApi.FindSessionId(request);
+                if(!sessionId.has_value())
+                    return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+                return engine.SubmitAnswers(sessionId.value(), request);
+            }
+        );
+}
+
+static void AddLeaderboardRoutes(QHttpServer &httpServer, const QString &apiPath, const Leaderboard &leaderboard, const SessionAPI<qint64> &sessionApi)
+{
+    //GET paginated ranking
+    httpServer.route
+        (
+            QString("%1").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&leaderboard, series = RouteSeries("GET", QString("%1").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                return leaderboard.GetPage(request);
+            }
+        );
+
+    //GET rank of a session
+    httpServer.route
+        (
+            QString("%1").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&leaderboard, series = RouteSeries("GET", QString("%1<id>").arg(apiPath))](qint64 sessionId)
             {
-                if(!sessionApi.Authorize(request))
+                const auto scope = RequestScope(series);
+                return leaderboard.GetRank(sessionId);
+            }
+        );
+
+    //GET rank of the requesting session
+    httpServer.route
+        (
+            QString("%1me").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&leaderboard, &sessionApi, series = RouteSeries("GET", QString("%1me").arg(apiPath))](const QHttpServerRequest &request)
+            {
+                const auto scope = RequestScope(series);
+                const auto sessionId = sessionApi.FindSessionId(request);
+                if(!sessionId.has_value())
                     return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
-                return api.DeleteItem(itemId);
+                return leaderboard.GetRank(sessionId.value());
+            }
+        );
+
+    //GET response cache statistics
+    httpServer.route
+        (
+            QString("%1cache").arg(apiPath),
+            QHttpServerRequest::Method::Get,
+            [&leaderboard, series = RouteSeries("GET", QString("%1cache").arg(apiPath))]()
+            {
+                const auto scope = RequestScope(series);
+                return QHttpServerResponse(leaderboard.GetCacheStats().ToJSON());
             }
         );
 }
 
+//websocket subscriptions at <apiPath>live, every server loop gets its own hub per feed
+static void AddLiveRoutes(QHttpServer &httpServer, const QList<QPair<QString, LiveFeed *>> &feeds)
+{
+    auto hubs = QHash<QString, LiveFeed::Hub *>{};
+    for(const auto &[apiPath, feed]: feeds)
+        hubs.insert(QString("%1live").arg(apiPath), new LiveFeed::Hub(*feed, &httpServer));
+
+    QObject::connect(&httpServer, &QAbstractHttpServer::newWebSocketConnection, &httpServer, [&httpServer, hubs]()
+    {
+        while(httpServer.hasPendingWebSocketConnections())
+        {
+            auto *socket = httpServer.nextPendingWebSocketConnection();
+            auto *hub = hubs.value(socket->requestUrl().path());
+            if(!hub)
+            {
+                socket->close(QWebSocketProtocol::CloseCodePolicyViolated, "no such feed");
+                socket->deleteLater();
+                continue;
+            }
+            hub->Subscribe(socket);
+        }
+    });
+}
+
+static void AddMetricsRoutes(QHttpServer &httpServer, const QString &path)
+{
+    //GET prometheus text exposition
+    httpServer.route
+        (
+            path,
+            QHttpServerRequest::Method::Get,
+            []()
+            {
+                return QHttpServerResponse("text/plain; version=0.0.4", MetricsRegistry::Instance().Exposition());
+            }
+        );
+
+    httpServer.afterRequest([](QHttpServerResponse &&response)
+    {
+        MetricsRegistry::Instance().CountResponse(int(response.statusCode()));
+        return std::move(response);
+    });
+}
+
 #endif // APISETUP_HPP
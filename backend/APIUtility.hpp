@@ -1,11 +1,18 @@
 #ifndef APIUTILITY_HPP
 #define APIUTILITY_HPP
 
+#include<QCborMap>
+#include<QCborArray>
 #include<QFile>
 #include<QJsonParseError>
 #include<QHttpServer>
+#include<QPromise>
 
 #include"Structs.hpp"
+#include"JSONBodyParser.hpp"
+#include"CBORWriter.hpp"
+#include"JSONStreamReader.hpp"
+#include"Metrics.hpp"
 
 static std::optional<QByteArray> ReadFileToByteArray(const QString &path)
 {
@@ -19,6 +26,7 @@ static std::optional<QByteArray> ReadFileToByteArray(const QString &path)
 
 static std::optional<QJsonArray> ByteArrayToJSONArray(const QByteArray &array)
 {
+    const auto phase = PhaseScope(MetricsRegistry::Phase::Parse);
     auto error = QJsonParseError{};
     const auto json = QJsonDocument::fromJson(array, &error);
     if(error.error || !json.isArray())
@@ -29,6 +37,7 @@ static std::optional<QJsonArray> ByteArrayToJSONArray(const QByteArray &array)
 
 static std::optional<QJsonObject> ByteArrayToJSONObject(const QByteArray &array)
 {
+    const auto phase = PhaseScope(MetricsRegistry::Phase::Parse);
     auto error = QJsonParseError{};
     const auto json = QJsonDocument::fromJson(array, &error);
     if(error.error || !json.isObject())
@@ -37,26 +46,82 @@ static std::optional<QJsonObject> ByteArrayToJSONObject(const QByteArray &array)
     return json.object();
 }
 
+//request bodies of described types are read without a full document, only the members T is built from come back
+//a body QJsonDocument would reject is rejected here too
+template<typename T>
+static std::optional<QJsonObject> ByteArrayToBodyFields(const QByteArray &array)
+{
+    if constexpr(HasFieldDescriptors<T>::value)
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Parse);
+        return JSONBodyParser(array, &WritableFieldNames<T>()).ParseObject();
+    }
+    else
+        return ByteArrayToJSONObject(array);
+}
+
+static std::optional<QCborValue> ByteArrayToCBOR(const QByteArray &array)
+{
+    const auto phase = PhaseScope(MetricsRegistry::Phase::Parse);
+    auto error = QCborParserError{};
+    const auto value = QCborValue::fromCbor(array, &error);
+    if(error.error != QCborError::NoError)
+        return std::nullopt;
+    return value;
+}
+
+//request body in either wire format, as the object the factories and Update take
+template<typename T>
+static std::optional<QJsonObject> BodyToJSONObject(const QByteArray &body, WireFormat format)
+{
+    if(format == WireFormat::JSON)
+        return ByteArrayToBodyFields<T>(body);
+
+    const auto value = ByteArrayToCBOR(body);
+    if(!value.has_value() || !value.value().isMap())
+        return std::nullopt;
+    return value.value().toMap().toJsonObject();
+}
+
+static std::optional<QJsonArray> BodyToJSONArray(const QByteArray &body, WireFormat format)
+{
+    if(format == WireFormat::JSON)
+        return ByteArrayToJSONArray(body);
+
+    const auto value = ByteArrayToCBOR(body);
+    if(!value.has_value() || !value.value().isArray())
+        return std::nullopt;
+    return value.value().toArray().toJsonArray();
+}
+
+//streams the array, so peak memory is one record rather than the whole file and its DOM
 template<typename K = qint64, typename T = void>
 static IdMap<K, T> TryLoadFromFile(const FactoryFromJSON<T> &factory, const QString &path)
 {
-    const auto optionalByteArray = ReadFileToByteArray(path);
-
-    if(!optionalByteArray.has_value())
+    auto file = QFile{path};
+    if(!file.open(QIODevice::ReadOnly))
     {
         qDebug() << "Reading file " << path << "failed";
         return IdMap<K, T>();
     }
 
-    const auto optionalArray = ByteArrayToJSONArray(optionalByteArray.value());
-    if(!optionalArray.has_value())
+    auto data = IdMap<K, T>();
+    auto reader = JSONArrayStreamReader{file};
+    const auto valid = reader.ForEachObject([&factory, &data, &path](const QJsonObject &json, qint64 offset)
     {
-        qDebug() << "Content of file " << path << "is not a json array";
-        return IdMap<K, T>();
-    }
-
-    return IdMap<K, T>(factory, optionalArray.value());
-
+        const auto optional = factory.FromJSON(json);
+        if(optional.has_value())
+            data.insert(optional.value().id, optional.value());
+        else
+            qDebug() << "Record at byte" << offset << "of" << path << "is missing required fields";
+    });
+
+    if(!valid)
+        qDebug() << "Content of file " << path << "is not a json array:" << reader.ErrorString();
+    if(reader.MalformedCount())
+        qDebug() << reader.MalformedCount() << "malformed records skipped in" << path;
+
+    return data;
 }
 
 static QByteArray GetValueFromHeader(const QList<QPair<QByteArray, QByteArray>> &headers, QByteArrayView headerName)
@@ -79,4 +144,89 @@ static std::optional<QString> GetTokenFromRequest(const QHttpServerRequest &requ
     return token;
 }
 
+static std::optional<QUuid> GetTokenUuidFromHeaders(const QList<QPair<QByteArray, QByteArray>> &headers)
+{
+    const auto bytes = GetValueFromHeader(headers, "token");
+    if(bytes.isEmpty())
+        return std::nullopt;
+
+    const auto token = QUuid::fromString(QLatin1StringView(bytes));
+    if(token.isNull())
+        return std::nullopt;
+
+    return token;
+}
+
+static std::optional<QUuid> GetTokenUuidFromRequest(const QHttpServerRequest &request)
+{
+    return GetTokenUuidFromHeaders(request.headers());
+}
+
+//whether a comma separated header lists the media type without q=0, parameters of other types are ignored
+static bool ListsMediaType(const QByteArray &value, QByteArrayView mediaType)
+{
+    for(const auto &entry: value.split(','))
+    {
+        const auto parameters = entry.split(';');
+        if(parameters.first().trimmed().compare(mediaType, Qt::CaseInsensitive) != 0)
+            continue;
+
+        auto q = 1.0;
+        for(qsizetype i = 1; i < parameters.size(); ++i)
+        {
+            const auto parameter = parameters[i].trimmed();
+            if(parameter.startsWith("q=") || parameter.startsWith("Q="))
+                q = parameter.mid(2).toDouble();
+        }
+        return q > 0.0;
+    }
+    return false;
+}
+
+//cbor only when the client names it, anything else including */* gets json
+static WireFormat ResponseFormat(const QList<QPair<QByteArray, QByteArray>> &headers)
+{
+    return ListsMediaType(GetValueFromHeader(headers, "Accept"), "application/cbor") ? WireFormat::CBOR : WireFormat::JSON;
+}
+
+static WireFormat BodyFormat(const QList<QPair<QByteArray, QByteArray>> &headers)
+{
+    return ListsMediaType(GetValueFromHeader(headers, "Content-Type"), "application/cbor") ? WireFormat::CBOR : WireFormat::JSON;
+}
+
+//uncached responses are built as json objects and only converted when cbor was asked for
+//the body depends on Accept, which Vary tells shared caches
+static QHttpServerResponse FormattedResponse(const QJsonObject &json, WireFormat format,
+                                             QHttpServerResponder::StatusCode status = QHttpServerResponder::StatusCode::Ok)
+{
+    if(format == WireFormat::JSON)
+    {
+        auto response = QHttpServerResponse(json, status);
+        response.setHeader("Vary", "Accept");
+        return response;
+    }
+
+    const auto phase = PhaseScope(MetricsRegistry::Phase::Serialize);
+    auto response = QHttpServerResponse(MediaTypeOf(format), QCborValue::fromJsonValue(json).toCbor(), status);
+    response.setHeader("Vary", "Accept");
+    return response;
+}
+
+//400 whose body names the query parameter that was missing or malformed
+static QHttpServerResponse BadParameter(const QString &name, WireFormat format)
+{
+    return FormattedResponse(QJsonObject{{"error", "invalid parameter"}, {"parameter", name}}, format,
+                             QHttpServerResponder::StatusCode::BadRequest);
+}
+
+static QFuture<QHttpServerResponse> ReadyResponse(QHttpServerResponse &&response)
+{
+    auto promise = QPromise<QHttpServerResponse>{};
+    auto future = promise.future();
+    promise.start();
+    promise.addResult(std::move(response));
+    promise.finish();
+    return future;
+}
+
 #endif // APIUTILITY_HPP
@@ -0,0 +1,231 @@
+#ifndef ADMISSIONCONTROL_HPP
+#define ADMISSIONCONTROL_HPP
+
+#include<QElapsedTimer>
+#include<QHostAddress>
+#include<array>
+#include<atomic>
+#include<memory>
+
+#include"APIUtility.hpp"
+
+//limits of one route group, a zero turns that limit off
+struct RouteLimits
+{
+    double requestsPerSecond = 0; //per client
+    qint64 burst = 0;
+    qint64 maxInFlight = 0;       //for the whole group, including responses still waiting for the log
+    double addressRequestsPerSecond = 0; //per remote address across all its sessions, for routes admitted with one
+    qint64 addressBurst = 0;
+};
+
+static constexpr auto DEFAULT_READ_LIMITS = RouteLimits{50, 100, 1024};
+//an address gets a few sessions' worth of writes, minting more sessions does not raise it
+static constexpr auto DEFAULT_WRITE_LIMITS = RouteLimits{10, 20, 256, 40, 80};
+//sessions are free to start, so new ones are limited per address
+static constexpr auto DEFAULT_SESSION_LIMITS = RouteLimits{1, 10, 256};
+
+//token bucket per client kept as one theoretical arrival time (gcra), so a request costs one compare and swap
+//clients hash into a fixed slot table, a slot word is a 16 bit client fingerprint over a 48 bit time in microseconds
+//a client finding its slot taken by another active one probes a few neighbours, then shares the last one
+class RateLimiter
+{
+public:
+
+    static constexpr qsizetype SLOT_COUNT = 16384;
+    static constexpr int MAX_PROBES = 4;
+
+    explicit RateLimiter(double requestsPerSecond, qint64 burst) :
+        m_slots(std::make_unique<std::atomic<quint64>[]>(SLOT_COUNT)),
+        m_interval(qMax(qint64{1}, qint64(1000000 / requestsPerSecond))),
+        m_window(m_interval * qMax(qint64{1}, burst))
+    {
+        m_clock.start();
+    }
+
+    //0 when the request is admitted, otherwise the microseconds until the client may retry
+    qint64 Acquire(quint64 client)
+    {
+        const auto fingerprint = (client >> TIME_BITS) | 1;
+        for(;;)
+        {
+            const auto now = quint64(m_clock.nsecsElapsed() / 1000) + 1;
+
+            //the client's own slot first, else the first idle one, an idle slot has a full bucket
+            auto chosen = -1;
+            auto words = std::array<quint64, MAX_PROBES>{};
+            for(auto probe = 0; probe < MAX_PROBES; ++probe)
+            {
+                words[probe] = Slot(client, probe).load(std::memory_order_relaxed);
+                if((words[probe] >> TIME_BITS) == fingerprint)
+                {
+                    chosen = probe;
+                    break;
+                }
+                if(chosen < 0 && (words[probe] & TIME_MASK) <= now)
+                    chosen = probe;
+            }
+            if(chosen < 0)
+                chosen = MAX_PROBES - 1;
+
+            auto word = words[chosen];
+            const auto next = qMax(word & TIME_MASK, now) + quint64(m_interval);
+            if(next - now > quint64(m_window))
+                return qint64(next - now) - m_window;
+            if(Slot(client, chosen).compare_exchange_strong(word, (fingerprint << TIME_BITS) | next, std::memory_order_relaxed))
+                return 0;
+        }
+    }
+
+private:
+
+    static constexpr int TIME_BITS = 48;
+    static constexpr quint64 TIME_MASK = (quint64{1} << TIME_BITS) - 1;
+
+    std::atomic<quint64> &Slot(quint64 client, int probe)
+    {
+        return m_slots[(client + quint64(probe)) & (SLOT_COUNT - 1)];
+    }
+
+    std::unique_ptr<std::atomic<quint64>[]> m_slots;
+    qint64 m_interval;
+    qint64 m_window;
+    QElapsedTimer m_clock;
+};
+
+//admission of one route group: a rate limit per client, then shedding once too many requests are in flight
+//rejections are answered before the body is looked at, 429 for the client over its rate and 503 for overload
+class RouteGuard
+{
+public:
+
+    explicit RouteGuard(const RouteLimits &limits) :
+        m_maxInFlight(limits.maxInFlight)
+    {
+        if(limits.requestsPerSecond > 0)
+            m_limiter = std::make_unique<RateLimiter>(limits.requestsPerSecond, limits.burst);
+        if(limits.addressRequestsPerSecond > 0)
+            m_addressLimiter = std::make_unique<RateLimiter>(limits.addressRequestsPerSecond, limits.addressBurst);
+    }
+
+    RouteGuard(const RouteGuard &) = delete;
+    RouteGuard &operator=(const RouteGuard &) = delete;
+
+    //sessions are limited by their id, anonymous clients by their address
+    static quint64 ClientKey(const QHttpServerRequest &request, std::optional<qint64> sessionId)
+    {
+        const auto hash = sessionId.has_value()
+            ? qHash(sessionId.value(), 0x5e55) : qHash(request.remoteAddress(), 0xadd7);
+        //spread over all 64 bits, the fingerprint is taken from the top
+        return quint64(hash) * 0x9e3779b97f4a7c15ull;
+    }
+
+    static quint64 AddressKey(const QHttpServerRequest &request)
+    {
+        return ClientKey(request, std::nullopt);
+    }
+
+    //runs handler unless the request is turned away, the answer has the type the handler returns
+    template<typename Handler>
+    auto Admit(quint64 client, Handler &&handler) -> decltype(handler())
+    {
+        return Admit(client, std::nullopt, std::forward<Handler>(handler));
+    }
+
+    //address is charged as well as client, so a client minting sessions still shares its address' limit
+    template<typename Handler>
+    auto Admit(quint64 client, std::optional<quint64> address, Handler &&handler) -> decltype(handler())
+    {
+        using Result = decltype(handler());
+        auto rejection = Check(client, address);
+        if(rejection.has_value())
+        {
+            if constexpr(std::is_same_v<Result, QHttpServerResponse>)
+                return std::move(rejection.value());
+            else
+                return ReadyResponse(std::move(rejection.value()));
+        }
+        if(m_maxInFlight <= 0)
+            return handler();
+
+        if constexpr(std::is_same_v<Result, QHttpServerResponse>)
+        {
+            auto response = handler();
+            m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+            return response;
+        }
+        else
+        {
+            //deferred responses stay in flight until they are released, that is the queue being bounded
+            auto future = handler();
+            if(future.isFinished())
+            {
+                m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+                return future;
+            }
+            return future.then([this](QFuture<QHttpServerResponse> finished)
+            {
+                m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+                return finished.takeResult();
+            });
+        }
+    }
+
+    qint64 InFlight() const
+    {
+        return m_inFlight.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    //takes an in flight slot when admitted
+    std::optional<QHttpServerResponse> Check(quint64 client, std::optional<quint64> address)
+    {
+        if(m_limiter)
+        {
+            const auto retryUs = m_limiter->Acquire(client);
+            if(retryUs > 0)
+                return Rejection(QHttpServerResponder::StatusCode::TooManyRequests, (retryUs + 999999) / 1000000);
+        }
+        if(m_addressLimiter && address.has_value())
+        {
+            const auto retryUs = m_addressLimiter->Acquire(address.value());
+            if(retryUs > 0)
+                return Rejection(QHttpServerResponder::StatusCode::TooManyRequests, (retryUs + 999999) / 1000000);
+        }
+
+        if(m_maxInFlight > 0 && m_inFlight.fetch_add(1, std::memory_order_relaxed) >= m_maxInFlight)
+        {
+            m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+            return Rejection(QHttpServerResponder::StatusCode::ServiceUnavailable, 1);
+        }
+        return std::nullopt;
+    }
+
+    static QHttpServerResponse Rejection(QHttpServerResponder::StatusCode status, qint64 retryAfterSeconds)
+    {
+        auto response = QHttpServerResponse(status);
+        response.setHeader("Retry-After", QByteArray::number(retryAfterSeconds));
+        return response;
+    }
+
+    std::unique_ptr<RateLimiter> m_limiter;
+    std::unique_ptr<RateLimiter> m_addressLimiter;
+    qint64 m_maxInFlight;
+    std::atomic<qint64> m_inFlight{0};
+};
+
+//the route groups of AddCRUDRoutes, reads are the GET routes and writes everything that mutates
+//shared by every server loop, so the limits hold for the process and not per loop
+struct CRUDGuards
+{
+    explicit CRUDGuards(const RouteLimits &readLimits = DEFAULT_READ_LIMITS, const RouteLimits &writeLimits = DEFAULT_WRITE_LIMITS) :
+        reads(readLimits),
+        writes(writeLimits)
+    {}
+
+    RouteGuard reads;
+    RouteGuard writes;
+};
+
+#endif // ADMISSIONCONTROL_HPP
@@ -0,0 +1,451 @@
+#ifndef BINARYSNAPSHOT_HPP
+#define BINARYSNAPSHOT_HPP
+
+#include<QFile>
+#include<QSaveFile>
+#include<QtEndian>
+#include<array>
+#include<cstring>
+#include<utility>
+
+#include"APIUtility.hpp"
+
+//layout, all integers little endian
+//header  : magic[8] | quint32 version | quint32 native byte order tag | quint64 count | quint64 index offset
+//index   : count x (qint64 id | quint64 record offset), sorted by id
+//records : 8 byte aligned, fields written by BinaryCodec<T>, strings as quint32 length + utf-16 at an even offset
+//strings can be used in place from the mapping, so a lazily opened snapshot costs no parsing at all
+//the tag is written natively and rejects files from a host whose utf-16 would read swapped
+
+static constexpr char SNAPSHOT_MAGIC[8] = {'W', 'Q', 'S', 'N', 'A', 'P', '0', '1'};
+static constexpr quint32 SNAPSHOT_VERSION = 1;
+static constexpr quint32 SNAPSHOT_BYTE_ORDER = 0x01020304;
+static constexpr qint64 SNAPSHOT_HEADER_SIZE = 32;
+static constexpr qint64 SNAPSHOT_INDEX_ENTRY_SIZE = 16;
+
+class SnapshotWriter
+{
+public:
+
+    void WriteUInt32(quint32 value)
+    {
+        value = qToLittleEndian(value);
+        m_bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void WriteNativeUInt32(quint32 value)
+    {
+        m_bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void WriteInt64(qint64 value)
+    {
+        value = qToLittleEndian(value);
+        m_bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void WriteBool(bool value)
+    {
+        m_bytes.append(value ? '\1' : '\0');
+    }
+
+    void WriteString(const QString &value)
+    {
+        WriteUInt32(static_cast<quint32>(value.size()));
+        Align(2);
+        m_bytes.append(reinterpret_cast<const char *>(value.utf16()), value.size() * qsizetype(sizeof(char16_t)));
+    }
+
+    void Align(qsizetype alignment)
+    {
+        while(m_bytes.size() % alignment)
+            m_bytes.append('\0');
+    }
+
+    qsizetype Position() const
+    {
+        return m_bytes.size();
+    }
+
+    QByteArray &Bytes()
+    {
+        return m_bytes;
+    }
+
+private:
+
+    QByteArray m_bytes;
+};
+
+class SnapshotReader
+{
+public:
+
+    //zero copy strings point into the buffer and must not outlive it
+    explicit SnapshotReader(const char *begin, const char *end, qint64 offset, bool zeroCopy) :
+        m_begin(begin),
+        m_cursor(begin + offset),
+        m_end(end),
+        m_zeroCopy(zeroCopy)
+    {}
+
+    quint32 ReadUInt32()
+    {
+        return qFromLittleEndian(ReadNativeUInt32());
+    }
+
+    quint32 ReadNativeUInt32()
+    {
+        auto value = quint32{};
+        Read(&value, sizeof(value));
+        return value;
+    }
+
+    qint64 ReadInt64()
+    {
+        auto value = qint64{};
+        Read(&value, sizeof(value));
+        return qFromLittleEndian(value);
+    }
+
+    bool ReadBool()
+    {
+        auto value = char{};
+        Read(&value, sizeof(value));
+        return value != '\0';
+    }
+
+    QString ReadString()
+    {
+        const auto length = qsizetype(ReadUInt32());
+        if((m_cursor - m_begin) % 2)
+            ++m_cursor;
+        const auto bytes = length * qsizetype(sizeof(char16_t));
+        if(!m_ok || m_end - m_cursor < bytes)
+        {
+            m_ok = false;
+            return QString{};
+        }
+
+        const auto *data = reinterpret_cast<const QChar *>(m_cursor);
+        m_cursor += bytes;
+        return m_zeroCopy ? QString::fromRawData(data, length) : QString(data, length);
+    }
+
+    //for strings that end up in a process wide pool and so must not point into the buffer
+    QString ReadOwnedString()
+    {
+        const auto zeroCopy = std::exchange(m_zeroCopy, false);
+        auto value = ReadString();
+        m_zeroCopy = zeroCopy;
+        return value;
+    }
+
+    bool Ok() const
+    {
+        return m_ok;
+    }
+
+private:
+
+    void Read(void *destination, qsizetype size)
+    {
+        if(!m_ok || m_end - m_cursor < size)
+        {
+            m_ok = false;
+            memset(destination, 0, size);
+            return;
+        }
+        memcpy(destination, m_cursor, size);
+        m_cursor += size;
+    }
+
+    const char *m_begin;
+    const char *m_cursor;
+    const char *m_end;
+    bool m_zeroCopy;
+    bool m_ok = true;
+};
+
+//field layout of a snapshot record, specialized per struct
+template<typename T>
+struct BinaryCodec
+{
+    static constexpr bool Supported = false;
+};
+
+template<>
+struct BinaryCodec<Answer>
+{
+    static constexpr bool Supported = true;
+
+    static void Write(SnapshotWriter &writer, const Answer &answer)
+    {
+        writer.WriteInt64(answer.id);
+        writer.WriteBool(answer.isTrue);
+        writer.WriteString(answer.answerText);
+    }
+
+    static std::optional<Answer> Read(SnapshotReader &reader)
+    {
+        const auto id = reader.ReadInt64();
+        const auto isTrue = reader.ReadBool();
+        auto answer = Answer(reader.ReadString(), isTrue);
+        answer.id = id;
+        IdSequence<Answer>::Reserve(id);
+        return reader.Ok() ? std::optional<Answer>(answer) : std::nullopt;
+    }
+};
+
+template<>
+struct BinaryCodec<Category>
+{
+    static constexpr bool Supported = true;
+
+    static void Write(SnapshotWriter &writer, const Category &category)
+    {
+        writer.WriteInt64(category.id);
+        writer.WriteString(category.categoryText);
+        writer.WriteString(category.iconUrl.toString());
+    }
+
+    static std::optional<Category> Read(SnapshotReader &reader)
+    {
+        const auto id = reader.ReadInt64();
+        const auto categoryText = reader.ReadString();
+        auto category = Category(categoryText, QUrl(reader.ReadString()));
+        category.id = id;
+        IdSequence<Category>::Reserve(id);
+        return reader.Ok() ? std::optional<Category>(category) : std::nullopt;
+    }
+};
+
+template<>
+struct BinaryCodec<Question>
+{
+    static constexpr bool Supported = true;
+
+    static void Write(SnapshotWriter &writer, const Question &question)
+    {
+        writer.WriteInt64(question.id);
+        writer.WriteString(question.questionText);
+        //the record layout embeds the whole category, only its id is read back
+        const auto category = CategoryDirectory::Instance().Find(question.categoryId);
+        writer.WriteInt64(question.categoryId);
+        writer.WriteString(category.has_value() ? category.value().categoryText : QString());
+        writer.WriteString(category.has_value() ? category.value().iconUrl.toString() : QString());
+        writer.WriteUInt32(static_cast<quint32>(question.answers.size()));
+        for(const auto &answer: question.answers)
+        {
+            writer.WriteInt64(answer.id);
+            writer.WriteBool(answer.isTrue);
+            writer.WriteString(answer.AnswerText());
+        }
+    }
+
+    //the category is referred to by id, answer texts go through the pool so shared values are stored once again
+    static std::optional<Question> Read(SnapshotReader &reader)
+    {
+        const auto id = reader.ReadInt64();
+        const auto questionText = reader.ReadString();
+        const auto categoryId = reader.ReadInt64();
+        reader.ReadString();
+        reader.ReadString();
+        if(!reader.Ok())
+            return std::nullopt;
+
+        auto answers = QList<AnswerRecord>{};
+        const auto answerCount = reader.ReadUInt32();
+        for(quint32 i = 0; i < answerCount && reader.Ok(); ++i)
+        {
+            const auto answerId = reader.ReadInt64();
+            const auto isTrue = reader.ReadBool();
+            const auto answerText = reader.ReadOwnedString();
+            IdSequence<Answer>::Reserve(answerId);
+            const auto answerTextRef = AnswerTextPool::Instance().Intern(answerText, [&answerText](){ return answerText; });
+            if(!answerTextRef.has_value())
+                return std::nullopt;
+            answers.append(AnswerRecord{answerId, answerTextRef.value(), isTrue});
+        }
+
+        auto question = Question(questionText, categoryId, answers);
+        question.id = id;
+        IdSequence<Question>::Reserve(id);
+        return reader.Ok() ? std::optional<Question>(question) : std::nullopt;
+    }
+};
+
+template<typename K = qint64, typename T = void, typename = enable_if_t<BinaryCodec<T>::Supported>>
+static QByteArray SerializeBinarySnapshot(const IdMap<K, T> &data)
+{
+    auto writer = SnapshotWriter{};
+    writer.Bytes().append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writer.WriteUInt32(SNAPSHOT_VERSION);
+    writer.WriteNativeUInt32(SNAPSHOT_BYTE_ORDER);
+    writer.WriteInt64(data.size());
+    writer.WriteInt64(SNAPSHOT_HEADER_SIZE);
+
+    //index is reserved first and filled once the record offsets are known
+    const auto indexOffset = writer.Position();
+    writer.Bytes().append(QByteArray(data.size() * SNAPSHOT_INDEX_ENTRY_SIZE, '\0'));
+
+    auto entry = qsizetype{0};
+    for(auto item = data.constBegin(); item != data.constEnd(); ++item, ++entry)
+    {
+        writer.Align(8);
+        const auto indexEntry = std::array<qint64, 2>{qToLittleEndian(qint64(item.key())), qToLittleEndian(qint64(writer.Position()))};
+        memcpy(writer.Bytes().data() + indexOffset + entry * SNAPSHOT_INDEX_ENTRY_SIZE, indexEntry.data(), SNAPSHOT_INDEX_ENTRY_SIZE);
+        BinaryCodec<T>::Write(writer, item.value());
+    }
+
+    return writer.Bytes();
+}
+
+static bool IsBinarySnapshot(const QByteArray &prefix)
+{
+    return prefix.startsWith(QByteArrayView(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)));
+}
+
+//read-only view over a mapped snapshot file
+//items are materialized on demand, lazily materialized strings point into the mapping
+template<typename K = qint64, typename T = void, typename = enable_if_t<BinaryCodec<T>::Supported>>
+class MappedSnapshot
+{
+public:
+
+    explicit MappedSnapshot(const QString &path) :
+        m_file(path)
+    {
+        if(!m_file.open(QIODevice::ReadOnly) || m_file.size() < SNAPSHOT_HEADER_SIZE)
+            return;
+
+        m_begin = reinterpret_cast<const char *>(m_file.map(0, m_file.size()));
+        if(!m_begin)
+            return;
+        m_end = m_begin + m_file.size();
+
+        auto header = SnapshotReader(m_begin, m_end, sizeof(SNAPSHOT_MAGIC), false);
+        const auto version = header.ReadUInt32();
+        const auto byteOrder = header.ReadNativeUInt32();
+        m_count = header.ReadInt64();
+        m_indexOffset = header.ReadInt64();
+
+        //the index has to lie between the header and the end of the mapping, checked without multiplying untrusted values
+        m_valid = IsBinarySnapshot(QByteArray::fromRawData(m_begin, sizeof(SNAPSHOT_MAGIC)))
+                  && header.Ok()
+                  && version == SNAPSHOT_VERSION
+                  && byteOrder == SNAPSHOT_BYTE_ORDER
+                  && m_count >= 0
+                  && m_indexOffset >= SNAPSHOT_HEADER_SIZE
+                  && m_indexOffset <= m_end - m_begin
+                  && m_count <= (m_end - m_begin - m_indexOffset) / SNAPSHOT_INDEX_ENTRY_SIZE;
+    }
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    bool IsValid() const
+    {
+        return m_valid;
+    }
+
+    qint64 Size() const
+    {
+        return m_valid ? m_count : 0;
+    }
+
+    K IdAt(qint64 index) const
+    {
+        return static_cast<K>(IndexEntry(index, 0));
+    }
+
+    std::optional<T> At(qint64 index, bool zeroCopy = true) const
+    {
+        if(!m_valid || index < 0 || index >= m_count)
+            return std::nullopt;
+
+        const auto offset = IndexEntry(index, 1);
+        if(offset < SNAPSHOT_HEADER_SIZE || offset >= m_end - m_begin)
+            return std::nullopt;
+
+        auto reader = SnapshotReader(m_begin, m_end, offset, zeroCopy);
+        return BinaryCodec<T>::Read(reader);
+    }
+
+    //binary search over the id index, nothing else is touched
+    std::optional<T> Find(const K &id, bool zeroCopy = true) const
+    {
+        auto low = qint64{0};
+        auto high = Size();
+        while(low < high)
+        {
+            const auto middle = low + (high - low) / 2;
+            if(IdAt(middle) < id)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        if(low >= Size() || IdAt(low) != id)
+            return std::nullopt;
+        return At(low, zeroCopy);
+    }
+
+    //eager mode, strings are copied so the map outlives the file
+    IdMap<K, T> ToIdMap() const
+    {
+        auto data = IdMap<K, T>{};
+        for(auto i = qint64{0}; i < Size(); ++i)
+        {
+            const auto optionalItem = At(i, false);
+            if(!optionalItem.has_value())
+            {
+                qDebug() << "Snapshot" << m_file.fileName() << "is corrupt at record" << i;
+                break;
+            }
+            data.insert(optionalItem.value().id, optionalItem.value());
+        }
+        return data;
+    }
+
+private:
+
+    qint64 IndexEntry(qint64 index, int field) const
+    {
+        auto value = qint64{};
+        memcpy(&value, m_begin + m_indexOffset + index * SNAPSHOT_INDEX_ENTRY_SIZE + field * sizeof(qint64), sizeof(value));
+        return qFromLittleEndian(value);
+    }
+
+    QFile m_file;
+    const char *m_begin = nullptr;
+    const char *m_end = nullptr;
+    qint64 m_count = 0;
+    qint64 m_indexOffset = 0;
+    bool m_valid = false;
+};
+
+template<typename K = qint64, typename T = void>
+static bool WriteBinarySnapshot(const IdMap<K, T> &data, const QString &path)
+{
+    const auto bytes = SerializeBinarySnapshot(data);
+    auto file = QSaveFile{path};
+    return file.open(QIODevice::WriteOnly) && file.write(bytes) == bytes.size() && file.commit();
+}
+
+//converter from the json assets
+template<typename K = qint64, typename T = void>
+static bool ConvertJSONToSnapshot(const FactoryFromJSON<T> &factory, const QString &jsonPath, const QString &snapshotPath)
+{
+    const auto data = TryLoadFromFile<K, T>(factory, jsonPath);
+    if(!WriteBinarySnapshot(data, snapshotPath))
+    {
+        qDebug() << "Writing snapshot" << snapshotPath << "failed";
+        return false;
+    }
+
+    qDebug() << "Converted" << data.size() << "items from" << jsonPath << "to" << snapshotPath;
+    return true;
+}
+
+#endif // BINARYSNAPSHOT_HPP
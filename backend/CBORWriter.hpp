@@ -0,0 +1,109 @@
+#ifndef CBORWRITER_HPP
+#define CBORWRITER_HPP
+
+#include<QCborStreamWriter>
+#include<QCborValue>
+#include<cmath>
+
+#include"JSONFields.hpp"
+
+//how bodies travel, json unless a client asks for cbor
+enum class WireFormat
+{
+    JSON,
+    CBOR,
+    Count
+};
+
+static constexpr int WIRE_FORMAT_COUNT = int(WireFormat::Count);
+
+static QByteArray MediaTypeOf(WireFormat format)
+{
+    return format == WireFormat::CBOR ? "application/cbor" : "application/json";
+}
+
+//same interface as JSONWriter, the json data model streamed out as cbor
+//maps and arrays are indefinite length so nothing has to be counted up front
+class CBORWriter
+{
+public:
+
+    explicit CBORWriter(QByteArray &buffer) :
+        m_writer(&buffer)
+    {}
+
+    void BeginObject()
+    {
+        m_writer.startMap();
+    }
+
+    void EndObject()
+    {
+        m_writer.endMap();
+    }
+
+    void BeginArray()
+    {
+        m_writer.startArray();
+    }
+
+    void EndArray()
+    {
+        m_writer.endArray();
+    }
+
+    void Key(const char *name)
+    {
+        m_writer.append(QLatin1StringView(name));
+    }
+
+    void Key(QStringView name)
+    {
+        m_writer.append(name);
+    }
+
+    void Null()
+    {
+        m_writer.append(nullptr);
+    }
+
+    void Bool(bool value)
+    {
+        m_writer.append(value);
+    }
+
+    void Integer(qint64 value)
+    {
+        m_writer.append(value);
+    }
+
+    //integral values go out as integers, as JSONWriter prints them
+    void Double(double value)
+    {
+        if(std::isfinite(value) && std::trunc(value) == value && std::fabs(value) < 9007199254740992.0)
+            return Integer(qint64(value));
+        m_writer.append(value);
+    }
+
+    void String(QStringView value)
+    {
+        m_writer.append(value);
+    }
+
+    void Value(const QJsonValue &value)
+    {
+        QCborValue::fromJsonValue(value).toCbor(m_writer);
+    }
+
+    template<typename Item>
+    void Write(const Item &item)
+    {
+        WriteItem(*this, item);
+    }
+
+private:
+
+    QCborStreamWriter m_writer;
+};
+
+#endif // CBORWRITER_HPP
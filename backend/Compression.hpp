@@ -0,0 +1,165 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include<QByteArray>
+#include<QList>
+#include<QtEndian>
+#include<array>
+#include<optional>
+
+#ifdef HAVE_ZSTD
+#include<zstd.h>
+#endif
+
+//content codings a response body can be sent in, identity is the raw body
+enum class ContentEncoding
+{
+    Identity,
+    Deflate,
+    Gzip,
+    Zstd,
+    Count
+};
+
+static constexpr int CONTENT_ENCODING_COUNT = int(ContentEncoding::Count);
+
+//bodies below this size go out raw, the coding overhead would eat most of the gain
+static constexpr qsizetype MIN_COMPRESSED_SIZE = 1024;
+
+//compressed bodies are cached per version, so the slower, denser levels are worth it
+static constexpr int DEFLATE_LEVEL = 9;
+static constexpr int ZSTD_LEVEL = 15;
+
+static constexpr bool EncodingSupported(ContentEncoding encoding)
+{
+#ifdef HAVE_ZSTD
+    return encoding != ContentEncoding::Count;
+#else
+    return encoding != ContentEncoding::Count && encoding != ContentEncoding::Zstd;
+#endif
+}
+
+static QByteArray EncodingName(ContentEncoding encoding)
+{
+    switch(encoding)
+    {
+    case ContentEncoding::Deflate: return "deflate";
+    case ContentEncoding::Gzip: return "gzip";
+    case ContentEncoding::Zstd: return "zstd";
+    default: return "identity";
+    }
+}
+
+//highest q value wins, ties go to the denser coding, identity is always acceptable as a last resort
+static ContentEncoding NegotiateEncoding(const QByteArray &acceptEncoding)
+{
+    if(acceptEncoding.isEmpty())
+        return ContentEncoding::Identity;
+
+    auto quality = std::array<std::optional<double>, CONTENT_ENCODING_COUNT>{};
+    auto wildcard = std::optional<double>{};
+    for(const auto &entry: acceptEncoding.split(','))
+    {
+        const auto parameters = entry.split(';');
+        const auto coding = parameters.first().trimmed().toLower();
+        auto q = 1.0;
+        for(qsizetype i = 1; i < parameters.size(); ++i)
+        {
+            const auto parameter = parameters[i].trimmed();
+            if(parameter.startsWith("q=") || parameter.startsWith("Q="))
+                q = parameter.mid(2).toDouble();
+        }
+
+        if(coding == "*")
+            wildcard = q;
+        else if(coding == "gzip" || coding == "x-gzip")
+            quality[int(ContentEncoding::Gzip)] = q;
+        else if(coding == "deflate")
+            quality[int(ContentEncoding::Deflate)] = q;
+        else if(coding == "zstd")
+            quality[int(ContentEncoding::Zstd)] = q;
+    }
+
+    auto best = ContentEncoding::Identity;
+    auto bestQuality = 0.0;
+    for(const auto encoding: {ContentEncoding::Zstd, ContentEncoding::Gzip, ContentEncoding::Deflate})
+    {
+        const auto q = quality[int(encoding)].has_value() ? quality[int(encoding)] : wildcard;
+        if(EncodingSupported(encoding) && q.value_or(0.0) > bestQuality)
+        {
+            best = encoding;
+            bestQuality = q.value();
+        }
+    }
+    return best;
+}
+
+//crc-32 as gzip trails its members with, table driven
+static quint32 Crc32(const QByteArray &data)
+{
+    static constexpr auto table = []()
+    {
+        auto entries = std::array<quint32, 256>{};
+        for(quint32 i = 0; i < 256; ++i)
+        {
+            auto crc = i;
+            for(auto bit = 0; bit < 8; ++bit)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+
+    auto crc = 0xffffffffu;
+    for(const auto byte: data)
+        crc = table[(crc ^ quint8(byte)) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+//qCompress gives a zlib stream behind a 4 byte length, which is exactly http deflate once the length is cut
+//gzip wraps the raw deflate data of that stream, without the 2 byte zlib header and the adler-32 trailer
+static std::optional<QByteArray> Compress(const QByteArray &body, ContentEncoding encoding)
+{
+    switch(encoding)
+    {
+    case ContentEncoding::Deflate:
+    {
+        const auto zlib = qCompress(body, DEFLATE_LEVEL);
+        if(zlib.size() <= 4)
+            return std::nullopt;
+        return zlib.mid(4);
+    }
+    case ContentEncoding::Gzip:
+    {
+        const auto zlib = qCompress(body, DEFLATE_LEVEL);
+        if(zlib.size() <= 4 + 2 + 4)
+            return std::nullopt;
+
+        static constexpr char HEADER[] = {'\x1f', '\x8b', '\x08', '\x00', '\x00', '\x00', '\x00', '\x00', '\x02', '\xff'};
+        auto gzip = QByteArray{};
+        gzip.reserve(sizeof(HEADER) + zlib.size() + 8);
+        gzip.append(HEADER, sizeof(HEADER));
+        gzip.append(zlib.constData() + 4 + 2, zlib.size() - 4 - 2 - 4);
+        auto trailer = std::array<char, 8>{};
+        qToLittleEndian(Crc32(body), trailer.data());
+        qToLittleEndian(quint32(body.size()), trailer.data() + 4);
+        gzip.append(trailer.data(), trailer.size());
+        return gzip;
+    }
+#ifdef HAVE_ZSTD
+    case ContentEncoding::Zstd:
+    {
+        auto zstd = QByteArray(qsizetype(ZSTD_compressBound(size_t(body.size()))), Qt::Uninitialized);
+        const auto size = ZSTD_compress(zstd.data(), size_t(zstd.size()), body.constData(), size_t(body.size()), ZSTD_LEVEL);
+        if(ZSTD_isError(size))
+            return std::nullopt;
+        zstd.truncate(qsizetype(size));
+        return zstd;
+    }
+#endif
+    default:
+        return std::nullopt;
+    }
+}
+
+#endif // COMPRESSION_HPP
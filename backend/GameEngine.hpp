@@ -0,0 +1,326 @@
+#ifndef GAMEENGINE_HPP
+#define GAMEENGINE_HPP
+
+#include"QuizAPI.hpp"
+
+//a question reduced to what grading needs
+//bit i of a mask stands for the i-th answer, so a response is right when its mask equals the correct one
+struct CompiledQuestion
+{
+    static constexpr qsizetype MAX_ANSWERS = 64;
+
+    quint64 correctMask = 0;
+    QVarLengthArray<qint64, 4> answerIds;
+
+    static CompiledQuestion FromQuestion(const Question &question)
+    {
+        auto compiled = CompiledQuestion{};
+        const auto answerCount = qMin(question.answers.size(), MAX_ANSWERS);
+        for(qsizetype i = 0; i < answerCount; ++i)
+        {
+            compiled.answerIds.append(question.answers[i].id);
+            if(question.answers[i].isTrue)
+                compiled.correctMask |= quint64{1} << i;
+        }
+        return compiled;
+    }
+
+    //unknown answer ids can never match
+    quint64 MaskOf(const QJsonArray &submitted) const
+    {
+        auto mask = quint64{0};
+        for(const auto &answerId: submitted)
+        {
+            const auto answer = std::find(answerIds.cbegin(), answerIds.cend(), answerId.toInteger(-1));
+            if(answer == answerIds.cend())
+                return ~quint64{0};
+            mask |= quint64{1} << (answer - answerIds.cbegin());
+        }
+        return mask;
+    }
+};
+
+//one running quiz per session plus the session's running totals
+//both are kept by session id in bounded maps, grading is an xor per question
+//a game is dropped once it is graded, idle for GAME_IDLE_MS or the oldest when MAX_GAMES are running,
+//totals of the session that played longest ago go once MAX_TOTALS sessions have some
+class GameEngine
+{
+public:
+
+    static constexpr qsizetype MAX_GAMES = qsizetype{1} << 16;
+    static constexpr qsizetype MAX_TOTALS = qsizetype{1} << 20;
+    static constexpr qint64 GAME_IDLE_MS = 15 * 60 * 1000;
+
+    struct Totals : public JSONable
+    {
+        qint64 games = 0;
+        qint64 answered = 0;
+        qint64 correct = 0;
+
+        QJsonObject ToJSON() const override
+        {
+            return QJsonObject
+                {
+                    {"games", games},
+                    {"answered", answered},
+                    {"correct", correct}
+                };
+        }
+    };
+
+    explicit GameEngine(CRUDAPI<qint64, Question> &questions, QuizAPI &quiz) :
+        m_questions(questions),
+        m_quiz(quiz),
+        m_games(MAX_GAMES),
+        m_totals(MAX_TOTALS)
+    {
+        m_questions.AddChangeListener([this](const qint64 &questionId, const Question *, const Question *after)
+        {
+            auto locker = QMutexLocker(&m_mutex);
+            if(after)
+                m_compiled.insert(questionId, CompiledQuestion::FromQuestion(*after));
+            else
+                m_compiled.remove(questionId);
+        });
+    }
+
+    //called with the session's new total after every graded game, under the engine's lock
+    using ScoreListener = std::function<void(qint64, qint64)>;
+
+    void AddScoreListener(ScoreListener listener)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_scoreListeners.append(std::move(listener));
+    }
+
+    GameEngine(const GameEngine &) = delete;
+    GameEngine &operator=(const GameEngine &) = delete;
+
+    //body {"category": <id>, "count": <n>}, a running game of the session is abandoned
+    //bodies and responses come in either wire format like on every other route
+    QHttpServerResponse StartGame(qint64 sessionId, const QHttpServerRequest &request)
+    {
+        const auto &headers = request.headers();
+        return StartGame(sessionId, request.body(), BodyFormat(headers), ResponseFormat(headers));
+    }
+
+    QHttpServerResponse StartGame(qint64 sessionId, const QByteArray &body, WireFormat bodyFormat = WireFormat::JSON, WireFormat responseFormat = WireFormat::JSON)
+    {
+        const auto optionalJson = BodyToJSONObject<QJsonObject>(body, bodyFormat);
+        if(!optionalJson.has_value())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+        const auto json = optionalJson.value();
+        const auto categoryId = json.value("category").toInteger(-1);
+        const auto count = json.value("count").toInteger(8);
+        if(categoryId < 0 || count < 1 || count > QuestionIndex::MAX_DRAW)
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+        auto draw = m_quiz.DrawQuestions(categoryId, count, sessionId, false);
+        if(draw.questionIds.isEmpty())
+            draw = m_quiz.DrawQuestions(categoryId, count, sessionId, true);
+        if(draw.questionIds.isEmpty())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
+
+        const auto items = m_questions.ItemsToJSON(draw.questionIds);
+
+        auto locker = QMutexLocker(&m_mutex);
+        auto &game = m_games.Touch(sessionId);
+        game = Game{};
+
+        //items come in their public form without isTrue, exactly the questions that were sent are graded
+        auto questionsJson = QJsonArray{};
+        for(const auto &item: items)
+        {
+            const auto question = item.toObject();
+            const auto compiled = m_compiled.constFind(question.value("id").toInteger());
+            if(compiled == m_compiled.constEnd())
+                continue;
+            game.questions.append(compiled.value());
+            questionsJson.append(question);
+        }
+
+        //the timer runs on this thread's event loop, a game started again in between is left alone
+        TimerWheel::ForCurrentThread().Schedule(GAME_IDLE_MS, [this, sessionId, stamp = m_games.StampOf(sessionId)]()
+        {
+            auto locker = QMutexLocker(&m_mutex);
+            m_games.RemoveIfStamp(sessionId, stamp);
+        });
+
+        return FormattedResponse(QJsonObject
+            {
+                {"category", categoryId},
+                {"count", questionsJson.size()},
+                {"data", questionsJson}
+            }, responseFormat);
+    }
+
+    //body {"answers": [[<answer id>, ...], ...]} in the order the questions were handed out
+    QHttpServerResponse SubmitAnswers(qint64 sessionId, const QHttpServerRequest &request)
+    {
+        const auto &headers = request.headers();
+        return SubmitAnswers(sessionId, request.body(), BodyFormat(headers), ResponseFormat(headers));
+    }
+
+    QHttpServerResponse SubmitAnswers(qint64 sessionId, const QByteArray &body, WireFormat bodyFormat = WireFormat::JSON, WireFormat responseFormat = WireFormat::JSON)
+    {
+        const auto optionalJson = BodyToJSONObject<QJsonObject>(body, bodyFormat);
+        if(!optionalJson.has_value() || !optionalJson.value().value("answers").isArray())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+        const auto answers = optionalJson.value().value("answers").toArray();
+
+        auto locker = QMutexLocker(&m_mutex);
+        const auto *running = m_games.Find(sessionId);
+        if(!running)
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::Conflict);
+
+        //a copy, the game is dropped as soon as it is graded
+        const auto game = *running;
+        if(answers.size() != game.questions.size())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+        auto submitted = QVarLengthArray<quint64, QuestionIndex::MAX_DRAW>(game.questions.size());
+        for(qsizetype i = 0; i < game.questions.size(); ++i)
+        {
+            const auto answer = answers.at(i);
+            submitted[i] = game.questions[i].MaskOf(answer.isArray() ? answer.toArray() : QJsonArray{answer});
+        }
+
+        m_games.Remove(sessionId);
+        const auto results = Grade(game, submitted.constData());
+        auto &totals = m_totals.Touch(sessionId);
+        ++totals.games;
+        totals.answered += game.questions.size();
+        totals.correct += results.correct;
+        for(const auto &listener: m_scoreListeners)
+            listener(sessionId, totals.correct);
+
+        auto correctJson = QJsonArray{};
+        for(qsizetype i = 0; i < game.questions.size(); ++i)
+            correctJson.append(results.mismatches[i] == 0);
+
+        return FormattedResponse(QJsonObject
+            {
+                {"score", results.correct},
+                {"total", game.questions.size()},
+                {"correct", correctJson},
+                {"totals", totals.ToJSON()}
+            }, responseFormat);
+    }
+
+    QHttpServerResponse GetTotals(qint64 sessionId, WireFormat responseFormat = WireFormat::JSON) const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto *totals = m_totals.Find(sessionId);
+        auto json = totals ? totals->ToJSON() : Totals{}.ToJSON();
+        json.insert("active", m_games.Find(sessionId) != nullptr);
+        return FormattedResponse(json, responseFormat);
+    }
+
+private:
+
+    struct Game
+    {
+        QList<CompiledQuestion> questions;
+    };
+
+    //values by session id, each touch stamps its entry and a full map drops the entry stamped first
+    template<typename V>
+    class SessionMap
+    {
+    public:
+
+        explicit SessionMap(qsizetype capacity) :
+            m_capacity(capacity)
+        {}
+
+        const V *Find(qint64 sessionId) const
+        {
+            const auto entry = m_entries.constFind(sessionId);
+            return entry == m_entries.constEnd() ? nullptr : &entry.value().value;
+        }
+
+        //the entry of the session, made when missing
+        V &Touch(qint64 sessionId)
+        {
+            auto entry = m_entries.find(sessionId);
+            if(entry != m_entries.end())
+                m_order.remove(entry.value().stamp);
+            else
+            {
+                if(m_entries.size() >= m_capacity)
+                    m_entries.remove(m_order.take(m_order.firstKey()));
+                entry = m_entries.insert(sessionId, Entry{});
+            }
+
+            entry.value().stamp = ++m_lastStamp;
+            m_order.insert(m_lastStamp, sessionId);
+            return entry.value().value;
+        }
+
+        quint64 StampOf(qint64 sessionId) const
+        {
+            return m_entries.value(sessionId).stamp;
+        }
+
+        void Remove(qint64 sessionId)
+        {
+            const auto entry = m_entries.constFind(sessionId);
+            if(entry == m_entries.constEnd())
+                return;
+            m_order.remove(entry.value().stamp);
+            m_entries.erase(entry);
+        }
+
+        //only while the entry was not touched since the stamp was taken
+        void RemoveIfStamp(qint64 sessionId, quint64 stamp)
+        {
+            const auto entry = m_entries.constFind(sessionId);
+            if(entry != m_entries.constEnd() && entry.value().stamp == stamp)
+                Remove(sessionId);
+        }
+
+    private:
+
+        struct Entry
+        {
+            V value;
+            quint64 stamp = 0;
+        };
+
+        qsizetype m_capacity;
+        quint64 m_lastStamp = 0;
+        QHash<qint64, Entry> m_entries;
+        QMap<quint64, qint64> m_order;
+    };
+
+    struct Results
+    {
+        QVarLengthArray<quint64, QuestionIndex::MAX_DRAW> mismatches;
+        qint64 correct = 0;
+    };
+
+    //one xor per question, a zero difference is a right answer
+    static Results Grade(const Game &game, const quint64 *submitted)
+    {
+        auto results = Results{};
+        results.mismatches.resize(game.questions.size());
+        for(qsizetype i = 0; i < game.questions.size(); ++i)
+        {
+            results.mismatches[i] = game.questions[i].correctMask ^ submitted[i];
+            results.correct += results.mismatches[i] == 0;
+        }
+        return results;
+    }
+
+    CRUDAPI<qint64, Question> &m_questions;
+    QuizAPI &m_quiz;
+    mutable QMutex m_mutex;
+    QHash<qint64, CompiledQuestion> m_compiled;
+    SessionMap<Game> m_games;
+    SessionMap<Totals> m_totals;
+    QList<ScoreListener> m_scoreListeners;
+};
+
+#endif // GAMEENGINE_HPP
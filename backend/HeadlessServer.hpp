@@ -0,0 +1,194 @@
+#ifndef HEADLESSSERVER_HPP
+#define HEADLESSSERVER_HPP
+
+#include<QCoreApplication>
+#include<QElapsedTimer>
+#include<QFile>
+#include<QSemaphore>
+#include<QTcpServer>
+#include<QThread>
+#include<QTimer>
+#include<atomic>
+#include<functional>
+#include<memory>
+#include<vector>
+
+#ifdef Q_OS_UNIX
+#include<netinet/in.h>
+#include<sys/socket.h>
+#include<unistd.h>
+#endif
+
+#include"APISetup.hpp"
+
+//resident set size of the process in bytes, 0 where it cannot be read
+static qint64 ResidentSetSize()
+{
+    auto status = QFile{"/proc/self/status"};
+    if(!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return 0;
+
+    for(const auto &line: status.readAll().split('\n'))
+    {
+        if(line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').value(0).toLongLong() * 1024;
+    }
+    return 0;
+}
+
+//listening socket that several loops can open on the same port, the kernel spreads connections over them
+//returns -1 when SO_REUSEPORT is not available
+static qintptr OpenReusePortSocket(quint16 port)
+{
+#if defined(Q_OS_UNIX) && defined(SO_REUSEPORT)
+    const auto descriptor = ::socket(AF_INET, SOCK_STREAM, 0);
+    if(descriptor < 0)
+        return -1;
+
+    const auto enable = 1;
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(::setsockopt(descriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0
+        || ::setsockopt(descriptor, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0
+        || ::bind(descriptor, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0
+        || ::listen(descriptor, SOMAXCONN) < 0)
+    {
+        ::close(descriptor);
+        return -1;
+    }
+    return descriptor;
+#else
+    Q_UNUSED(port);
+    return -1;
+#endif
+}
+
+//one QHttpServer with its own event loop, every loop registers the same routes over the shared apis
+class ServerLoop : public QThread
+{
+public:
+
+    using RouteSetup = std::function<void(QHttpServer &)>;
+
+    explicit ServerLoop(int index, quint16 port, RouteSetup setup, QSemaphore &ready) :
+        m_index(index),
+        m_port(port),
+        m_setup(std::move(setup)),
+        m_ready(ready)
+    {
+        setObjectName(QString("server-loop-%1").arg(index));
+    }
+
+    bool IsListening() const
+    {
+        return m_listening.load(std::memory_order_acquire);
+    }
+
+    qint64 Requests() const
+    {
+        return m_requests.load(std::memory_order_relaxed);
+    }
+
+protected:
+
+    void run() override
+    {
+        auto httpServer = QHttpServer{};
+        m_setup(httpServer);
+        httpServer.afterRequest([this](QHttpServerResponse &&response)
+        {
+            m_requests.fetch_add(1, std::memory_order_relaxed);
+            return std::move(response);
+        });
+
+        //without SO_REUSEPORT only the first loop can own the port
+        auto tcpServer = std::make_unique<QTcpServer>();
+        const auto descriptor = OpenReusePortSocket(m_port);
+        const auto listening = descriptor >= 0
+            ? tcpServer->setSocketDescriptor(descriptor)
+            : m_index == 0 && tcpServer->listen(QHostAddress::Any, m_port);
+#ifdef Q_OS_UNIX
+        if(descriptor >= 0 && !listening)
+            ::close(descriptor);
+#endif
+
+        if(listening)
+            httpServer.bind(tcpServer.release());
+        m_listening.store(listening, std::memory_order_release);
+        m_ready.release();
+
+        if(listening)
+            exec();
+    }
+
+private:
+
+    int m_index;
+    quint16 m_port;
+    RouteSetup m_setup;
+    QSemaphore &m_ready;
+    std::atomic<bool> m_listening{false};
+    std::atomic<qint64> m_requests{0};
+};
+
+//runs without the widget stack, startup, rss and request rate go to the debug output
+static int RunHeadless(QCoreApplication &application, int loopCount, quint16 port, const ServerLoop::RouteSetup &setup,
+                       const QElapsedTimer &startupTimer, qint64 reportIntervalMs = 10000)
+{
+    auto ready = QSemaphore{};
+    auto loops = std::vector<std::unique_ptr<ServerLoop>>{};
+    for(auto i = 0; i < loopCount; ++i)
+    {
+        loops.push_back(std::make_unique<ServerLoop>(i, port, setup, ready));
+        loops.back()->start();
+    }
+    ready.acquire(loopCount);
+
+    auto listening = 0;
+    for(const auto &loop: loops)
+        listening += loop->IsListening();
+    if(listening == 0)
+    {
+        qDebug() << "Server failed to start";
+        for(const auto &loop: loops)
+            loop->wait();
+        return 1;
+    }
+
+    qDebug() << QString("Headless server on port %1 with %2 of %3 loops listening, ready in %4 ms, rss %5 MiB")
+                    .arg(port).arg(listening).arg(loopCount).arg(startupTimer.elapsed())
+                    .arg(ResidentSetSize() / (1024.0 * 1024.0), 0, 'f', 1);
+
+    auto reportTimer = QTimer{};
+    auto intervalTimer = QElapsedTimer{};
+    auto lastRequests = qint64{0};
+    intervalTimer.start();
+    QObject::connect(&reportTimer, &QTimer::timeout, [&loops, &intervalTimer, &lastRequests]()
+    {
+        auto requests = qint64{0};
+        for(const auto &loop: loops)
+            requests += loop->Requests();
+
+        const auto seconds = intervalTimer.restart() / 1000.0;
+        const auto rate = seconds > 0 ? (requests - lastRequests) / seconds : 0.0;
+        lastRequests = requests;
+        qDebug() << QString("%1 requests/s over %2 loops, %3 total, rss %4 MiB")
+                        .arg(rate, 0, 'f', 0).arg(loops.size()).arg(requests)
+                        .arg(ResidentSetSize() / (1024.0 * 1024.0), 0, 'f', 1);
+    });
+    reportTimer.start(reportIntervalMs);
+
+    QObject::connect(&application, &QCoreApplication::aboutToQuit, [&loops]()
+    {
+        for(const auto &loop: loops)
+            loop->quit();
+        for(const auto &loop: loops)
+            loop->wait();
+    });
+
+    return application.exec();
+}
+
+#endif // HEADLESSSERVER_HPP
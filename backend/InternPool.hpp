@@ -0,0 +1,185 @@
+#ifndef INTERNPOOL_HPP
+#define INTERNPOOL_HPP
+
+#include<QHash>
+#include<QMutex>
+#include<QString>
+#include<atomic>
+#include<memory>
+#include<new>
+#include<optional>
+
+//append-only storage in fixed size chunks, elements never move once written
+//At() is lock free, Append() has to be serialized by the owner and refuses values once every chunk is full
+template<typename T>
+class ChunkedPool
+{
+public:
+
+    static constexpr quint32 CHUNK_BITS = 12;
+    static constexpr quint32 CHUNK_SIZE = quint32{1} << CHUNK_BITS;
+    static constexpr quint32 MAX_CHUNKS = quint32{1} << 14;
+    static constexpr quint32 CAPACITY = CHUNK_SIZE * MAX_CHUNKS;
+
+    ChunkedPool() :
+        m_chunks(new std::atomic<T *>[MAX_CHUNKS])
+    {
+        for(quint32 i = 0; i < MAX_CHUNKS; ++i)
+            m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~ChunkedPool()
+    {
+        const auto size = Size();
+        for(quint32 i = 0; i < size; ++i)
+            Slot(i)->~T();
+        for(quint32 i = 0; i < MAX_CHUNKS; ++i)
+            ::operator delete(m_chunks[i].load(std::memory_order_relaxed));
+    }
+
+    ChunkedPool(const ChunkedPool &) = delete;
+    ChunkedPool &operator=(const ChunkedPool &) = delete;
+
+    const T &At(quint32 index) const
+    {
+        return *Slot(index);
+    }
+
+    std::optional<quint32> Append(const T &value)
+    {
+        const auto index = m_size.load(std::memory_order_relaxed);
+        if(index >= CAPACITY)
+            return std::nullopt;
+
+        auto &chunk = m_chunks[index >> CHUNK_BITS];
+        if(!chunk.load(std::memory_order_relaxed))
+            chunk.store(static_cast<T *>(::operator new(sizeof(T) * CHUNK_SIZE)), std::memory_order_release);
+
+        new(Slot(index)) T(value);
+        m_size.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    quint32 Size() const
+    {
+        return m_size.load(std::memory_order_acquire);
+    }
+
+    //bytes held by the chunks, not counting heap data owned by the elements
+    qint64 ReservedBytes() const
+    {
+        return qint64((Size() + CHUNK_SIZE - 1) / CHUNK_SIZE) * CHUNK_SIZE * qint64(sizeof(T));
+    }
+
+private:
+
+    T *Slot(quint32 index) const
+    {
+        return m_chunks[index >> CHUNK_BITS].load(std::memory_order_acquire) + (index & (CHUNK_SIZE - 1));
+    }
+
+    std::unique_ptr<std::atomic<T *>[]> m_chunks;
+    std::atomic<quint32> m_size{0};
+};
+
+//heap bytes an interned value holds besides its slot
+template<typename T>
+qint64 InternedBytes(const T &)
+{
+    return 0;
+}
+
+inline qint64 InternedBytes(const QString &value)
+{
+    return value.size() * qint64(sizeof(QChar));
+}
+
+//deduplicated values addressed by a 32 bit reference
+//one process wide pool per value and key type
+//entries live as long as the process, so the pool is capped by count and by bytes and refuses new values past either
+template<typename T, typename Key>
+class InternPool
+{
+public:
+
+    static constexpr quint32 MAX_ENTRIES = quint32{1} << 20;
+    static constexpr qint64 MAX_BYTES = qint64{64} << 20;
+
+    static InternPool &Instance()
+    {
+        static auto pool = InternPool{};
+        return pool;
+    }
+
+    //nullopt when the value is new and the pool is full, counted in Refusals() of the calling thread
+    template<typename Make>
+    std::optional<quint32> Intern(const Key &key, Make make)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto existing = m_index.constFind(key);
+        if(existing != m_index.constEnd())
+            return existing.value();
+
+        const auto value = make();
+        const auto bytes = qint64(sizeof(T)) + InternedBytes(value);
+        const auto reference = m_values.Size() < MAX_ENTRIES && m_bytes + bytes <= MAX_BYTES
+            ? m_values.Append(value)
+            : std::nullopt;
+        if(!reference.has_value())
+        {
+            ++ThreadRefusals();
+            return std::nullopt;
+        }
+
+        m_bytes += bytes;
+        m_index.insert(key, reference.value());
+        return reference;
+    }
+
+    //lets a caller tell a full pool from a bad value, compared before and after it interns
+    static quint64 Refusals()
+    {
+        return ThreadRefusals();
+    }
+
+    std::optional<quint32> Find(const Key &key) const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto existing = m_index.constFind(key);
+        if(existing == m_index.constEnd())
+            return std::nullopt;
+        return existing.value();
+    }
+
+    const T &At(quint32 reference) const
+    {
+        return m_values.At(reference);
+    }
+
+    quint32 Size() const
+    {
+        return m_values.Size();
+    }
+
+    qint64 ReservedBytes() const
+    {
+        return m_values.ReservedBytes();
+    }
+
+private:
+
+    InternPool() = default;
+
+    static quint64 &ThreadRefusals()
+    {
+        thread_local auto refusals = quint64{0};
+        return refusals;
+    }
+
+    mutable QMutex m_mutex;
+    ChunkedPool<T> m_values;
+    QHash<Key, quint32> m_index;
+    qint64 m_bytes = 0;
+};
+
+#endif // INTERNPOOL_HPP
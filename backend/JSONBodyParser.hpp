@@ -0,0 +1,502 @@
+#ifndef JSONBODYPARSER_HPP
+#define JSONBODYPARSER_HPP
+
+#include<QByteArrayView>
+#include<QJsonArray>
+#include<QJsonObject>
+#include<QJsonValue>
+#include<QList>
+#include<QString>
+#include<charconv>
+#include<cmath>
+#include<optional>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include<emmintrin.h>
+#define JSONBODYPARSER_SSE2
+#endif
+
+//the avx2 scan is compiled with a target attribute and picked at run time, so it runs without -mavx2
+#if defined(JSONBODYPARSER_SSE2) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include<immintrin.h>
+#define JSONBODYPARSER_AVX2
+#endif
+
+//validating single pass parser for request bodies
+//only the members asked for are built into json values, everything else is checked and skipped
+//accepts and rejects the same documents as QJsonDocument::fromJson, duplicate keys keep the last value
+class JSONBodyParser
+{
+public:
+
+    static constexpr int MAX_DEPTH = 1024;
+
+    //names == nullptr keeps every member of the top level object
+    explicit JSONBodyParser(QByteArrayView body, const QList<QLatin1StringView> *names = nullptr) :
+        m_current(body.data()),
+        m_end(body.data() + body.size()),
+        m_names(names)
+    {}
+
+    std::optional<QJsonObject> ParseObject()
+    {
+        //QJsonDocument skips a utf-8 byte order mark as well
+        if(m_end - m_current >= 3 && QByteArrayView(m_current, 3) == QByteArrayView("\xef\xbb\xbf"))
+            m_current += 3;
+
+        SkipWhitespace();
+        if(m_current == m_end || *m_current != '{')
+            return std::nullopt;
+
+        auto object = QJsonObject{};
+        if(!ParseMembers(&object, 0, true))
+            return std::nullopt;
+
+        SkipWhitespace();
+        if(m_current != m_end)
+            return std::nullopt;
+        return object;
+    }
+
+    //first byte at or after from that can end a plain string run: '"', '\\', a control character or any non-ascii byte
+    //the wide scans stop on a special byte or short of their block size, the narrower ones finish from there
+    static const char *ScanStringRun(const char *from, const char *end)
+    {
+#if defined(JSONBODYPARSER_AVX2)
+        if(HasAVX2())
+            from = ScanStringRunAVX2(from, end);
+#endif
+#if defined(JSONBODYPARSER_SSE2)
+        from = ScanStringRunSSE2(from, end);
+#endif
+        for(; from != end; ++from)
+        {
+            const auto c = uchar(*from);
+            if(c == '"' || c == '\\' || c < 0x20 || c >= 0x80)
+                return from;
+        }
+        return end;
+    }
+
+private:
+
+#if defined(JSONBODYPARSER_AVX2)
+    static bool HasAVX2()
+    {
+        static const auto supported = __builtin_cpu_supports("avx2") != 0;
+        return supported;
+    }
+
+    __attribute__((target("avx2"))) static const char *ScanStringRunAVX2(const char *from, const char *end)
+    {
+        const auto quote = _mm256_set1_epi8('"');
+        const auto backslash = _mm256_set1_epi8('\\');
+        const auto space = _mm256_set1_epi8(0x20);
+        for(; end - from >= 32; from += 32)
+        {
+            const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(from));
+            //signed compare, bytes >= 0x80 are negative and count as special too
+            const auto special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, quote), _mm256_cmpeq_epi8(bytes, backslash)),
+                                                 _mm256_cmpgt_epi8(space, bytes));
+            const auto mask = unsigned(_mm256_movemask_epi8(special));
+            if(mask)
+                return from + CountTrailingZeros(mask);
+        }
+        return from;
+    }
+#endif
+
+#if defined(JSONBODYPARSER_SSE2)
+    static const char *ScanStringRunSSE2(const char *from, const char *end)
+    {
+        const auto quote = _mm_set1_epi8('"');
+        const auto backslash = _mm_set1_epi8('\\');
+        const auto space = _mm_set1_epi8(0x20);
+        for(; end - from >= 16; from += 16)
+        {
+            const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(from));
+            const auto special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)),
+                                              _mm_cmplt_epi8(bytes, space));
+            const auto mask = unsigned(_mm_movemask_epi8(special));
+            if(mask)
+                return from + CountTrailingZeros(mask);
+        }
+        return from;
+    }
+#endif
+
+    static int CountTrailingZeros(unsigned mask)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return int(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    static bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    void SkipWhitespace()
+    {
+        while(m_current != m_end && IsSpace(*m_current))
+            ++m_current;
+    }
+
+    bool Consume(char c)
+    {
+        SkipWhitespace();
+        if(m_current == m_end || *m_current != c)
+            return false;
+        ++m_current;
+        return true;
+    }
+
+    bool Wanted(QByteArrayView rawKey, const QString &decodedKey, bool decoded) const
+    {
+        if(!m_names)
+            return true;
+        for(const auto &name: *m_names)
+        {
+            if(decoded ? decodedKey == name : rawKey == QByteArrayView(name.data(), name.size()))
+                return true;
+        }
+        return false;
+    }
+
+    //m_current is on '{', out == nullptr only validates
+    bool ParseMembers(QJsonObject *out, int depth, bool topLevel = false)
+    {
+        if(depth >= MAX_DEPTH)
+            return false;
+        ++m_current;
+        if(Consume('}'))
+            return true;
+
+        do
+        {
+            SkipWhitespace();
+            if(m_current == m_end || *m_current != '"')
+                return false;
+
+            //keys without escapes are compared as raw bytes, they are only decoded when needed
+            const auto *keyBegin = m_current + 1;
+            auto key = QString{};
+            auto plain = false;
+            if(!ScanString(out ? &key : nullptr, &plain))
+                return false;
+            const auto rawKey = QByteArrayView(keyBegin, m_current - 1 - keyBegin);
+            if(!Consume(':'))
+                return false;
+
+            const auto keep = out && (!topLevel || Wanted(rawKey, key, !plain));
+            auto value = QJsonValue{};
+            if(!ParseValue(keep ? &value : nullptr, depth + 1))
+                return false;
+            if(keep)
+                out->insert(plain ? QString::fromLatin1(rawKey.data(), rawKey.size()) : key, value);
+        }
+        while(Consume(','));
+
+        return Consume('}');
+    }
+
+    //m_current is on '['
+    bool ParseElements(QJsonArray *out, int depth)
+    {
+        if(depth >= MAX_DEPTH)
+            return false;
+        ++m_current;
+        if(Consume(']'))
+            return true;
+
+        do
+        {
+            auto value = QJsonValue{};
+            if(!ParseValue(out ? &value : nullptr, depth + 1))
+                return false;
+            if(out)
+                out->append(value);
+        }
+        while(Consume(','));
+
+        return Consume(']');
+    }
+
+    bool ParseValue(QJsonValue *out, int depth)
+    {
+        SkipWhitespace();
+        if(m_current == m_end)
+            return false;
+
+        switch(*m_current)
+        {
+        case '{':
+        {
+            auto object = QJsonObject{};
+            if(!ParseMembers(out ? &object : nullptr, depth))
+                return false;
+            if(out)
+                *out = object;
+            return true;
+        }
+        case '[':
+        {
+            auto array = QJsonArray{};
+            if(!ParseElements(out ? &array : nullptr, depth))
+                return false;
+            if(out)
+                *out = array;
+            return true;
+        }
+        case '"':
+        {
+            auto text = QString{};
+            auto plain = false;
+            const auto *begin = m_current + 1;
+            if(!ScanString(out ? &text : nullptr, &plain))
+                return false;
+            if(out)
+                *out = plain ? QString::fromLatin1(begin, m_current - 1 - begin) : text;
+            return true;
+        }
+        case 't':
+            return Literal("true", out, QJsonValue(true));
+        case 'f':
+            return Literal("false", out, QJsonValue(false));
+        case 'n':
+            return Literal("null", out, QJsonValue(QJsonValue::Null));
+        default:
+            return ParseNumber(out);
+        }
+    }
+
+    bool Literal(QByteArrayView literal, QJsonValue *out, const QJsonValue &value)
+    {
+        if(m_end - m_current < literal.size() || QByteArrayView(m_current, literal.size()) != literal)
+            return false;
+        m_current += literal.size();
+        if(out)
+            *out = value;
+        return true;
+    }
+
+    //integers that fit qint64 stay integers, like QJsonDocument does
+    bool ParseNumber(QJsonValue *out)
+    {
+        const auto *begin = m_current;
+        auto integral = true;
+        if(m_current != m_end && *m_current == '-')
+            ++m_current;
+        if(m_current == m_end)
+            return false;
+        if(*m_current == '0')
+            ++m_current;
+        else if(*m_current >= '1' && *m_current <= '9')
+            SkipDigits();
+        else
+            return false;
+
+        if(m_current != m_end && *m_current == '.')
+        {
+            integral = false;
+            ++m_current;
+            if(!SkipDigits())
+                return false;
+        }
+        if(m_current != m_end && (*m_current == 'e' || *m_current == 'E'))
+        {
+            integral = false;
+            ++m_current;
+            if(m_current != m_end && (*m_current == '+' || *m_current == '-'))
+                ++m_current;
+            if(!SkipDigits())
+                return false;
+        }
+
+        if(integral)
+        {
+            auto integer = qint64{0};
+            const auto result = std::from_chars(begin, m_current, integer);
+            if(result.ec == std::errc{} && result.ptr == m_current)
+            {
+                if(out)
+                    *out = QJsonValue(integer);
+                return true;
+            }
+        }
+
+        //overflow and underflow are both out of range, QJsonDocument rejects either
+        auto number = 0.0;
+        const auto result = std::from_chars(begin, m_current, number);
+        if(result.ec != std::errc{} || result.ptr != m_current || !std::isfinite(number))
+            return false;
+
+        if(out)
+            *out = QJsonValue(number);
+        return true;
+    }
+
+    bool SkipDigits()
+    {
+        const auto *begin = m_current;
+        while(m_current != m_end && *m_current >= '0' && *m_current <= '9')
+            ++m_current;
+        return m_current != begin;
+    }
+
+    //m_current is on the opening quote and ends after the closing one
+    //plain strings are ascii without escapes, the caller takes them from the raw bytes and out is left empty
+    bool ScanString(QString *out, bool *plain)
+    {
+        ++m_current;
+        const auto *begin = m_current;
+        m_current = ScanStringRun(m_current, m_end);
+        if(m_current != m_end && *m_current == '"')
+        {
+            ++m_current;
+            *plain = true;
+            return true;
+        }
+
+        *plain = false;
+        if(out)
+            out->append(QLatin1StringView(begin, m_current - begin));
+        while(m_current != m_end)
+        {
+            const auto c = uchar(*m_current);
+            if(c == '"')
+            {
+                ++m_current;
+                return true;
+            }
+            if(c < 0x20)
+                return false;
+            if(c == '\\')
+            {
+                if(!ScanEscape(out))
+                    return false;
+            }
+            else if(!ScanUtf8Sequence(out))
+                return false;
+
+            const auto *run = m_current;
+            m_current = ScanStringRun(m_current, m_end);
+            if(out)
+                out->append(QLatin1StringView(run, m_current - run));
+        }
+        return false;
+    }
+
+    //well formed utf-8 only: no overlong forms, no surrogates, nothing above U+10FFFF
+    bool ScanUtf8Sequence(QString *out)
+    {
+        const auto lead = uchar(*m_current);
+        auto length = 0;
+        auto minimum = char32_t{0};
+        auto code = char32_t{0};
+        if(lead >= 0xc2 && lead <= 0xdf)
+        {
+            length = 2;
+            minimum = 0x80;
+            code = lead & 0x1f;
+        }
+        else if(lead >= 0xe0 && lead <= 0xef)
+        {
+            length = 3;
+            minimum = 0x800;
+            code = lead & 0x0f;
+        }
+        else if(lead >= 0xf0 && lead <= 0xf4)
+        {
+            length = 4;
+            minimum = 0x10000;
+            code = lead & 0x07;
+        }
+        else
+            return false;
+
+        if(m_end - m_current < length)
+            return false;
+        for(auto i = 1; i < length; ++i)
+        {
+            const auto continuation = uchar(m_current[i]);
+            if((continuation & 0xc0) != 0x80)
+                return false;
+            code = (code << 6) | (continuation & 0x3f);
+        }
+        if(code < minimum || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff))
+            return false;
+
+        m_current += length;
+        if(out)
+        {
+            if(QChar::requiresSurrogates(code))
+                out->append(QChar(QChar::highSurrogate(code))).append(QChar(QChar::lowSurrogate(code)));
+            else
+                out->append(QChar(char16_t(code)));
+        }
+        return true;
+    }
+
+    static int HexValue(char c)
+    {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    //m_current is on the backslash
+    //\u escapes go in as utf-16 units, so pairs join up and lone surrogates are kept as QJsonDocument keeps them
+    bool ScanEscape(QString *out)
+    {
+        ++m_current;
+        if(m_current == m_end)
+            return false;
+
+        auto unit = char16_t{0};
+        switch(*m_current++)
+        {
+        case '"': unit = u'"'; break;
+        case '\\': unit = u'\\'; break;
+        case '/': unit = u'/'; break;
+        case 'b': unit = u'\b'; break;
+        case 'f': unit = u'\f'; break;
+        case 'n': unit = u'\n'; break;
+        case 'r': unit = u'\r'; break;
+        case 't': unit = u'\t'; break;
+        case 'u':
+            if(m_end - m_current < 4)
+                return false;
+            for(auto i = 0; i < 4; ++i)
+            {
+                const auto digit = HexValue(m_current[i]);
+                if(digit < 0)
+                    return false;
+                unit = char16_t((unit << 4) | digit);
+            }
+            m_current += 4;
+            break;
+        default:
+            return false;
+        }
+
+        if(out)
+            out->append(QChar(unit));
+        return true;
+    }
+
+    const char *m_current;
+    const char *m_end;
+    const QList<QLatin1StringView> *m_names;
+};
+
+#endif // JSONBODYPARSER_HPP
@@ -0,0 +1,609 @@
+#ifndef JSONFIELDS_HPP
+#define JSONFIELDS_HPP
+
+#include<QByteArray>
+#include<QJsonArray>
+#include<QJsonObject>
+#include<QJsonValue>
+#include<QList>
+#include<QLocale>
+#include<QString>
+#include<QStringList>
+#include<QUrl>
+#include<QUuid>
+#include<charconv>
+#include<cmath>
+#include<optional>
+#include<tuple>
+#include<type_traits>
+
+//compact json written straight into a byte buffer, no QJsonObject/QJsonArray tree in between
+//the writer appends, so one buffer can be reused for many documents
+class JSONWriter
+{
+public:
+
+    explicit JSONWriter(QByteArray &buffer) :
+        m_buffer(buffer)
+    {}
+
+    void BeginObject()
+    {
+        Separator();
+        m_buffer.append('{');
+        m_needsComma = false;
+    }
+
+    void EndObject()
+    {
+        m_buffer.append('}');
+        m_needsComma = true;
+    }
+
+    void BeginArray()
+    {
+        Separator();
+        m_buffer.append('[');
+        m_needsComma = false;
+    }
+
+    void EndArray()
+    {
+        m_buffer.append(']');
+        m_needsComma = true;
+    }
+
+    //names from field descriptors are plain ascii literals and need no escaping
+    void Key(const char *name)
+    {
+        Separator();
+        m_buffer.append('"').append(name).append("\":");
+        m_needsComma = false;
+    }
+
+    void Key(QStringView name)
+    {
+        Separator();
+        AppendString(name);
+        m_buffer.append(':');
+        m_needsComma = false;
+    }
+
+    void Null()
+    {
+        Separator();
+        m_buffer.append("null");
+        m_needsComma = true;
+    }
+
+    void Bool(bool value)
+    {
+        Separator();
+        m_buffer.append(value ? "true" : "false");
+        m_needsComma = true;
+    }
+
+    void Integer(qint64 value)
+    {
+        Separator();
+        char digits[24];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        m_buffer.append(digits, result.ptr - digits);
+        m_needsComma = true;
+    }
+
+    //integral values print like integers, as QJsonDocument does
+    void Double(double value)
+    {
+        if(!std::isfinite(value))
+            return Null();
+        if(std::trunc(value) == value && std::fabs(value) < 9007199254740992.0)
+            return Integer(qint64(value));
+
+        Separator();
+        m_buffer.append(QByteArray::number(value, 'g', QLocale::FloatingPointShortest));
+        m_needsComma = true;
+    }
+
+    void String(QStringView value)
+    {
+        Separator();
+        AppendString(value);
+        m_needsComma = true;
+    }
+
+    //fallback for values that only exist as a json tree
+    void Value(const QJsonValue &value)
+    {
+        switch(value.type())
+        {
+        case QJsonValue::Bool:
+            return Bool(value.toBool());
+        case QJsonValue::Double:
+            return Double(value.toDouble());
+        case QJsonValue::String:
+            return String(value.toString());
+        case QJsonValue::Array:
+            BeginArray();
+            for(const auto &element: value.toArray())
+                Value(element);
+            return EndArray();
+        case QJsonValue::Object:
+        {
+            const auto object = value.toObject();
+            BeginObject();
+            for(auto member = object.constBegin(); member != object.constEnd(); ++member)
+            {
+                Key(member.key());
+                Value(member.value());
+            }
+            return EndObject();
+        }
+        default:
+            return Null();
+        }
+    }
+
+    //described types are written field by field, types with WriteJSON write themselves,
+    //anything else goes through its ToJSON
+    template<typename Item>
+    void Write(const Item &item);
+
+private:
+
+    void Separator()
+    {
+        if(m_needsComma)
+            m_buffer.append(',');
+    }
+
+    void AppendString(QStringView value)
+    {
+        m_buffer.append('"');
+        const auto *units = value.utf16();
+        const auto size = value.size();
+        for(qsizetype i = 0; i < size; ++i)
+        {
+            const auto unit = char16_t(units[i]);
+            if(unit < 0x80)
+            {
+                if(unit >= 0x20 && unit != u'"' && unit != u'\\')
+                    m_buffer.append(char(unit));
+                else
+                    AppendEscape(unit);
+            }
+            else if(unit < 0x800)
+            {
+                m_buffer.append(char(0xc0 | (unit >> 6)));
+                m_buffer.append(char(0x80 | (unit & 0x3f)));
+            }
+            else if(QChar::isHighSurrogate(unit) && i + 1 < size && QChar::isLowSurrogate(units[i + 1]))
+            {
+                const auto code = QChar::surrogateToUcs4(unit, units[++i]);
+                m_buffer.append(char(0xf0 | (code >> 18)));
+                m_buffer.append(char(0x80 | ((code >> 12) & 0x3f)));
+                m_buffer.append(char(0x80 | ((code >> 6) & 0x3f)));
+                m_buffer.append(char(0x80 | (code & 0x3f)));
+            }
+            else if(QChar::isSurrogate(unit))
+            {
+                //lone surrogate, not representable in utf-8
+                m_buffer.append("\xef\xbf\xbd");
+            }
+            else
+            {
+                m_buffer.append(char(0xe0 | (unit >> 12)));
+                m_buffer.append(char(0x80 | ((unit >> 6) & 0x3f)));
+                m_buffer.append(char(0x80 | (unit & 0x3f)));
+            }
+        }
+        m_buffer.append('"');
+    }
+
+    void AppendEscape(char16_t unit)
+    {
+        switch(unit)
+        {
+        case u'"': m_buffer.append("\\\""); return;
+        case u'\\': m_buffer.append("\\\\"); return;
+        case u'\b': m_buffer.append("\\b"); return;
+        case u'\f': m_buffer.append("\\f"); return;
+        case u'\n': m_buffer.append("\\n"); return;
+        case u'\r': m_buffer.append("\\r"); return;
+        case u'\t': m_buffer.append("\\t"); return;
+        default:
+            static constexpr char HEX[] = "0123456789abcdef";
+            m_buffer.append("\\u00").append(HEX[unit >> 4]).append(HEX[unit & 0xf]);
+        }
+    }
+
+    QByteArray &m_buffer;
+    bool m_needsComma = false;
+};
+
+//how a member type goes to and comes from json
+//Write and ToJSON are needed for every field, FromJSON only for writable ones
+template<typename M>
+struct JSONCodec;
+
+template<>
+struct JSONCodec<qint64>
+{
+    static QJsonValue ToJSON(qint64 value)
+    {
+        return value;
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, qint64 value)
+    {
+        writer.Integer(value);
+    }
+
+    static bool FromJSON(const QJsonValue &json, qint64 &value)
+    {
+        value = json.toInteger();
+        return true;
+    }
+};
+
+template<>
+struct JSONCodec<bool>
+{
+    static QJsonValue ToJSON(bool value)
+    {
+        return value;
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, bool value)
+    {
+        writer.Bool(value);
+    }
+
+    static bool FromJSON(const QJsonValue &json, bool &value)
+    {
+        value = json.toBool();
+        return true;
+    }
+};
+
+template<>
+struct JSONCodec<QString>
+{
+    static QJsonValue ToJSON(const QString &value)
+    {
+        return value;
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, const QString &value)
+    {
+        writer.String(value);
+    }
+
+    static bool FromJSON(const QJsonValue &json, QString &value)
+    {
+        value = json.toString();
+        return true;
+    }
+};
+
+template<>
+struct JSONCodec<QUrl>
+{
+    static QJsonValue ToJSON(const QUrl &value)
+    {
+        return value.toString();
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, const QUrl &value)
+    {
+        writer.String(value.toString());
+    }
+
+    static bool FromJSON(const QJsonValue &json, QUrl &value)
+    {
+        value = QUrl{json.toString()};
+        return true;
+    }
+};
+
+template<>
+struct JSONCodec<std::optional<QUuid>>
+{
+    static QJsonValue ToJSON(const std::optional<QUuid> &value)
+    {
+        return value ? QJsonValue(value->toString(QUuid::StringFormat::WithoutBraces)) : QJsonValue(QJsonValue::Null);
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, const std::optional<QUuid> &value)
+    {
+        if(value)
+            writer.String(QString::fromLatin1(value->toByteArray(QUuid::StringFormat::WithoutBraces)));
+        else
+            writer.Null();
+    }
+};
+
+//one member of a described struct: its json name, where it lives and how it is encoded
+//read-only fields (ids, tokens) are written but never taken from a request body
+//secret fields (the right answers) are read-only and only written when the mask asks for secrets
+template<typename T, typename M, typename Codec, bool Writable, bool Secret = false>
+struct FieldDescriptor
+{
+    using CodecType = Codec;
+    using MemberType = M;
+    static constexpr bool WRITABLE = Writable;
+    static constexpr bool SECRET = Secret;
+
+    const char *name;
+    M T::*member;
+};
+
+template<typename Codec = void, typename T, typename M>
+constexpr auto Field(const char *name, M T::*member)
+{
+    return FieldDescriptor<T, M, std::conditional_t<std::is_void_v<Codec>, JSONCodec<M>, Codec>, true>{name, member};
+}
+
+template<typename Codec = void, typename T, typename M>
+constexpr auto ReadOnlyField(const char *name, M T::*member)
+{
+    return FieldDescriptor<T, M, std::conditional_t<std::is_void_v<Codec>, JSONCodec<M>, Codec>, false>{name, member};
+}
+
+template<typename Codec = void, typename T, typename M>
+constexpr auto SecretField(const char *name, M T::*member)
+{
+    return FieldDescriptor<T, M, std::conditional_t<std::is_void_v<Codec>, JSONCodec<M>, Codec>, false, true>{name, member};
+}
+
+//a described type has static constexpr Fields() returning a tuple of descriptors
+template<typename T, typename = void>
+struct HasFieldDescriptors : std::false_type {};
+
+template<typename T>
+struct HasFieldDescriptors<T, std::void_t<decltype(T::Fields())>> : std::true_type {};
+
+template<typename T, typename Writer, typename = void>
+struct HasWriteJSON : std::false_type {};
+
+template<typename T, typename Writer>
+struct HasWriteJSON<T, Writer, std::void_t<decltype(std::declval<const T &>().WriteJSON(std::declval<Writer &>()))>> : std::true_type {};
+
+template<typename T, typename Function>
+void ForEachField(Function &&function)
+{
+    std::apply([&function](const auto &...fields){ (function(fields), ...); }, T::Fields());
+}
+
+//bit i selects the i-th descriptor, sparse fieldsets write only the selected ones
+//the top bit stands for the secret fields of the type and of the values nested in it, public responses leave it out
+using FieldMask = quint64;
+static constexpr FieldMask ALL_FIELDS = ~FieldMask{0};
+static constexpr FieldMask SECRET_FIELDS = FieldMask{1} << 63;
+static constexpr FieldMask PUBLIC_FIELDS = ALL_FIELDS & ~SECRET_FIELDS;
+
+//codecs of nested described values take a mask, they are written whole apart from the secrets
+template<typename Codec, typename M, typename = void>
+struct NestsFields : std::false_type {};
+
+template<typename Codec, typename M>
+struct NestsFields<Codec, M, std::void_t<decltype(Codec::ToJSON(std::declval<const M &>(), FieldMask{}))>> : std::true_type {};
+
+static constexpr FieldMask NestedFields(FieldMask fields)
+{
+    return (fields & SECRET_FIELDS) ? ALL_FIELDS : PUBLIC_FIELDS;
+}
+
+template<typename Descriptor>
+constexpr bool IsFieldWritten(FieldMask fields, int index)
+{
+    return (fields & (FieldMask{1} << index)) && (!Descriptor::SECRET || (fields & SECRET_FIELDS));
+}
+
+template<typename T>
+QJsonObject FieldsToJSON(const T &item, FieldMask fields = ALL_FIELDS)
+{
+    auto json = QJsonObject{};
+    auto index = 0;
+    ForEachField<T>([&json, &item, &index, fields](const auto &field)
+    {
+        using Descriptor = std::decay_t<decltype(field)>;
+        using Codec = typename Descriptor::CodecType;
+        if(!IsFieldWritten<Descriptor>(fields, index++))
+            return;
+        if constexpr(NestsFields<Codec, typename Descriptor::MemberType>::value)
+            json.insert(QLatin1String(field.name), Codec::ToJSON(item.*field.member, NestedFields(fields)));
+        else
+            json.insert(QLatin1String(field.name), Codec::ToJSON(item.*field.member));
+    });
+    return json;
+}
+
+template<typename Writer, typename T>
+void WriteFields(Writer &writer, const T &item, FieldMask fields = ALL_FIELDS)
+{
+    writer.BeginObject();
+    auto index = 0;
+    ForEachField<T>([&writer, &item, &index, fields](const auto &field)
+    {
+        using Descriptor = std::decay_t<decltype(field)>;
+        using Codec = typename Descriptor::CodecType;
+        if(!IsFieldWritten<Descriptor>(fields, index++))
+            return;
+        writer.Key(field.name);
+        if constexpr(NestsFields<Codec, typename Descriptor::MemberType>::value)
+            Codec::Write(writer, item.*field.member, NestedFields(fields));
+        else
+            Codec::Write(writer, item.*field.member);
+    });
+    writer.EndObject();
+}
+
+//mask of the named fields, nullopt if a name is not a field of T or T is not described
+template<typename T>
+std::optional<FieldMask> FieldMaskOf(const QStringList &names)
+{
+    if constexpr(HasFieldDescriptors<T>::value)
+    {
+        auto mask = FieldMask{0};
+        for(const auto &name: names)
+        {
+            auto index = 0;
+            auto found = false;
+            ForEachField<T>([&name, &index, &found, &mask](const auto &field)
+            {
+                if(!found && name == QLatin1StringView(field.name))
+                {
+                    mask |= FieldMask{1} << index;
+                    found = true;
+                }
+                ++index;
+            });
+            if(!found)
+                return std::nullopt;
+        }
+        return mask;
+    }
+    else
+        return std::nullopt;
+}
+
+//members a request body is read for, in declaration order
+template<typename T>
+const QList<QLatin1StringView> &WritableFieldNames()
+{
+    static const auto names = []()
+    {
+        auto list = QList<QLatin1StringView>{};
+        ForEachField<T>([&list](const auto &field)
+        {
+            if constexpr(std::decay_t<decltype(field)>::WRITABLE)
+                list.append(QLatin1StringView(field.name));
+        });
+        return list;
+    }();
+    return names;
+}
+
+//full updates and factories need every writable field
+template<typename T>
+bool HasWritableFields(const QJsonObject &json)
+{
+    auto complete = true;
+    ForEachField<T>([&complete, &json](const auto &field)
+    {
+        if constexpr(std::decay_t<decltype(field)>::WRITABLE)
+            complete = complete && json.contains(QLatin1String(field.name));
+    });
+    return complete;
+}
+
+//decodes every writable field, stops at the first value its codec rejects
+template<typename T>
+bool ReadFields(T &item, const QJsonObject &json)
+{
+    auto ok = true;
+    ForEachField<T>([&ok, &item, &json](const auto &field)
+    {
+        using Descriptor = std::decay_t<decltype(field)>;
+        if constexpr(Descriptor::WRITABLE)
+            ok = ok && Descriptor::CodecType::FromJSON(json.value(QLatin1String(field.name)), item.*field.member);
+    });
+    return ok;
+}
+
+//Updatable::Update, all or nothing
+template<typename T>
+bool UpdateAllFields(T &item, const QJsonObject &json)
+{
+    if(!HasWritableFields<T>(json))
+        return false;
+
+    auto updated = item;
+    if(!ReadFields(updated, json))
+        return false;
+    item = std::move(updated);
+    return true;
+}
+
+//Updatable::UpdateFields, fields that are present and valid are taken
+template<typename T>
+void UpdatePresentFields(T &item, const QJsonObject &json)
+{
+    ForEachField<T>([&item, &json](const auto &field)
+    {
+        using Descriptor = std::decay_t<decltype(field)>;
+        if constexpr(Descriptor::WRITABLE)
+        {
+            const auto key = QLatin1String(field.name);
+            if(json.contains(key))
+            {
+                auto value = item.*field.member;
+                if(Descriptor::CodecType::FromJSON(json.value(key), value))
+                    item.*field.member = std::move(value);
+            }
+        }
+    });
+}
+
+//any writer of the json data model, JSONWriter or CBORWriter
+template<typename Writer, typename Item>
+void WriteItem(Writer &writer, const Item &item)
+{
+    if constexpr(HasWriteJSON<Item, Writer>::value)
+        item.WriteJSON(writer);
+    else if constexpr(HasFieldDescriptors<Item>::value)
+        WriteFields(writer, item);
+    else
+        writer.Value(item.ToJSON());
+}
+
+//sparse fieldsets only apply to described types, everything else is written whole
+template<typename Writer, typename Item>
+void WriteProjectedItem(Writer &writer, const Item &item, FieldMask fields)
+{
+    if constexpr(HasFieldDescriptors<Item>::value)
+    {
+        if(fields != ALL_FIELDS)
+            return WriteFields(writer, item, fields);
+    }
+    WriteItem(writer, item);
+}
+
+template<typename Item>
+QJsonObject ProjectedToJSON(const Item &item, FieldMask fields)
+{
+    if constexpr(HasFieldDescriptors<Item>::value)
+    {
+        if(fields != ALL_FIELDS)
+            return FieldsToJSON(item, fields);
+    }
+    return item.ToJSON();
+}
+
+//a single item under a mask, for the writers that take whole values
+template<typename Item>
+struct ProjectedItem
+{
+    const Item &item;
+    FieldMask fields;
+
+    template<typename Writer>
+    void WriteJSON(Writer &writer) const
+    {
+        WriteProjectedItem(writer, item, fields);
+    }
+};
+
+template<typename Item>
+void JSONWriter::Write(const Item &item)
+{
+    WriteItem(*this, item);
+}
+
+#endif // JSONFIELDS_HPP
@@ -0,0 +1,235 @@
+#ifndef JSONSTREAMREADER_HPP
+#define JSONSTREAMREADER_HPP
+
+#include<QDebug>
+#include<QIODevice>
+#include<QJsonDocument>
+#include<QJsonObject>
+#include<QJsonParseError>
+#include<functional>
+
+//reads a top level json array one element at a time
+//only the element being scanned and one read chunk are held in memory
+class JSONArrayStreamReader
+{
+public:
+
+    static constexpr qint64 CHUNK_SIZE = 64 * 1024;
+    static constexpr qsizetype MAX_ELEMENT_SIZE = 16 * 1024 * 1024;
+
+    explicit JSONArrayStreamReader(QIODevice &device) :
+        m_device(device)
+    {}
+
+    //consume gets every object element with its byte offset, malformed elements are reported and skipped
+    //returns false if the array structure itself is broken
+    bool ForEachObject(const std::function<void(const QJsonObject &, qint64)> &consume)
+    {
+        auto chunk = QByteArray{};
+        while(m_state != State::Failed)
+        {
+            chunk = m_device.read(CHUNK_SIZE);
+            if(chunk.isEmpty())
+                break;
+
+            for(const auto c: chunk)
+            {
+                Feed(c, consume);
+                ++m_offset;
+                if(m_state == State::Failed)
+                    break;
+            }
+        }
+
+        if(m_state != State::Done && m_state != State::Failed)
+            Fail("unexpected end of data");
+
+        return m_state == State::Done;
+    }
+
+    qint64 MalformedCount() const
+    {
+        return m_malformed;
+    }
+
+    QString ErrorString() const
+    {
+        return m_error;
+    }
+
+private:
+
+    static constexpr char UTF8_BOM[3] = {'\xEF', '\xBB', '\xBF'};
+
+    enum class State
+    {
+        BeforeArray,
+        BeforeElement,
+        InElement,
+        AfterElement,
+        Done,
+        Failed
+    };
+
+    static bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+
+    void Feed(char c, const std::function<void(const QJsonObject &, qint64)> &consume)
+    {
+        switch(m_state)
+        {
+        case State::BeforeArray:
+            //a utf-8 bom is skipped only as the exact bytes EF BB BF at offset 0
+            if(m_offset < 3 && m_bomBytes == m_offset && c == UTF8_BOM[m_offset])
+            {
+                ++m_bomBytes;
+                return;
+            }
+            if(m_bomBytes > 0 && m_bomBytes < 3)
+                return Fail("incomplete utf-8 bom");
+            if(IsSpace(c))
+                return;
+            if(c != '[')
+                return Fail("expected '['");
+            m_state = State::BeforeElement;
+            return;
+
+        case State::BeforeElement:
+            if(IsSpace(c))
+                return;
+            if(c == ']' && m_elements == 0)
+            {
+                m_state = State::Done;
+                return;
+            }
+            StartElement();
+            [[fallthrough]];
+
+        case State::InElement:
+            return ScanElement(c, consume);
+
+        case State::AfterElement:
+            if(IsSpace(c))
+                return;
+            if(c == ',')
+                m_state = State::BeforeElement;
+            else if(c == ']')
+                m_state = State::Done;
+            else
+                Fail("expected ',' or ']'");
+            return;
+
+        case State::Done:
+            if(!IsSpace(c))
+                Fail("data after the closing ']'");
+            return;
+
+        case State::Failed:
+            return;
+        }
+    }
+
+    void StartElement()
+    {
+        m_state = State::InElement;
+        m_elementStart = m_offset;
+        m_element.clear();
+        m_depth = 0;
+        m_inString = false;
+        m_escaped = false;
+        m_oversized = false;
+        ++m_elements;
+    }
+
+    void ScanElement(char c, const std::function<void(const QJsonObject &, qint64)> &consume)
+    {
+        if(m_inString)
+        {
+            Append(c);
+            if(m_escaped)
+                m_escaped = false;
+            else if(c == '\\')
+                m_escaped = true;
+            else if(c == '"')
+                m_inString = false;
+            return;
+        }
+
+        //a bare scalar element ends at the separator that follows it
+        if(m_depth == 0 && (c == ',' || c == ']'))
+        {
+            EmitElement(consume);
+            m_state = c == ',' ? State::BeforeElement : State::Done;
+            return;
+        }
+
+        Append(c);
+        if(c == '"')
+            m_inString = true;
+        else if(c == '{' || c == '[')
+            ++m_depth;
+        else if(c == '}' || c == ']')
+        {
+            if(--m_depth < 0)
+                return Fail("unbalanced bracket");
+            if(m_depth == 0)
+            {
+                EmitElement(consume);
+                m_state = State::AfterElement;
+            }
+        }
+    }
+
+    void Append(char c)
+    {
+        if(m_element.size() < MAX_ELEMENT_SIZE)
+            m_element.append(c);
+        else
+            m_oversized = true;
+    }
+
+    void EmitElement(const std::function<void(const QJsonObject &, qint64)> &consume)
+    {
+        if(m_oversized)
+            return Malformed(m_elementStart, QString("record larger than %1 bytes").arg(MAX_ELEMENT_SIZE));
+
+        auto error = QJsonParseError{};
+        const auto json = QJsonDocument::fromJson(m_element, &error);
+        if(error.error)
+            return Malformed(m_elementStart + error.offset, error.errorString());
+        if(!json.isObject())
+            return Malformed(m_elementStart, "record is not an object");
+
+        consume(json.object(), m_elementStart);
+    }
+
+    void Malformed(qint64 offset, const QString &reason)
+    {
+        ++m_malformed;
+        qDebug() << "Malformed record at byte" << offset << ":" << reason;
+    }
+
+    void Fail(const QString &reason)
+    {
+        m_state = State::Failed;
+        m_error = QString("%1 at byte %2").arg(reason).arg(m_offset);
+    }
+
+    QIODevice &m_device;
+    State m_state = State::BeforeArray;
+    QByteArray m_element;
+    QString m_error;
+    qint64 m_offset = 0;
+    qint64 m_bomBytes = 0;
+    qint64 m_elementStart = 0;
+    qint64 m_elements = 0;
+    qint64 m_malformed = 0;
+    qint64 m_depth = 0;
+    bool m_inString = false;
+    bool m_escaped = false;
+    bool m_oversized = false;
+};
+
+#endif // JSONSTREAMREADER_HPP
@@ -0,0 +1,415 @@
+#ifndef LEADERBOARD_HPP
+#define LEADERBOARD_HPP
+
+#include<QMutex>
+#include<QRandomGenerator>
+#include<QVarLengthArray>
+#include<array>
+#include<limits>
+#include<vector>
+
+#include"APIUtility.hpp"
+#include"ResponseCache.hpp"
+
+struct LeaderboardEntry : public JSONable
+{
+    qint64 id = 0;
+    qint64 score = 0;
+    qsizetype rank = 0;
+
+    QJsonObject ToJSON() const override
+    {
+        return QJsonObject
+            {
+                {"id", id},
+                {"score", score},
+                {"rank", rank}
+            };
+    }
+};
+
+//indexable skip list ordered by score descending, ties broken by the lower id
+//every link stores how many entries it skips, so rank and rank->entry are both O(log n)
+//nodes live in one vector and link by index, removed nodes are reused
+class RankingSkipList
+{
+    struct Link
+    {
+        quint32 next;
+        quint32 span;
+    };
+
+    struct Node
+    {
+        qint64 id;
+        qint64 score;
+        QVarLengthArray<Link, 4> links;
+    };
+
+public:
+
+    static constexpr int MAX_LEVEL = 16;
+    static constexpr quint32 NIL = std::numeric_limits<quint32>::max();
+    static constexpr quint32 HEAD = 0;
+
+    //keys are 1-based ranks, so PaginatedData can page over the list directly
+    using key_type = qsizetype;
+
+    class ConstIterator
+    {
+    public:
+
+        explicit ConstIterator(const RankingSkipList *list, quint32 node, qsizetype rank) :
+            m_list(list),
+            m_node(node)
+        {
+            Load(rank);
+        }
+
+        qsizetype key() const
+        {
+            return m_entry.rank;
+        }
+
+        const LeaderboardEntry &operator*() const
+        {
+            return m_entry;
+        }
+
+        const LeaderboardEntry *operator->() const
+        {
+            return &m_entry;
+        }
+
+        ConstIterator &operator++()
+        {
+            m_node = m_list->m_nodes[m_node].links[0].next;
+            Load(m_entry.rank + 1);
+            return *this;
+        }
+
+        bool operator==(const ConstIterator &other) const
+        {
+            return m_node == other.m_node;
+        }
+
+        bool operator!=(const ConstIterator &other) const
+        {
+            return m_node != other.m_node;
+        }
+
+    private:
+
+        void Load(qsizetype rank)
+        {
+            if(m_node == NIL)
+                return;
+            m_entry.id = m_list->m_nodes[m_node].id;
+            m_entry.score = m_list->m_nodes[m_node].score;
+            m_entry.rank = rank;
+        }
+
+        const RankingSkipList *m_list;
+        quint32 m_node;
+        LeaderboardEntry m_entry;
+    };
+
+    RankingSkipList()
+    {
+        auto head = Node{0, 0, {}};
+        head.links.resize(MAX_LEVEL);
+        for(auto &link: head.links)
+            link = Link{NIL, 0};
+        m_nodes.push_back(std::move(head));
+    }
+
+    qsizetype size() const
+    {
+        return m_length;
+    }
+
+    std::optional<qint64> ScoreOf(qint64 id) const
+    {
+        const auto node = m_index.constFind(id);
+        if(node == m_index.constEnd())
+            return std::nullopt;
+        return m_nodes[node.value()].score;
+    }
+
+    //inserts or moves an entry
+    void Set(qint64 id, qint64 score)
+    {
+        const auto existing = m_index.constFind(id);
+        if(existing != m_index.constEnd())
+        {
+            if(m_nodes[existing.value()].score == score)
+                return;
+            Remove(id);
+        }
+        Insert(id, score);
+    }
+
+    bool Remove(qint64 id)
+    {
+        const auto existing = m_index.constFind(id);
+        if(existing == m_index.constEnd())
+            return false;
+
+        const auto target = existing.value();
+        auto update = std::array<quint32, MAX_LEVEL>{};
+        auto node = HEAD;
+        for(auto level = m_level - 1; level >= 0; --level)
+        {
+            for(auto next = Next(node, level); next != NIL && Before(m_nodes[next], m_nodes[target]); next = Next(node, level))
+                node = next;
+            update[level] = node;
+        }
+
+        for(auto level = 0; level < m_level; ++level)
+        {
+            auto &link = m_nodes[update[level]].links[level];
+            if(link.next == target)
+            {
+                link.span += m_nodes[target].links[level].span - 1;
+                link.next = m_nodes[target].links[level].next;
+            }
+            else
+                --link.span;
+        }
+
+        while(m_level > 1 && Next(HEAD, m_level - 1) == NIL)
+            --m_level;
+
+        m_index.erase(existing);
+        m_nodes[target].links.clear();
+        m_free.push_back(target);
+        --m_length;
+        return true;
+    }
+
+    //1-based
+    std::optional<qsizetype> RankOf(qint64 id) const
+    {
+        const auto existing = m_index.constFind(id);
+        if(existing == m_index.constEnd())
+            return std::nullopt;
+
+        const auto target = existing.value();
+        auto rank = qsizetype{0};
+        auto node = HEAD;
+        for(auto level = m_level - 1; level >= 0; --level)
+        {
+            for(auto next = Next(node, level); next != NIL && !Before(m_nodes[target], m_nodes[next]); next = Next(node, level))
+            {
+                rank += m_nodes[node].links[level].span;
+                node = next;
+            }
+            if(node == target)
+                return rank;
+        }
+        return std::nullopt;
+    }
+
+    //0-based position, as PaginatedData asks for it
+    ConstIterator ConstIteratorAt(qsizetype index) const
+    {
+        if(index < 0 || index >= m_length)
+            return constEnd();
+
+        const auto rank = index + 1;
+        auto traversed = qsizetype{0};
+        auto node = HEAD;
+        for(auto level = m_level - 1; level >= 0; --level)
+        {
+            while(Next(node, level) != NIL && traversed + m_nodes[node].links[level].span <= rank)
+            {
+                traversed += m_nodes[node].links[level].span;
+                node = Next(node, level);
+            }
+            if(traversed == rank)
+                return ConstIterator(this, node, rank);
+        }
+        return constEnd();
+    }
+
+    ConstIterator constBegin() const
+    {
+        return ConstIterator(this, Next(HEAD, 0), 1);
+    }
+
+    ConstIterator constEnd() const
+    {
+        return ConstIterator(this, NIL, m_length + 1);
+    }
+
+private:
+
+    static bool Before(const Node &left, const Node &right)
+    {
+        return left.score > right.score || (left.score == right.score && left.id < right.id);
+    }
+
+    quint32 Next(quint32 node, int level) const
+    {
+        return m_nodes[node].links[level].next;
+    }
+
+    static int RandomLevel()
+    {
+        auto level = 1;
+        while(level < MAX_LEVEL && (QRandomGenerator::global()->generate() & 3) == 0)
+            ++level;
+        return level;
+    }
+
+    quint32 Allocate(qint64 id, qint64 score, int level)
+    {
+        auto node = Node{id, score, {}};
+        node.links.resize(level);
+        if(!m_free.empty())
+        {
+            const auto index = m_free.back();
+            m_free.pop_back();
+            m_nodes[index] = std::move(node);
+            return index;
+        }
+        m_nodes.push_back(std::move(node));
+        return quint32(m_nodes.size() - 1);
+    }
+
+    void Insert(qint64 id, qint64 score)
+    {
+        //allocated first, growing the vector would invalidate references taken below
+        const auto level = RandomLevel();
+        const auto inserted = Allocate(id, score, level);
+
+        auto update = std::array<quint32, MAX_LEVEL>{};
+        auto rank = std::array<qsizetype, MAX_LEVEL>{};
+        auto node = HEAD;
+        for(auto i = m_level - 1; i >= 0; --i)
+        {
+            rank[i] = i == m_level - 1 ? 0 : rank[i + 1];
+            for(auto next = Next(node, i); next != NIL && Before(m_nodes[next], m_nodes[inserted]); next = Next(node, i))
+            {
+                rank[i] += m_nodes[node].links[i].span;
+                node = next;
+            }
+            update[i] = node;
+        }
+
+        if(level > m_level)
+        {
+            for(auto i = m_level; i < level; ++i)
+            {
+                rank[i] = 0;
+                update[i] = HEAD;
+                m_nodes[HEAD].links[i].span = quint32(m_length);
+            }
+            m_level = level;
+        }
+
+        for(auto i = 0; i < level; ++i)
+        {
+            auto &previous = m_nodes[update[i]].links[i];
+            auto &link = m_nodes[inserted].links[i];
+            link.next = previous.next;
+            previous.next = inserted;
+            link.span = previous.span - quint32(rank[0] - rank[i]);
+            previous.span = quint32(rank[0] - rank[i]) + 1;
+        }
+
+        for(auto i = level; i < m_level; ++i)
+            ++m_nodes[update[i]].links[i].span;
+
+        m_index.insert(id, inserted);
+        ++m_length;
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<quint32> m_free;
+    QHash<qint64, quint32> m_index;
+    qsizetype m_length = 0;
+    int m_level = 1;
+};
+
+//scores per session with rank queries and cached top pages
+//a score change only invalidates the cached pages between the old and the new rank
+class Leaderboard
+{
+public:
+
+    void SetScore(qint64 sessionId, qint64 score)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        if(m_ranking.ScoreOf(sessionId) == score)
+            return;
+
+        const auto oldRank = m_ranking.RankOf(sessionId);
+        m_ranking.Set(sessionId, score);
+        const auto newRank = m_ranking.RankOf(sessionId).value();
+
+        if(oldRank.has_value())
+            m_cache.InvalidateRange(qMin(oldRank.value(), newRank), qMax(oldRank.value(), newRank));
+        else
+            m_cache.InvalidateMembership(newRank);
+    }
+
+    //?page=<n>&per_page=<n>, same shape as the CRUD lists with ranks as keys
+    QHttpServerResponse GetPage(const QHttpServerRequest &request) const
+    {
+        using PaginatedDataType = PaginatedData<RankingSkipList>;
+        const auto query = request.query();
+        const auto page = query.hasQueryItem("page")
+            ?   query.queryItemValue("page").toLongLong() : PaginatedDataType::DEFAULT_PAGE;
+        const auto perPage = query.hasQueryItem("per_page")
+            ?   query.queryItemValue("per_page").toLongLong() : PaginatedDataType::DEFAULT_PAGE_SIZE;
+        if(page < 1 || perPage < 1)
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+        const auto &headers = request.headers();
+        const auto format = ResponseFormat(headers);
+        const auto generation = m_cache.Generation();
+        auto optionalPayload = m_cache.FindPage(page, perPage, ALL_FIELDS, format);
+        if(!optionalPayload.has_value())
+        {
+            auto locker = QMutexLocker(&m_mutex);
+            const auto paginatedData = PaginatedDataType{m_ranking, page, perPage};
+            if(!paginatedData.IsValid())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
+
+            optionalPayload = CachedPayload::FromValue(paginatedData, format);
+            m_cache.StorePage(page, perPage, ALL_FIELDS, format, paginatedData.FirstKey(), paginatedData.LastKey(), optionalPayload.value(), generation);
+        }
+
+        return m_cache.Respond(optionalPayload.value(), GetValueFromHeader(headers, "If-None-Match"), GetValueFromHeader(headers, "Accept-Encoding"));
+    }
+
+    QHttpServerResponse GetRank(qint64 sessionId) const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto rank = m_ranking.RankOf(sessionId);
+        if(!rank.has_value())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
+
+        auto entry = LeaderboardEntry{};
+        entry.id = sessionId;
+        entry.score = m_ranking.ScoreOf(sessionId).value();
+        entry.rank = rank.value();
+        auto json = entry.ToJSON();
+        json.insert("total", m_ranking.size());
+        return QHttpServerResponse(json);
+    }
+
+    CacheStats GetCacheStats() const
+    {
+        return m_cache.Stats();
+    }
+
+private:
+
+    mutable QMutex m_mutex;
+    RankingSkipList m_ranking;
+    mutable ResponseCache<qsizetype> m_cache;
+};
+
+#endif // LEADERBOARD_HPP
@@ -0,0 +1,191 @@
+#ifndef LISTQUERY_HPP
+#define LISTQUERY_HPP
+
+#include<QUrlQuery>
+#include<algorithm>
+
+#include"Structs.hpp"
+
+//the items of a map that pass a filter, in key order, for PaginatedData and CursorPaginatedData to page over
+//holds iterators into the map, which has to stay alive and unchanged meanwhile
+template<typename Map>
+class FilteredView
+{
+    using MapIterator = typename Map::const_iterator;
+
+public:
+
+    using key_type = typename Map::key_type;
+    using mapped_type = typename Map::mapped_type;
+
+    class const_iterator
+    {
+    public:
+
+        const_iterator() = default;
+
+        const_iterator(const QList<MapIterator> *matches, qsizetype index) :
+            m_matches(matches),
+            m_index(index)
+        {}
+
+        const key_type &key() const
+        {
+            return m_matches->at(m_index).key();
+        }
+
+        const mapped_type &operator*() const
+        {
+            return m_matches->at(m_index).value();
+        }
+
+        const mapped_type *operator->() const
+        {
+            return &m_matches->at(m_index).value();
+        }
+
+        const_iterator &operator++()
+        {
+            ++m_index;
+            return *this;
+        }
+
+        bool operator==(const const_iterator &other) const
+        {
+            return m_index == other.m_index;
+        }
+
+        bool operator!=(const const_iterator &other) const
+        {
+            return m_index != other.m_index;
+        }
+
+    private:
+
+        const QList<MapIterator> *m_matches = nullptr;
+        qsizetype m_index = 0;
+    };
+
+    template<typename Predicate>
+    explicit FilteredView(const Map &map, Predicate &&matches)
+    {
+        for(auto item = map.constBegin(); item != map.constEnd(); ++item)
+        {
+            if(matches(item.value()))
+                m_matches.append(item);
+        }
+    }
+
+    FilteredView(const FilteredView &) = delete;
+    FilteredView &operator=(const FilteredView &) = delete;
+
+    qsizetype size() const
+    {
+        return m_matches.size();
+    }
+
+    const_iterator constBegin() const
+    {
+        return const_iterator(&m_matches, 0);
+    }
+
+    const_iterator constEnd() const
+    {
+        return const_iterator(&m_matches, m_matches.size());
+    }
+
+    const_iterator ConstIteratorAt(qsizetype index) const
+    {
+        if(index < 0 || index >= m_matches.size())
+            return constEnd();
+        return const_iterator(&m_matches, index);
+    }
+
+    const_iterator upperBound(const key_type &key) const
+    {
+        const auto match = std::upper_bound(m_matches.cbegin(), m_matches.cend(), key,
+                                            [](const key_type &key, const MapIterator &item){ return key < item.key(); });
+        return const_iterator(&m_matches, match - m_matches.cbegin());
+    }
+
+private:
+
+    QList<MapIterator> m_matches;
+};
+
+//query filters a list route evaluates while it pages, types without a specialization take none
+//FromQuery leaves filter empty when the query names no filter and returns false for a malformed one
+//Key is the same for filters that match the same items, filtered pages are cached under it
+template<typename T>
+struct ItemFilter
+{
+    static constexpr bool Supported = false;
+};
+
+//text prefixes are matched case insensitively
+template<>
+struct ItemFilter<Question>
+{
+    static constexpr bool Supported = true;
+
+    std::optional<qint64> categoryId;
+    QString textPrefix;
+
+    static bool FromQuery(const QUrlQuery &query, std::optional<ItemFilter> &filter)
+    {
+        if(!query.hasQueryItem("category") && !query.hasQueryItem("text_prefix"))
+            return true;
+
+        auto parsed = ItemFilter{};
+        if(query.hasQueryItem("category"))
+        {
+            auto valid = false;
+            parsed.categoryId = query.queryItemValue("category").toLongLong(&valid);
+            if(!valid)
+                return false;
+        }
+        parsed.textPrefix = query.queryItemValue("text_prefix", QUrl::FullyDecoded);
+        filter = parsed;
+        return true;
+    }
+
+    //never empty, an empty key stands for the unfiltered list
+    QString Key() const
+    {
+        return QString("category=%1&text_prefix=%2")
+            .arg(categoryId.has_value() ? QString::number(categoryId.value()) : QString(), textPrefix.toCaseFolded());
+    }
+
+    bool Matches(const Question &question) const
+    {
+        return (!categoryId.has_value() || question.categoryId == categoryId.value())
+               && question.questionText.startsWith(textPrefix, Qt::CaseInsensitive);
+    }
+};
+
+template<>
+struct ItemFilter<Category>
+{
+    static constexpr bool Supported = true;
+
+    QString textPrefix;
+
+    static bool FromQuery(const QUrlQuery &query, std::optional<ItemFilter> &filter)
+    {
+        if(query.hasQueryItem("text_prefix"))
+            filter = ItemFilter{query.queryItemValue("text_prefix", QUrl::FullyDecoded)};
+        return true;
+    }
+
+    QString Key() const
+    {
+        return QString("text_prefix=%1").arg(textPrefix.toCaseFolded());
+    }
+
+    bool Matches(const Category &category) const
+    {
+        return category.categoryText.startsWith(textPrefix, Qt::CaseInsensitive);
+    }
+};
+
+#endif // LISTQUERY_HPP
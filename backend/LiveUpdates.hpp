@@ -0,0 +1,150 @@
+#ifndef LIVEUPDATES_HPP
+#define LIVEUPDATES_HPP
+
+#include<QHash>
+#include<QMutex>
+#include<QWebSocket>
+
+#include"RestAPI.hpp"
+
+//change events of one collection pushed to websocket subscribers, so lobbies stop polling the lists
+//an event is encoded once into a shared string, every server loop gets it through one queued call
+//and writes that same string to each of its subscribers
+//{"seq", "op": "create" | "update" | "delete", "id", "item"}, item is missing for a delete and in its public form otherwise
+//a subscriber first gets {"seq", "op": "hello"} with the sequence of the latest change at that point
+class LiveFeed
+{
+public:
+
+    //a subscriber that lets this much pile up unread is dropped, it has to resubscribe and reload
+    static constexpr qint64 MAX_BACKLOG = 1 << 20;
+
+    //subscribers of one feed on one server loop, lives on that loop's thread
+    class Hub : public QObject
+    {
+    public:
+
+        explicit Hub(LiveFeed &feed, QObject *parent) :
+            QObject(parent),
+            m_feed(feed)
+        {
+            m_feed.AddHub(this);
+        }
+
+        ~Hub() override
+        {
+            m_feed.RemoveHub(this);
+            m_feed.m_subscribers.fetch_sub(m_sockets.size(), std::memory_order_relaxed);
+        }
+
+        void Subscribe(QWebSocket *socket)
+        {
+            socket->setParent(this);
+            m_sockets.append(socket);
+            m_feed.m_subscribers.fetch_add(1, std::memory_order_relaxed);
+            QObject::connect(socket, &QWebSocket::disconnected, this, [this, socket]()
+            {
+                Drop(socket);
+            });
+            socket->sendTextMessage(QString(R"({"seq":%1,"op":"hello"})").arg(m_feed.m_sequence.load(std::memory_order_acquire)));
+        }
+
+        //closing a socket drops it right away, so the loop runs over a copy
+        void Broadcast(const QString &event)
+        {
+            const auto sockets = m_sockets;
+            for(auto *socket: sockets)
+            {
+                if(socket->bytesToWrite() > MAX_BACKLOG)
+                    socket->close(QWebSocketProtocol::CloseCodePolicyViolated, "subscriber too slow");
+                else
+                    socket->sendTextMessage(event);
+            }
+        }
+
+    private:
+
+        void Drop(QWebSocket *socket)
+        {
+            if(!m_sockets.removeOne(socket))
+                return;
+            m_feed.m_subscribers.fetch_sub(1, std::memory_order_relaxed);
+            socket->deleteLater();
+        }
+
+        LiveFeed &m_feed;
+        QList<QWebSocket *> m_sockets;
+    };
+
+    //the replayed creations of existing items only advance the sequence, nobody is subscribed yet
+    template<typename T>
+    explicit LiveFeed(CRUDAPI<qint64, T> &api)
+    {
+        api.AddChangeListener([this](const qint64 &id, const T *before, const T *after)
+        {
+            const auto sequence = m_sequence.fetch_add(1, std::memory_order_acq_rel) + 1;
+            if(m_subscribers.load(std::memory_order_relaxed) == 0)
+                return;
+            Publish(EncodeEvent(sequence, id, before, after));
+        });
+    }
+
+    LiveFeed(const LiveFeed &) = delete;
+    LiveFeed &operator=(const LiveFeed &) = delete;
+
+    template<typename T>
+    static QString EncodeEvent(quint64 sequence, qint64 id, const T *before, const T *after)
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Serialize);
+        auto buffer = QByteArray{};
+        auto writer = JSONWriter(buffer);
+        writer.BeginObject();
+        writer.Key("seq");
+        writer.Integer(qint64(sequence));
+        writer.Key("op");
+        writer.String(!before ? QStringView(u"create") : !after ? QStringView(u"delete") : QStringView(u"update"));
+        writer.Key("id");
+        writer.Integer(id);
+        if(after)
+        {
+            writer.Key("item");
+            WriteProjectedItem(writer, *after, PUBLIC_FIELDS);
+        }
+        writer.EndObject();
+        return QString::fromUtf8(buffer);
+    }
+
+    qint64 Subscribers() const
+    {
+        return m_subscribers.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    //posted under the mutex, so a hub being destroyed either still gets the call removed with it or is already gone
+    void Publish(const QString &event)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        for(auto *hub: std::as_const(m_hubs))
+            QMetaObject::invokeMethod(hub, [hub, event]() { hub->Broadcast(event); }, Qt::QueuedConnection);
+    }
+
+    void AddHub(Hub *hub)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_hubs.append(hub);
+    }
+
+    void RemoveHub(Hub *hub)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_hubs.removeOne(hub);
+    }
+
+    QMutex m_mutex;
+    QList<Hub *> m_hubs;
+    std::atomic<quint64> m_sequence{0};
+    std::atomic<qint64> m_subscribers{0};
+};
+
+#endif // LIVEUPDATES_HPP
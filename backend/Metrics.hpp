@@ -0,0 +1,315 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include<QElapsedTimer>
+#include<QList>
+#include<QMutex>
+#include<QPair>
+#include<QString>
+#include<QtAlgorithms>
+#include<array>
+#include<atomic>
+#include<memory>
+#include<utility>
+#include<vector>
+
+//latency histogram with hdr-like log-linear buckets, 8 linear sub-buckets per power of two (12.5% resolution)
+//written by one thread only, so increments are plain relaxed load/store without any locked instruction
+class LatencyHistogram
+{
+public:
+
+    static constexpr int SUB_BITS = 3;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_EXPONENT = 40; //~1100 s in nanoseconds
+    static constexpr int BUCKET_COUNT = (MAX_EXPONENT - SUB_BITS + 2) * SUB_COUNT;
+
+    static int BucketOf(quint64 nanoseconds)
+    {
+        if(nanoseconds < 2 * SUB_COUNT)
+            return int(nanoseconds);
+
+        const auto exponent = qMin(63 - qCountLeadingZeroBits(nanoseconds), MAX_EXPONENT);
+        const auto sub = qMin(quint64(2 * SUB_COUNT - 1), nanoseconds >> (exponent - SUB_BITS)) - SUB_COUNT;
+        return (exponent - SUB_BITS + 1) * SUB_COUNT + int(sub);
+    }
+
+    //exclusive upper bound of a bucket
+    static quint64 UpperBound(int bucket)
+    {
+        if(bucket < 2 * SUB_COUNT)
+            return quint64(bucket) + 1;
+
+        const auto exponent = bucket / SUB_COUNT + SUB_BITS - 1;
+        const auto sub = quint64(bucket % SUB_COUNT);
+        return (SUB_COUNT + sub + 1) << (exponent - SUB_BITS);
+    }
+
+    void Record(quint64 nanoseconds)
+    {
+        Increment(m_buckets[BucketOf(nanoseconds)], 1);
+        Increment(m_count, 1);
+        Increment(m_sum, nanoseconds);
+    }
+
+    //readers may see a bucket one increment ahead of the count, the exposition sums buckets itself
+    void AddTo(std::array<quint64, BUCKET_COUNT> &buckets, quint64 &sum) const
+    {
+        for(auto i = 0; i < BUCKET_COUNT; ++i)
+            buckets[i] += m_buckets[i].load(std::memory_order_relaxed);
+        sum += m_sum.load(std::memory_order_relaxed);
+    }
+
+    quint64 Count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static void Increment(std::atomic<quint64> &value, quint64 amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    std::atomic<quint64> m_buckets[BUCKET_COUNT] = {};
+    std::atomic<quint64> m_count{0};
+    std::atomic<quint64> m_sum{0};
+};
+
+//per route request metrics, every thread writes into its own shard and /metrics sums the shards
+class MetricsRegistry
+{
+public:
+
+    enum class Phase
+    {
+        Handler,
+        Parse,
+        Auth,
+        Store,
+        Serialize,
+        Count
+    };
+
+    static constexpr int PHASE_COUNT = int(Phase::Count);
+    static constexpr int MAX_SERIES = 256;
+    static constexpr int STATUS_CLASSES = 6;
+
+    static MetricsRegistry &Instance()
+    {
+        static auto registry = MetricsRegistry{};
+        return registry;
+    }
+
+    //series are created while routes are registered, never on the request path
+    int Series(const QString &method, const QString &route)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto key = qMakePair(method, route);
+        const auto existing = m_series.indexOf(key);
+        if(existing >= 0)
+            return int(existing);
+
+        Q_ASSERT(m_series.size() < MAX_SERIES);
+        if(m_series.size() >= MAX_SERIES)
+            return -1;
+        m_series.append(key);
+        return int(m_series.size() - 1);
+    }
+
+    void Record(int series, Phase phase, quint64 nanoseconds)
+    {
+        if(series < 0)
+            return;
+        CurrentShard().Series(series).phases[int(phase)].Record(nanoseconds);
+    }
+
+    void CountResponse(int statusCode)
+    {
+        auto &status = CurrentShard().statuses[qBound(0, statusCode / 100, STATUS_CLASSES - 1)];
+        status.store(status.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    //prometheus text format 0.0.4
+    QByteArray Exposition() const
+    {
+        static constexpr std::array<double, 17> BOUNDS =
+            {0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+        static const char *PHASE_NAMES[PHASE_COUNT] = {"handler", "parse", "auth", "store", "serialize"};
+
+        auto locker = QMutexLocker(&m_mutex);
+        auto text = QByteArray{};
+        text.append("# HELP webquiz_request_phase_seconds Time spent per request phase, phases may nest inside the handler.\n");
+        text.append("# TYPE webquiz_request_phase_seconds histogram\n");
+
+        for(auto series = 0; series < m_series.size(); ++series)
+        {
+            for(auto phase = 0; phase < PHASE_COUNT; ++phase)
+            {
+                auto buckets = std::array<quint64, LatencyHistogram::BUCKET_COUNT>{};
+                auto sum = quint64{0};
+                for(const auto &shard: m_shards)
+                {
+                    const auto *seriesShard = shard->series[series].load(std::memory_order_acquire);
+                    if(seriesShard)
+                        seriesShard->phases[phase].AddTo(buckets, sum);
+                }
+
+                auto count = quint64{0};
+                for(const auto bucket: buckets)
+                    count += bucket;
+                if(count == 0)
+                    continue;
+
+                const auto labels = QByteArray("method=\"").append(m_series[series].first.toUtf8())
+                                        .append("\",route=\"").append(m_series[series].second.toUtf8())
+                                        .append("\",phase=\"").append(PHASE_NAMES[phase]).append('"');
+
+                //buckets are counted under a bound once their whole range lies below it
+                auto cumulative = quint64{0};
+                auto bucket = 0;
+                for(const auto bound: BOUNDS)
+                {
+                    const auto boundNs = quint64(bound * 1e9);
+                    for(; bucket < LatencyHistogram::BUCKET_COUNT && LatencyHistogram::UpperBound(bucket) <= boundNs; ++bucket)
+                        cumulative += buckets[bucket];
+                    text.append("webquiz_request_phase_seconds_bucket{").append(labels)
+                        .append(",le=\"").append(QByteArray::number(bound, 'g')).append("\"} ")
+                        .append(QByteArray::number(cumulative)).append('\n');
+                }
+                text.append("webquiz_request_phase_seconds_bucket{").append(labels).append(",le=\"+Inf\"} ")
+                    .append(QByteArray::number(count)).append('\n');
+                text.append("webquiz_request_phase_seconds_sum{").append(labels).append("} ")
+                    .append(QByteArray::number(sum / 1e9, 'g', 9)).append('\n');
+                text.append("webquiz_request_phase_seconds_count{").append(labels).append("} ")
+                    .append(QByteArray::number(count)).append('\n');
+            }
+        }
+
+        text.append("# HELP webquiz_responses_total Responses sent by status class.\n");
+        text.append("# TYPE webquiz_responses_total counter\n");
+        for(auto statusClass = 1; statusClass < STATUS_CLASSES; ++statusClass)
+        {
+            auto total = quint64{0};
+            for(const auto &shard: m_shards)
+                total += shard->statuses[statusClass].load(std::memory_order_relaxed);
+            text.append("webquiz_responses_total{code=\"").append(QByteArray::number(statusClass)).append("xx\"} ")
+                .append(QByteArray::number(total)).append('\n');
+        }
+
+        return text;
+    }
+
+private:
+
+    MetricsRegistry() = default;
+
+    struct SeriesShard
+    {
+        LatencyHistogram phases[PHASE_COUNT];
+    };
+
+    //kept after its thread exits so the totals never go backwards
+    struct ThreadShard
+    {
+        std::atomic<SeriesShard *> series[MAX_SERIES] = {};
+        std::atomic<quint64> statuses[STATUS_CLASSES] = {};
+
+        ~ThreadShard()
+        {
+            for(auto &seriesShard: series)
+                delete seriesShard.load(std::memory_order_relaxed);
+        }
+
+        SeriesShard &Series(int index)
+        {
+            auto *seriesShard = series[index].load(std::memory_order_relaxed);
+            if(!seriesShard)
+            {
+                seriesShard = new SeriesShard{};
+                series[index].store(seriesShard, std::memory_order_release);
+            }
+            return *seriesShard;
+        }
+    };
+
+    ThreadShard &CurrentShard()
+    {
+        thread_local auto *shard = static_cast<ThreadShard *>(nullptr);
+        if(!shard)
+        {
+            auto locker = QMutexLocker(&m_mutex);
+            m_shards.push_back(std::make_unique<ThreadShard>());
+            shard = m_shards.back().get();
+        }
+        return *shard;
+    }
+
+    mutable QMutex m_mutex;
+    QList<QPair<QString, QString>> m_series;
+    std::vector<std::unique_ptr<ThreadShard>> m_shards;
+};
+
+//marks the calling thread as handling a request of a series, the whole scope is the handler phase
+class RequestScope
+{
+public:
+
+    explicit RequestScope(int series) :
+        m_previous(std::exchange(CurrentSeries(), series))
+    {
+        m_timer.start();
+    }
+
+    ~RequestScope()
+    {
+        MetricsRegistry::Instance().Record(CurrentSeries(), MetricsRegistry::Phase::Handler, quint64(m_timer.nsecsElapsed()));
+        CurrentSeries() = m_previous;
+    }
+
+    RequestScope(const RequestScope &) = delete;
+    RequestScope &operator=(const RequestScope &) = delete;
+
+    static int &CurrentSeries()
+    {
+        thread_local auto series = -1;
+        return series;
+    }
+
+private:
+
+    int m_previous;
+    QElapsedTimer m_timer;
+};
+
+//time of one phase of the current request, free outside of a request
+class PhaseScope
+{
+public:
+
+    explicit PhaseScope(MetricsRegistry::Phase phase) :
+        m_series(RequestScope::CurrentSeries()),
+        m_phase(phase)
+    {
+        if(m_series >= 0)
+            m_timer.start();
+    }
+
+    ~PhaseScope()
+    {
+        if(m_series >= 0)
+            MetricsRegistry::Instance().Record(m_series, m_phase, quint64(m_timer.nsecsElapsed()));
+    }
+
+    PhaseScope(const PhaseScope &) = delete;
+    PhaseScope &operator=(const PhaseScope &) = delete;
+
+private:
+
+    int m_series;
+    MetricsRegistry::Phase m_phase;
+    QElapsedTimer m_timer;
+};
+
+#endif // METRICS_HPP
@@ -0,0 +1,307 @@
+#ifndef QUIZAPI_HPP
+#define QUIZAPI_HPP
+
+#include<QMutex>
+#include<QRandomGenerator>
+#include<QVarLengthArray>
+#include<QtAlgorithms>
+
+#include"RestAPI.hpp"
+
+//question ids grouped by category for random draws
+//every category keeps an append-only slot array with a bitmask of live slots, deleted questions leave a tombstone
+//per session seen sets are bitsets over the same slots, so a repeat-free draw never looks at other categories
+//a category keeps a bounded number of seen sets, the session that drew from it longest ago starts over first
+class QuestionIndex
+{
+public:
+
+    static constexpr qsizetype MAX_DRAW = 100;
+    static constexpr qsizetype MAX_SEEN_SETS = 4096;
+
+    //kept in sync through CRUDAPI<qint64, Question>::AddChangeListener
+    void Apply(qint64 questionId, const Question *before, const Question *after)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto beforeCategory = before ? std::optional<qint64>(before->categoryId) : std::nullopt;
+        const auto afterCategory = after ? std::optional<qint64>(after->categoryId) : std::nullopt;
+        if(beforeCategory == afterCategory)
+            return;
+
+        if(beforeCategory.has_value())
+            Remove(questionId);
+        if(afterCategory.has_value())
+            Add(questionId, afterCategory.value());
+    }
+
+    struct Draw
+    {
+        QList<qint64> questionIds;
+        qsizetype remaining;
+    };
+
+    //session draws never repeat a question until the session's seen set of the category is reset
+    Draw DrawQuestions(qint64 categoryId, qsizetype count, std::optional<qint64> sessionId, bool reset)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto bucket = m_buckets.find(categoryId);
+        if(bucket == m_buckets.end())
+            return Draw{{}, 0};
+
+        auto *seen = static_cast<Seen *>(nullptr);
+        auto seenLive = qsizetype{0};
+        if(sessionId.has_value())
+        {
+            if(!bucket->seen.contains(sessionId.value()) && bucket->seen.size() >= MAX_SEEN_SETS)
+                DropStalestSeen(*bucket);
+            seen = &bucket->seen[sessionId.value()];
+            if(reset)
+                *seen = Seen{};
+            seen->bits.resize(bucket->live.size(), 0);
+            seen->lastDraw = ++m_drawClock;
+
+            //bits of removed questions stay behind, only the live ones count
+            for(qsizetype word = 0; word < bucket->live.size(); ++word)
+                seenLive += qPopulationCount(seen->bits[word] & bucket->live[word]);
+        }
+
+        const auto available = bucket->liveCount - seenLive;
+        count = qMin(count, available);
+
+        auto picked = QVarLengthArray<qsizetype, MAX_DRAW>{};
+        const auto taken = [seen, &picked](qsizetype slot)
+        {
+            return (seen && TestBit(seen->bits, slot)) || std::find(picked.cbegin(), picked.cend(), slot) != picked.cend();
+        };
+
+        //rejection sampling touches one slot per attempt while free slots are dense enough
+        if(count * 2 <= available && available * 4 >= bucket->slots.size())
+        {
+            for(auto attempts = count * 16; picked.size() < count && attempts > 0; --attempts)
+            {
+                const auto slot = qsizetype(QRandomGenerator::global()->bounded(qint64(bucket->slots.size())));
+                if(TestBit(bucket->live, slot) && !taken(slot))
+                    picked.append(slot);
+            }
+        }
+
+        //sparse or unlucky, pick the rest from the free slots word by word
+        if(picked.size() < count)
+        {
+            auto free = QList<qsizetype>{};
+            free.reserve(available);
+            for(qsizetype word = 0; word < bucket->live.size(); ++word)
+            {
+                auto bits = bucket->live[word] & ~(seen ? seen->bits[word] : 0);
+                while(bits)
+                {
+                    const auto slot = word * 64 + qCountTrailingZeroBits(bits);
+                    bits &= bits - 1;
+                    if(!taken(slot))
+                        free.append(slot);
+                }
+            }
+
+            //partial fisher-yates, only as many swaps as slots still needed
+            for(qsizetype i = 0; picked.size() < count && i < free.size(); ++i)
+            {
+                const auto j = i + qsizetype(QRandomGenerator::global()->bounded(qint64(free.size() - i)));
+                std::swap(free[i], free[j]);
+                picked.append(free[i]);
+            }
+        }
+
+        auto draw = Draw{{}, available - picked.size()};
+        draw.questionIds.reserve(picked.size());
+        for(const auto slot: picked)
+        {
+            draw.questionIds.append(bucket->slots[slot]);
+            if(seen)
+                SetBit(seen->bits, slot);
+        }
+        return draw;
+    }
+
+    qsizetype CategorySize(qint64 categoryId) const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto bucket = m_buckets.constFind(categoryId);
+        return bucket == m_buckets.constEnd() ? 0 : bucket->liveCount;
+    }
+
+private:
+
+    struct Seen
+    {
+        QList<quint64> bits;
+        quint64 lastDraw = 0;
+    };
+
+    struct Bucket
+    {
+        QList<qint64> slots;
+        QList<quint64> live;
+        qsizetype liveCount = 0;
+        QHash<qint64, Seen> seen;
+    };
+
+    struct Location
+    {
+        qint64 categoryId;
+        qsizetype slot;
+    };
+
+    static bool TestBit(const QList<quint64> &bits, qsizetype index)
+    {
+        const auto word = index / 64;
+        return word < bits.size() && (bits[word] >> (index % 64)) & 1;
+    }
+
+    static void SetBit(QList<quint64> &bits, qsizetype index)
+    {
+        if(index / 64 >= bits.size())
+            bits.resize(index / 64 + 1, 0);
+        bits[index / 64] |= quint64{1} << (index % 64);
+    }
+
+    static void ClearBit(QList<quint64> &bits, qsizetype index)
+    {
+        if(index / 64 < bits.size())
+            bits[index / 64] &= ~(quint64{1} << (index % 64));
+    }
+
+    void Add(qint64 questionId, qint64 categoryId)
+    {
+        auto &bucket = m_buckets[categoryId];
+        const auto slot = bucket.slots.size();
+        bucket.slots.append(questionId);
+        SetBit(bucket.live, slot);
+        ++bucket.liveCount;
+        m_locations.insert(questionId, Location{categoryId, slot});
+    }
+
+    //runs in the change listener, so seen sets are left alone and masked with the live bits on draw
+    void Remove(qint64 questionId)
+    {
+        const auto location = m_locations.constFind(questionId);
+        if(location == m_locations.constEnd())
+            return;
+
+        const auto categoryId = location->categoryId;
+        auto &bucket = m_buckets[categoryId];
+        ClearBit(bucket.live, location->slot);
+        --bucket.liveCount;
+        m_locations.erase(location);
+
+        const auto tombstones = bucket.slots.size() - bucket.liveCount;
+        if(tombstones > 64 && tombstones * 2 > bucket.slots.size())
+            Compact(categoryId, bucket);
+    }
+
+    //drops tombstones, slots and seen bits keep their relative order
+    void Compact(qint64 categoryId, Bucket &bucket)
+    {
+        auto compacted = Bucket{};
+        compacted.slots.reserve(bucket.liveCount);
+        for(auto seen = bucket.seen.cbegin(); seen != bucket.seen.cend(); ++seen)
+            compacted.seen.insert(seen.key(), Seen{{}, seen->lastDraw});
+
+        for(qsizetype slot = 0; slot < bucket.slots.size(); ++slot)
+        {
+            if(!TestBit(bucket.live, slot))
+                continue;
+
+            const auto newSlot = compacted.slots.size();
+            compacted.slots.append(bucket.slots[slot]);
+            SetBit(compacted.live, newSlot);
+            m_locations[bucket.slots[slot]].slot = newSlot;
+            for(auto seen = bucket.seen.cbegin(); seen != bucket.seen.cend(); ++seen)
+            {
+                if(TestBit(seen->bits, slot))
+                    SetBit(compacted.seen[seen.key()].bits, newSlot);
+            }
+        }
+
+        compacted.liveCount = compacted.slots.size();
+        m_buckets.insert(categoryId, std::move(compacted));
+    }
+
+    //only paid when a new session draws from a full category
+    static void DropStalestSeen(Bucket &bucket)
+    {
+        auto stalest = bucket.seen.begin();
+        for(auto seen = bucket.seen.begin(); seen != bucket.seen.end(); ++seen)
+        {
+            if(seen->lastDraw < stalest->lastDraw)
+                stalest = seen;
+        }
+        if(stalest != bucket.seen.end())
+            bucket.seen.erase(stalest);
+    }
+
+    mutable QMutex m_mutex;
+    QHash<qint64, Bucket> m_buckets;
+    QHash<qint64, Location> m_locations;
+    quint64 m_drawClock = 0;
+};
+
+class QuizAPI
+{
+public:
+
+    explicit QuizAPI(CRUDAPI<qint64, Question> &questions) :
+        m_questions(questions)
+    {
+        m_questions.AddChangeListener([this](const qint64 &questionId, const Question *before, const Question *after)
+        {
+            m_index.Apply(questionId, before, after);
+        });
+    }
+
+    QuizAPI(const QuizAPI &) = delete;
+    QuizAPI &operator=(const QuizAPI &) = delete;
+
+    //?category=<id>&count=<n>[&reset=1], the session only matters for repeat-free draws
+    //a bad parameter is named in the 400 body, reset=1 needs a session
+    QHttpServerResponse GetRandomQuestions(const QHttpServerRequest &request, std::optional<qint64> sessionId)
+    {
+        const auto query = request.query();
+        const auto format = ResponseFormat(request.headers());
+        auto validCategory = false;
+        const auto categoryId = query.queryItemValue("category").toLongLong(&validCategory);
+        if(!validCategory)
+            return BadParameter("category", format);
+
+        auto validCount = true;
+        const auto count = query.hasQueryItem("count")
+            ?   query.queryItemValue("count").toLongLong(&validCount) : qlonglong{1};
+        if(!validCount || count < 1 || count > QuestionIndex::MAX_DRAW)
+            return BadParameter("count", format);
+
+        const auto reset = query.queryItemValue("reset") == "1";
+        if(reset && !sessionId.has_value())
+            return BadParameter("reset", format);
+
+        const auto draw = DrawQuestions(categoryId, count, sessionId, reset);
+        const auto data = m_questions.ItemsToJSON(draw.questionIds);
+        return FormattedResponse(QJsonObject
+            {
+                {"category", categoryId},
+                {"count", data.size()},
+                {"remaining", draw.remaining},
+                {"data", data}
+            }, format);
+    }
+
+    QuestionIndex::Draw DrawQuestions(qint64 categoryId, qsizetype count, std::optional<qint64> sessionId, bool reset)
+    {
+        return m_index.DrawQuestions(categoryId, count, sessionId, reset);
+    }
+
+private:
+
+    CRUDAPI<qint64, Question> &m_questions;
+    QuestionIndex m_index;
+};
+
+#endif // QUIZAPI_HPP
@@ -0,0 +1,443 @@
+#ifndef RESPONSECACHE_HPP
+#define RESPONSECACHE_HPP
+
+#include<QCryptographicHash>
+#include<QHttpServerResponse>
+#include<QJsonDocument>
+#include<QMutex>
+#include<algorithm>
+#include<atomic>
+#include<memory>
+#include<mutex>
+
+#include"CBORWriter.hpp"
+#include"Compression.hpp"
+#include"Metrics.hpp"
+#include"Structs.hpp"
+
+//compressed forms of one payload, made on first request and shared by every copy of it
+//an empty body means the coding did not pay off and the raw body goes out instead
+struct EncodedBodies
+{
+    std::array<std::once_flag, CONTENT_ENCODING_COUNT> once;
+    std::array<QByteArray, CONTENT_ENCODING_COUNT> bodies;
+};
+
+//final bytes of a response together with their strong validator
+struct CachedPayload
+{
+    QByteArray body;
+    QByteArray etag;
+    QByteArray contentType = MediaTypeOf(WireFormat::JSON);
+    std::shared_ptr<EncodedBodies> encoded = std::make_shared<EncodedBodies>();
+
+    //body in the given coding, compressed once per payload, nullptr when it goes out raw
+    const QByteArray *Encoded(ContentEncoding encoding) const
+    {
+        if(encoding == ContentEncoding::Identity || body.size() < MIN_COMPRESSED_SIZE)
+            return nullptr;
+
+        const auto index = int(encoding);
+        std::call_once(encoded->once[index], [this, encoding, index]()
+        {
+            const auto phase = PhaseScope(MetricsRegistry::Phase::Serialize);
+            const auto compressed = Compress(body, encoding);
+            if(compressed.has_value() && compressed.value().size() < body.size())
+                encoded->bodies[index] = compressed.value();
+        });
+
+        const auto &bodyInEncoding = encoded->bodies[index];
+        return bodyInEncoding.isEmpty() ? nullptr : &bodyInEncoding;
+    }
+
+    //each coding is its own representation and gets its own strong tag
+    QByteArray EncodedETag(ContentEncoding encoding) const
+    {
+        if(encoding == ContentEncoding::Identity)
+            return etag;
+        return QByteArray(etag).insert(etag.size() - 1, QByteArray("-") + EncodingName(encoding));
+    }
+
+    static CachedPayload FromJSON(const QJsonObject &json)
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Serialize);
+        const auto body = QJsonDocument(json).toJson(QJsonDocument::Compact);
+        return CachedPayload{body, ETagFor(body)};
+    }
+
+    //written straight from the value, the thread's scratch buffer keeps its capacity between payloads
+    template<typename Value>
+    static CachedPayload FromValue(const Value &value, WireFormat format = WireFormat::JSON)
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Serialize);
+        thread_local auto scratch = QByteArray{};
+        scratch.resize(0);
+        if(format == WireFormat::CBOR)
+        {
+            auto writer = CBORWriter(scratch);
+            writer.Write(value);
+        }
+        else
+        {
+            auto writer = JSONWriter(scratch);
+            writer.Write(value);
+        }
+        const auto body = QByteArray(scratch.constData(), scratch.size());
+        return CachedPayload{body, ETagFor(body), MediaTypeOf(format)};
+    }
+
+    static QByteArray ETagFor(const QByteArray &body)
+    {
+        return QByteArray("\"")
+            .append(QCryptographicHash::hash(body, QCryptographicHash::Sha1).toHex())
+            .append('"');
+    }
+};
+
+//If-None-Match uses weak comparison and may list several tags
+static bool MatchesETag(const QByteArray &ifNoneMatch, const QByteArray &etag)
+{
+    if(ifNoneMatch.isEmpty())
+        return false;
+
+    for(const auto &candidate: ifNoneMatch.split(','))
+    {
+        auto tag = candidate.trimmed();
+        if(tag == "*")
+            return true;
+        if(tag.startsWith("W/"))
+            tag = tag.mid(2);
+        if(tag == etag)
+            return true;
+    }
+    return false;
+}
+
+struct CacheStats : public JSONable
+{
+    qint64 itemHits = 0;
+    qint64 itemMisses = 0;
+    qint64 pageHits = 0;
+    qint64 pageMisses = 0;
+    qint64 notModified = 0;
+    qint64 bytesReused = 0;
+    qint64 bytesNotSent = 0;
+    qint64 invalidations = 0;
+    qint64 pageEvictions = 0;
+    qint64 pageBytes = 0;
+    qint64 compressed = 0;
+    qint64 bytesSavedByCompression = 0;
+
+    QJsonObject ToJSON() const override
+    {
+        const auto lookups = itemHits + itemMisses + pageHits + pageMisses;
+        return QJsonObject
+            {
+                {"item_hits", itemHits},
+                {"item_misses", itemMisses},
+                {"page_hits", pageHits},
+                {"page_misses", pageMisses},
+                {"hit_rate", lookups ? double(itemHits + pageHits) / lookups : 0.0},
+                {"not_modified", notModified},
+                {"bytes_reused", bytesReused},
+                {"bytes_not_sent", bytesNotSent},
+                {"invalidations", invalidations},
+                {"page_evictions", pageEvictions},
+                {"page_bytes", pageBytes},
+                {"compressed", compressed},
+                {"bytes_saved_by_compression", bytesSavedByCompression}
+            };
+    }
+};
+
+//serialized item and page responses, invalidated by the mutations of the owning CRUDAPI
+//pages are keyed by client chosen parameters, so they share a byte budget and the least recently used go first
+template<typename K = qint64>
+class ResponseCache
+{
+public:
+
+    //raw page bodies, their compressed forms are made on demand and are each smaller than the body
+    static constexpr qint64 PAGE_BYTE_BUDGET = qint64{32} << 20;
+
+    //a store only lands if nothing was invalidated since the generation was read
+    quint64 Generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    //every wire format is cached on its own
+    std::optional<CachedPayload> FindItem(const K &id, WireFormat format) const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto &items = m_items[int(format)];
+        const auto entry = items.constFind(id);
+        if(entry == items.constEnd())
+        {
+            ++m_itemMisses;
+            return std::nullopt;
+        }
+
+        ++m_itemHits;
+        m_bytesReused += entry.value().body.size();
+        return entry.value();
+    }
+
+    void StoreItem(const K &id, WireFormat format, const CachedPayload &payload, quint64 generation)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        if(generation == Generation())
+            m_items[int(format)].insert(id, payload);
+    }
+
+    //offset pages are keyed by (page, per_page), cursor pages by (after, per_page), both also by fieldset, format and filter
+    //filter is the canonical form of the list's filters, empty for the unfiltered list
+    std::optional<CachedPayload> FindPage(qsizetype page, qsizetype perPage, FieldMask fields, WireFormat format,
+                                          const QString &filter = QString()) const
+    {
+        return FindPage(PageKey{false, false, page, K{}, perPage, fields, format, filter});
+    }
+
+    std::optional<CachedPayload> FindCursorPage(const std::optional<K> &after, qsizetype perPage, FieldMask fields, WireFormat format,
+                                                const QString &filter = QString()) const
+    {
+        return FindPage(PageKey{true, after.has_value(), 0, after.value_or(K{}), perPage, fields, format, filter});
+    }
+
+    void StorePage(qsizetype page, qsizetype perPage, FieldMask fields, WireFormat format, const K &firstKey, const K &lastKey,
+                   const CachedPayload &payload, quint64 generation, const QString &filter = QString())
+    {
+        StorePage(PageKey{false, false, page, K{}, perPage, fields, format, filter}, PageEntry{payload, firstKey, lastKey}, generation);
+    }
+
+    void StoreCursorPage(const std::optional<K> &after, qsizetype perPage, FieldMask fields, WireFormat format, const K &firstKey, const K &lastKey,
+                         const CachedPayload &payload, quint64 generation, const QString &filter = QString())
+    {
+        StorePage(PageKey{true, after.has_value(), 0, after.value_or(K{}), perPage, fields, format, filter}, PageEntry{payload, firstKey, lastKey}, generation);
+    }
+
+    //item changed in place, only the pages that contain it are stale
+    //the change may move it in or out of a filter, which shifts every filtered page, so those go too
+    void InvalidateItem(const K &id)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+        for(auto &items: m_items)
+            items.remove(id);
+        for(auto page = m_pages.begin(); page != m_pages.end();)
+        {
+            if(!page.key().filter.isEmpty() || (page.value().firstKey <= id && id <= page.value().lastKey))
+                page = ErasePage(page);
+            else
+                ++page;
+        }
+        ++m_invalidations;
+    }
+
+    //keys between low and high moved, pages overlapping that range are stale
+    void InvalidateRange(const K &low, const K &high)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+        for(auto page = m_pages.begin(); page != m_pages.end();)
+        {
+            if(!page.key().filter.isEmpty() || (page.value().firstKey <= high && low <= page.value().lastKey))
+                page = ErasePage(page);
+            else
+                ++page;
+        }
+        ++m_invalidations;
+    }
+
+    //item added or removed, every page carries the total so all of them are stale
+    void InvalidateMembership(const K &id)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+        for(auto &items: m_items)
+            items.remove(id);
+        m_pages.clear();
+        m_pageBytes = 0;
+        ++m_invalidations;
+    }
+
+    //something every item embeds changed, nothing cached is current
+    void InvalidateAll()
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+        for(auto &items: m_items)
+            items.clear();
+        m_pages.clear();
+        m_pageBytes = 0;
+        ++m_invalidations;
+    }
+
+    //the coding is negotiated from Accept-Encoding, If-None-Match may carry the tag of any coding of the payload
+    //the wire format comes from Accept, so shared caches have to key on both
+    QHttpServerResponse Respond(const CachedPayload &payload, const QByteArray &ifNoneMatch, const QByteArray &acceptEncoding,
+                                QHttpServerResponder::StatusCode status = QHttpServerResponder::StatusCode::Ok) const
+    {
+        const auto negotiated = NegotiateEncoding(acceptEncoding);
+        const auto *encodedBody = payload.Encoded(negotiated);
+        const auto encoding = encodedBody ? negotiated : ContentEncoding::Identity;
+        const auto etag = payload.EncodedETag(encoding);
+
+        if(MatchesETag(ifNoneMatch, etag) || (encoding != ContentEncoding::Identity && MatchesETag(ifNoneMatch, payload.etag)))
+        {
+            m_notModified.fetch_add(1, std::memory_order_relaxed);
+            m_bytesNotSent.fetch_add(encodedBody ? encodedBody->size() : payload.body.size(), std::memory_order_relaxed);
+            auto response = QHttpServerResponse(QHttpServerResponder::StatusCode::NotModified);
+            response.setHeader("ETag", etag);
+            response.setHeader("Vary", "Accept, Accept-Encoding");
+            return response;
+        }
+
+        auto response = QHttpServerResponse(payload.contentType, encodedBody ? *encodedBody : payload.body, status);
+        response.setHeader("ETag", etag);
+        response.setHeader("Vary", "Accept, Accept-Encoding");
+        if(encodedBody)
+        {
+            response.setHeader("Content-Encoding", EncodingName(encoding));
+            m_compressed.fetch_add(1, std::memory_order_relaxed);
+            m_bytesSavedByCompression.fetch_add(payload.body.size() - encodedBody->size(), std::memory_order_relaxed);
+        }
+        return response;
+    }
+
+    CacheStats Stats() const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        auto stats = CacheStats{};
+        stats.itemHits = m_itemHits;
+        stats.itemMisses = m_itemMisses;
+        stats.pageHits = m_pageHits;
+        stats.pageMisses = m_pageMisses;
+        stats.notModified = m_notModified.load(std::memory_order_relaxed);
+        stats.bytesReused = m_bytesReused;
+        stats.bytesNotSent = m_bytesNotSent.load(std::memory_order_relaxed);
+        stats.invalidations = m_invalidations;
+        stats.pageEvictions = m_pageEvictions;
+        stats.pageBytes = m_pageBytes;
+        stats.compressed = m_compressed.load(std::memory_order_relaxed);
+        stats.bytesSavedByCompression = m_bytesSavedByCompression.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+
+    struct PageKey
+    {
+        bool cursor;
+        bool hasAfter;
+        qsizetype page;
+        K after;
+        qsizetype perPage;
+        FieldMask fields;
+        WireFormat format;
+        QString filter;
+
+        bool operator==(const PageKey &other) const
+        {
+            return cursor == other.cursor && hasAfter == other.hasAfter && page == other.page
+                   && after == other.after && perPage == other.perPage && fields == other.fields && format == other.format
+                   && filter == other.filter;
+        }
+
+        friend size_t qHash(const PageKey &key, size_t seed = 0)
+        {
+            return qHashMulti(seed, key.cursor, key.hasAfter, key.page, key.after, key.perPage, key.fields, int(key.format), key.filter);
+        }
+    };
+
+    struct PageEntry
+    {
+        CachedPayload payload;
+        K firstKey;
+        K lastKey;
+        mutable quint64 lastUsed = 0;
+    };
+
+    using PageIterator = typename QHash<PageKey, PageEntry>::iterator;
+
+    std::optional<CachedPayload> FindPage(const PageKey &key) const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        const auto entry = m_pages.constFind(key);
+        if(entry == m_pages.constEnd())
+        {
+            ++m_pageMisses;
+            return std::nullopt;
+        }
+
+        ++m_pageHits;
+        m_bytesReused += entry.value().payload.body.size();
+        entry.value().lastUsed = ++m_useClock;
+        return entry.value().payload;
+    }
+
+    void StorePage(const PageKey &key, const PageEntry &entry, quint64 generation)
+    {
+        //a page this large would push out most of the others
+        if(entry.payload.body.size() > PAGE_BYTE_BUDGET / 4)
+            return;
+
+        auto locker = QMutexLocker(&m_mutex);
+        if(generation != Generation())
+            return;
+
+        const auto existing = m_pages.find(key);
+        if(existing != m_pages.end())
+            ErasePage(existing);
+        auto stored = m_pages.insert(key, entry);
+        stored.value().lastUsed = ++m_useClock;
+        m_pageBytes += entry.payload.body.size();
+        if(m_pageBytes > PAGE_BYTE_BUDGET)
+            EvictPages();
+    }
+
+    PageIterator ErasePage(PageIterator page)
+    {
+        m_pageBytes -= page.value().payload.body.size();
+        return m_pages.erase(page);
+    }
+
+    //drops the least recently used pages until a quarter of the budget is free, so the sort is paid once per many stores
+    void EvictPages()
+    {
+        auto byAge = QList<QPair<quint64, PageKey>>{};
+        byAge.reserve(m_pages.size());
+        for(auto page = m_pages.cbegin(); page != m_pages.cend(); ++page)
+            byAge.append({page.value().lastUsed, page.key()});
+        std::sort(byAge.begin(), byAge.end(), [](const auto &left, const auto &right){ return left.first < right.first; });
+
+        for(const auto &[lastUsed, key]: std::as_const(byAge))
+        {
+            if(m_pageBytes <= PAGE_BYTE_BUDGET / 4 * 3)
+                break;
+            ErasePage(m_pages.find(key));
+            ++m_pageEvictions;
+        }
+    }
+
+    mutable QMutex m_mutex;
+    std::atomic<quint64> m_generation{0};
+    std::array<QHash<K, CachedPayload>, WIRE_FORMAT_COUNT> m_items;
+    QHash<PageKey, PageEntry> m_pages;
+    qint64 m_pageBytes = 0;
+    mutable quint64 m_useClock = 0;
+
+    mutable qint64 m_itemHits = 0;
+    mutable qint64 m_itemMisses = 0;
+    mutable qint64 m_pageHits = 0;
+    mutable qint64 m_pageMisses = 0;
+    mutable qint64 m_bytesReused = 0;
+    qint64 m_invalidations = 0;
+    qint64 m_pageEvictions = 0;
+    mutable std::atomic<qint64> m_notModified{0};
+    mutable std::atomic<qint64> m_bytesNotSent{0};
+    mutable std::atomic<qint64> m_compressed{0};
+    mutable std::atomic<qint64> m_bytesSavedByCompression{0};
+};
+
+#endif // RESPONSECACHE_HPP
@@ -2,9 +2,14 @@
 #define RESTAPI_HPP
 
 #include<QFuture>
-#include<QtConcurrentRun>
+#include<QReadWriteLock>
 
 #include"APIUtility.hpp"
+#include"ListQuery.hpp"
+#include"ResponseCache.hpp"
+#include"SnapshotStore.hpp"
+#include"TimerWheel.hpp"
+#include"WriteAheadLog.hpp"
 
 template<typename K = qint64, typename T = void, typename = enable_if_t<std::conjunction_v<std::is_base_of<JSONable, T>, std::is_base_of<Updatable, T>>>>
 class CRUDAPI
@@ -12,126 +17,659 @@ class CRUDAPI
 
 public:
 
+    //?delay= is for testing slow clients, a parked request still holds its in flight slot
+    static constexpr qint64 MAX_DELAY_SECONDS = 10;
+
     explicit CRUDAPI(const IdMap<K, T> &data, std::unique_ptr<FactoryFromJSON<T>> factory) :
-        m_data(data),
+        m_store(data),
         m_factory(std::move(factory))
     {}
 
-    //TODO PAGINATOR?
-    //TODO QFUTURE
-    QFuture<QHttpServerResponse> GetPaginatedDataList(const QHttpServerRequest &request) const
+    //reads take the fields the caller may see, PUBLIC_FIELDS hides the secret ones and ALL_FIELDS is for admins
+    QFuture<QHttpServerResponse> GetPaginatedDataList(const QHttpServerRequest &request, FieldMask visible = PUBLIC_FIELDS) const
     {
         using PaginatedDataType = PaginatedData<IdMap<K, T>>;
+        using CursorPaginatedDataType = CursorPaginatedData<IdMap<K, T>>;
+        const auto query = request.query();
         auto optionalPage = std::optional<qsizetype>{};
         auto optionalPerPage = std::optional<qsizetype>{};
         auto optionalDelay = std::optional<qint64>{};
+        auto optionalAfter = std::optional<K>{};
+        auto cursorMode = false;
+        auto validCursor = true;
+        auto validDelay = true;
+
+        if(query.hasQueryItem("ids"))
+            return ReadyResponse(GetItems(request, visible));
+
+        if(query.hasQueryItem("page"))
+            optionalPage = query.queryItemValue("page").toLongLong();
+        if(query.hasQueryItem("per_page"))
+            optionalPerPage = query.queryItemValue("per_page").toLongLong();
+        if(query.hasQueryItem("delay"))
+        {
+            optionalDelay = query.queryItemValue("delay").toLongLong(&validDelay);
+            validDelay = validDelay && optionalDelay.value() >= 0 && optionalDelay.value() <= MAX_DELAY_SECONDS;
+        }
+        if(query.hasQueryItem("cursor"))
+        {
+            //empty cursor asks for the first page
+            cursorMode = true;
+            const auto cursor = query.queryItemValue("cursor");
+            if(!cursor.isEmpty())
+            {
+                optionalAfter = CursorPaginatedDataType::DecodeCursor(cursor);
+                validCursor = optionalAfter.has_value();
+            }
+        }
+        else if(query.hasQueryItem("after_id"))
+        {
+            cursorMode = true;
+            optionalAfter = static_cast<K>(query.queryItemValue("after_id").toLongLong(&validCursor));
+        }
 
-        if(request.query().hasQueryItem("page"))
-            optionalPage = request.query().queryItemValue("page").toLongLong();
-        if(request.query().hasQueryItem("per_page"))
-            optionalPerPage = request.query().queryItemValue("per_page").toLongLong();
-        if(request.query().hasQueryItem("delay"))
-            optionalDelay = request.query().queryItemValue("delay").toLongLong();
+        //?fields=id,questionText writes only those fields, filters like ?category=<id>&text_prefix=<text> come from ItemFilter<T>
+        auto fields = visible;
+        auto validFields = true;
+        if(query.hasQueryItem("fields"))
+        {
+            const auto optionalFields = FieldMaskOf<T>(query.queryItemValue("fields").split(',', Qt::SkipEmptyParts));
+            validFields = optionalFields.has_value();
+            fields = optionalFields.value_or(visible) | (visible & SECRET_FIELDS);
+        }
+        auto optionalFilter = std::optional<ItemFilter<T>>{};
+        auto validFilter = true;
+        if constexpr(ItemFilter<T>::Supported)
+            validFilter = ItemFilter<T>::FromQuery(query, optionalFilter);
+
+        //per_page is capped, every page size is a cache entry of its own
+        if( (optionalPage.has_value() && optionalPage.value() < 1)
+            || (optionalPerPage.has_value() && (optionalPerPage.value() < 1 || optionalPerPage.value() > PaginatedDataType::MAX_PAGE_SIZE))
+            || (cursorMode && optionalPage.has_value()) || !validCursor || !validDelay || !validFields || !validFilter)
+        {
+            return ReadyResponse(QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest));
+        }
+
+        const auto perPage = optionalPerPage
+            ?   optionalPerPage.value() : PaginatedDataType::DEFAULT_PAGE_SIZE;
+        const auto page = optionalPage
+            ?   optionalPage.value() : PaginatedDataType::DEFAULT_PAGE;
+        const auto format = ResponseFormat(request.headers());
+        const auto generation = m_cache.Generation();
 
-        if( (optionalPage.has_value() && optionalPage.value() < 1) || (optionalPerPage.has_value() && optionalPerPage.value() < 1))
+        //filtered pages are cached like the others, only a miss scans the snapshot
+        auto filterKey = QString{};
+        if constexpr(ItemFilter<T>::Supported)
         {
-            return QtConcurrent::run
-                (
-                [](){ return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);}
-                );
+            if(optionalFilter.has_value())
+                filterKey = optionalFilter.value().Key();
         }
+        auto optionalPayload = cursorMode
+            ? m_cache.FindCursorPage(optionalAfter, perPage, fields, format, filterKey)
+            : m_cache.FindPage(page, perPage, fields, format, filterKey);
 
-        auto paginatedData = PaginatedDataType
+        if(!optionalPayload.has_value())
         {
-            m_data, optionalPage
-                ?   optionalPage.value() : PaginatedDataType::DEFAULT_PAGE,
-                    optionalPerPage
-                ?   optionalPerPage.value() : PaginatedDataType::DEFAULT_PAGE_SIZE
-        };
+            const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+            const auto snapshot = m_store.Read();
+            auto rendered = std::optional<RenderedPage>{};
+            if constexpr(ItemFilter<T>::Supported)
+            {
+                if(optionalFilter.has_value())
+                {
+                    const auto &filter = optionalFilter.value();
+                    const auto view = FilteredView<IdMap<K, T>>{*snapshot, [&filter](const T &item){ return filter.Matches(item); }};
+                    rendered = RenderPage(view, cursorMode, optionalAfter, page, perPage, fields, format);
+                }
+            }
+            if(!optionalFilter.has_value())
+                rendered = RenderPage(*snapshot, cursorMode, optionalAfter, page, perPage, fields, format);
+
+            if(rendered.has_value())
+            {
+                if(cursorMode)
+                    m_cache.StoreCursorPage(optionalAfter, perPage, fields, format, rendered.value().firstKey, rendered.value().lastKey,
+                                            rendered.value().payload, generation, filterKey);
+                else
+                    m_cache.StorePage(page, perPage, fields, format, rendered.value().firstKey, rendered.value().lastKey,
+                                      rendered.value().payload, generation, filterKey);
+                optionalPayload = rendered.value().payload;
+            }
+        }
 
-        return QtConcurrent::run
+        //delay is in seconds and only postpones the response, no thread waits for it
+        return DelayedResponse
             (
-            [paginatedData = std::move(paginatedData), optionalDelay]()
+            optionalDelay.value_or(0) * 1000,
+            [cache = &m_cache, optionalPayload = std::move(optionalPayload),
+             ifNoneMatch = GetValueFromHeader(request.headers(), "If-None-Match"),
+             acceptEncoding = GetValueFromHeader(request.headers(), "Accept-Encoding")]()
                 {
-                    if(optionalDelay.has_value())
-                        QThread::sleep(optionalDelay.value());
-                    return paginatedData.IsValid()
-                        ? QHttpServerResponse(paginatedData.ToJSON())
+                    return optionalPayload.has_value()
+                        ? cache->Respond(optionalPayload.value(), ifNoneMatch, acceptEncoding)
                         : QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
                 }
             );
     }
 
     //READ
-    QHttpServerResponse GetItem(K itemId) const
+    //only the public form of an item is cached
+    QHttpServerResponse GetItem(K itemId, const QHttpServerRequest &request, FieldMask visible = PUBLIC_FIELDS) const
     {
-        const auto item = m_data.find(itemId);
-        return item != m_data.end()
-            ? QHttpServerResponse(item.value().ToJSON())
-            : QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
+        const auto &headers = request.headers();
+        const auto format = ResponseFormat(headers);
+        const auto generation = m_cache.Generation();
+        const auto cached = visible == PUBLIC_FIELDS;
+        auto optionalPayload = cached ? m_cache.FindItem(itemId, format) : std::optional<CachedPayload>{};
+        if(!optionalPayload.has_value())
+        {
+            const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+            const auto snapshot = m_store.Read();
+            const auto item = snapshot->constFind(itemId);
+            if(item == snapshot->constEnd())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
+
+            optionalPayload = CachedPayload::FromValue(ProjectedItem<T>{item.value(), visible}, format);
+            if(cached)
+                m_cache.StoreItem(itemId, format, optionalPayload.value(), generation);
+        }
+
+        return m_cache.Respond(optionalPayload.value(), GetValueFromHeader(headers, "If-None-Match"), GetValueFromHeader(headers, "Accept-Encoding"));
+    }
 
+    //mutations are logged in stage order and published once durable, the log has to be recovered before it is attached
+    void AttachLog(std::shared_ptr<WriteAheadLog> log)
+    {
+        m_log = std::move(log);
+    }
+
+    //response is released once every mutation logged so far is on disk and published
+    //a failed log answers 503, a mutation it could not make durable 500 and is never published
+    QFuture<QHttpServerResponse> Commit(QHttpServerResponse &&response)
+    {
+        if(!m_log)
+            return ReadyResponse(std::move(response));
+        if(m_log->Failed())
+            return ReadyResponse(QHttpServerResponse(QHttpServerResponder::StatusCode::ServiceUnavailable));
+
+        if(m_log->CompactionDue())
+            CompactLog();
+
+        auto promise = std::make_shared<QPromise<QHttpServerResponse>>();
+        auto future = promise->future();
+        promise->start();
+        auto pending = std::make_shared<QHttpServerResponse>(std::move(response));
+        m_log->WhenDurable
+            (
+                m_log->LastSequence(),
+                [promise, pending](bool durable)
+                {
+                    promise->addResult(durable ? std::move(*pending) : QHttpServerResponse(QHttpServerResponder::StatusCode::InternalServerError));
+                    promise->finish();
+                }
+            );
+        return future;
+    }
+
+    //before is null for a creation, after is null for a deletion
+    //listeners run under the store's write lock, in mutation order, once the mutation is published, and must be quick
+    using ChangeListener = std::function<void(const K &, const T *, const T *)>;
+
+    //published items are replayed as creations before any later mutation is seen
+    void AddChangeListener(ChangeListener listener)
+    {
+        m_store.ExclusivePublished([this, &listener](const IdMap<K, T> &data)
+        {
+            for(auto item = data.constBegin(); item != data.constEnd(); ++item)
+                listener(item.key(), nullptr, &item.value());
+            m_listeners.append(std::move(listener));
+            return true;
+        });
+    }
+
+    //serialized items in the order of ids, missing ids are skipped
+    QJsonArray ItemsToJSON(const QList<K> &ids, FieldMask visible = PUBLIC_FIELDS) const
+    {
+        const auto snapshot = m_store.Read();
+        auto array = QJsonArray{};
+        for(const auto &id: ids)
+        {
+            const auto item = snapshot->constFind(id);
+            if(item != snapshot->constEnd())
+                array.append(ProjectedToJSON(item.value(), visible));
+        }
+        return array;
+    }
+
+    CacheStats GetCacheStats() const
+    {
+        return m_cache.Stats();
+    }
+
+    //for changes outside the store that show up in every item, like a renamed category of the questions
+    void InvalidateCache()
+    {
+        m_cache.InvalidateAll();
     }
 
     //CREATE
     QHttpServerResponse PostItem(const QHttpServerRequest &request)
     {
-        const auto optionalJson = ByteArrayToJSONObject(request.body());
+        const auto &headers = request.headers();
+        return PostItem(request.body(), BodyFormat(headers), ResponseFormat(headers));
+    }
+
+    QHttpServerResponse PostItem(const QByteArray &body, WireFormat bodyFormat = WireFormat::JSON, WireFormat responseFormat = WireFormat::JSON)
+    {
+        if(!Writable())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::ServiceUnavailable);
+
+        const auto optionalJson = BodyToJSONObject<T>(body, bodyFormat);
         if(!optionalJson.has_value())
             return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
 
+        const auto refusals = InternedFields<T>::Refusals();
         const auto optionalItem = m_factory->FromJSON(optionalJson.value());
         if(!optionalItem.has_value())
-            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
-
-        if(m_data.contains(optionalItem.value().id))
-            return QHttpServerResponse(QHttpServerResponder::StatusCode::AlreadyReported);
-
-        const auto entry = m_data.insert(optionalItem.value().id, optionalItem.value());
-        return QHttpServerResponse(entry.value().ToJSON(), QHttpServerResponder::StatusCode::Created);
+            return QHttpServerResponse(RefusalStatus(refusals));
+
+        const auto &newItem = optionalItem.value();
+        auto json = QJsonObject{};
+        const auto status = Mutate([this, &newItem, &json](IdMap<K, T> &data) {return CreateIn(data, newItem, json);});
+        if(status != QHttpServerResponder::StatusCode::Created)
+            return QHttpServerResponse(status);
+        return FormattedResponse(json, responseFormat, status);
     }
 
     //UPDATE
     QHttpServerResponse PutItem(K itemId, const QHttpServerRequest &request)
     {
-        const auto optionalJson = ByteArrayToJSONObject(request.body());
-        if(!optionalJson.has_value())
-            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+        return UpdateItem(itemId, request, false);
+    }
+
+    QHttpServerResponse PutItemFields(K itemId, const QHttpServerRequest &request)
+    {
+        return UpdateItem(itemId, request, true);
+    }
+
+    //DELETE
+    QHttpServerResponse DeleteItem(K itemId)
+    {
+        if(!Writable())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::ServiceUnavailable);
 
-        auto item = m_data.find(itemId);
-        if(item == m_data.end())
+        const auto removed = Mutate([this, itemId](IdMap<K, T> &data) {return RemoveIn(data, itemId);});
+        if(!removed)
             return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
-        if(!item.value().Update(optionalJson.value()))
+        return QHttpServerResponse(QHttpServerResponder::StatusCode::Ok);
+    }
+
+    static constexpr qsizetype MAX_BATCH_SIZE = 10000;
+
+    //?ids=1,2,3, items come back in the order asked for, null where an id does not exist
+    QHttpServerResponse GetItems(const QHttpServerRequest &request, FieldMask visible = PUBLIC_FIELDS) const
+    {
+        const auto idList = request.query().queryItemValue("ids").split(',', Qt::SkipEmptyParts);
+        if(idList.isEmpty() || idList.size() > MAX_BATCH_SIZE)
             return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
 
-        return QHttpServerResponse(item.value().ToJSON());
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+        const auto snapshot = m_store.Read();
+        auto data = QJsonArray{};
+        for(const auto &idText: idList)
+        {
+            auto valid = false;
+            const auto itemId = static_cast<K>(idText.toLongLong(&valid));
+            if(!valid)
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+            const auto item = snapshot->constFind(itemId);
+            data.append(item == snapshot->constEnd() ? QJsonValue{} : QJsonValue{ProjectedToJSON(item.value(), visible)});
+        }
+
+        return FormattedResponse(QJsonObject{{"data", data}}, ResponseFormat(request.headers()));
     }
 
-    QHttpServerResponse PutItemFields(K itemId, const QHttpServerRequest &request)
+    //BATCH body [{"op": "create", "item": {..}}, {"op": "update" | "patch", "id": <id>, "item": {..}}, {"op": "delete", "id": <id>}]
+    //all operations land in one published snapshot, the answer is one status and id per operation
+    QHttpServerResponse BatchItems(const QHttpServerRequest &request)
+    {
+        const auto &headers = request.headers();
+        return BatchItems(request.body(), BodyFormat(headers), ResponseFormat(headers));
+    }
+
+    QHttpServerResponse BatchItems(const QByteArray &body, WireFormat bodyFormat = WireFormat::JSON, WireFormat responseFormat = WireFormat::JSON)
+    {
+        if(!Writable())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::ServiceUnavailable);
+
+        const auto optionalArray = BodyToJSONArray(body, bodyFormat);
+        if(!optionalArray.has_value())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+        if(optionalArray.value().size() > MAX_BATCH_SIZE)
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::PayloadTooLarge);
+
+        //bodies are parsed and built before the write lock is taken
+        auto operations = QList<BatchOperation>{};
+        operations.reserve(optionalArray.value().size());
+        for(const auto &value: optionalArray.value())
+            operations.append(ParseOperation(value.toObject()));
+
+        auto statuses = QJsonArray{};
+        auto ids = QJsonArray{};
+        Mutate([this, &operations, &statuses, &ids](IdMap<K, T> &data)
+        {
+            auto json = QJsonObject{};
+            for(const auto &operation: operations)
+            {
+                auto status = operation.status;
+                switch(operation.kind)
+                {
+                case BatchOperation::Kind::Create:
+                    status = CreateIn(data, operation.item.value(), json);
+                    break;
+                case BatchOperation::Kind::Update:
+                case BatchOperation::Kind::Patch:
+                    status = UpdateIn(data, operation.id, operation.body, operation.kind == BatchOperation::Kind::Patch, json);
+                    break;
+                case BatchOperation::Kind::Delete:
+                    status = RemoveIn(data, operation.id) ? QHttpServerResponder::StatusCode::Ok : QHttpServerResponder::StatusCode::NoContent;
+                    break;
+                case BatchOperation::Kind::Invalid:
+                    break;
+                }
+
+                statuses.append(int(status));
+                ids.append(operation.kind == BatchOperation::Kind::Invalid ? QJsonValue{} : QJsonValue{qint64(operation.id)});
+            }
+            return true;
+        });
+
+        return FormattedResponse(QJsonObject{{"status", statuses}, {"ids", ids}}, responseFormat);
+    }
+
+private:
+
+    struct RenderedPage
+    {
+        CachedPayload payload;
+        K firstKey;
+        K lastKey;
+    };
+
+    //one page of the snapshot or of a filtered view of it, nullopt when the page is out of range
+    template<typename Container>
+    static std::optional<RenderedPage> RenderPage(const Container &container, bool cursorMode, const std::optional<K> &after,
+                                                  qsizetype page, qsizetype perPage, FieldMask fields, WireFormat format)
+    {
+        if(cursorMode)
+        {
+            const auto paginatedData = CursorPaginatedData<Container>{container, after, perPage, fields};
+            if(!paginatedData.IsValid())
+                return std::nullopt;
+            return RenderedPage{CachedPayload::FromValue(paginatedData, format), paginatedData.FirstKey(), paginatedData.LastKey()};
+        }
+
+        const auto paginatedData = PaginatedData<Container>{container, page, perPage, fields};
+        if(!paginatedData.IsValid())
+            return std::nullopt;
+        return RenderedPage{CachedPayload::FromValue(paginatedData, format), paginatedData.FirstKey(), paginatedData.LastKey()};
+    }
+
+    struct BatchOperation
     {
-        const auto optionalJson = ByteArrayToJSONObject(request.body());
+        enum class Kind
+        {
+            Create,
+            Update,
+            Patch,
+            Delete,
+            Invalid
+        };
+
+        Kind kind;
+        K id;
+        QJsonObject body;
+        std::optional<T> item;
+        QHttpServerResponder::StatusCode status;
+    };
+
+    BatchOperation ParseOperation(const QJsonObject &json) const
+    {
+        const auto invalid = BatchOperation{BatchOperation::Kind::Invalid, K{}, {}, std::nullopt, QHttpServerResponder::StatusCode::BadRequest};
+        const auto op = json.value("op").toString();
+        const auto body = json.value("item").toObject();
+        if(op == "create")
+        {
+            const auto refusals = InternedFields<T>::Refusals();
+            auto item = m_factory->FromJSON(body);
+            if(!item.has_value())
+                return BatchOperation{BatchOperation::Kind::Invalid, K{}, {}, std::nullopt, RefusalStatus(refusals)};
+            const auto itemId = item.value().id;
+            return BatchOperation{BatchOperation::Kind::Create, itemId, {}, std::move(item), QHttpServerResponder::StatusCode::Created};
+        }
+
+        if(!json.value("id").isDouble())
+            return invalid;
+        const auto itemId = static_cast<K>(json.value("id").toInteger());
+        if(op == "update" || op == "patch")
+        {
+            const auto kind = op == "update" ? BatchOperation::Kind::Update : BatchOperation::Kind::Patch;
+            return BatchOperation{kind, itemId, body, std::nullopt, QHttpServerResponder::StatusCode::Ok};
+        }
+        if(op == "delete")
+            return BatchOperation{BatchOperation::Kind::Delete, itemId, {}, std::nullopt, QHttpServerResponder::StatusCode::Ok};
+        return invalid;
+    }
+
+    QHttpServerResponse UpdateItem(K itemId, const QHttpServerRequest &request, bool fieldsOnly)
+    {
+        if(!Writable())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::ServiceUnavailable);
+
+        const auto &headers = request.headers();
+        const auto optionalJson = BodyToJSONObject<T>(request.body(), BodyFormat(headers));
         if(!optionalJson.has_value())
             return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
 
-        auto item = m_data.find(itemId);
-        if(item == m_data.end())
-            return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
-        item.value().UpdateFields(optionalJson.value());
+        auto json = QJsonObject{};
+        const auto status = Mutate([this, itemId, &optionalJson, fieldsOnly, &json](IdMap<K, T> &data)
+        {
+            return UpdateIn(data, itemId, optionalJson.value(), fieldsOnly, json);
+        });
+        if(status != QHttpServerResponder::StatusCode::Ok)
+            return QHttpServerResponse(status);
+        return FormattedResponse(json, ResponseFormat(headers));
+    }
+
+    //mutation cores shared by the single item and the batch routes, they run inside Mutate
+    QHttpServerResponder::StatusCode CreateIn(IdMap<K, T> &data, const T &newItem, QJsonObject &json)
+    {
+        if(std::as_const(data).contains(newItem.id))
+            return QHttpServerResponder::StatusCode::AlreadyReported;
 
-        return QHttpServerResponse(item.value().ToJSON());
+        const auto &created = data.insert(newItem.id, newItem).value();
+        json = created.ToJSON();
+        Record("post", newItem.id, nullptr, &created, json);
+        return QHttpServerResponder::StatusCode::Created;
     }
 
-    //DELETE
-    QHttpServerResponse DeleteItem(K itemId)
+    QHttpServerResponder::StatusCode UpdateIn(IdMap<K, T> &data, K itemId, const QJsonObject &body, bool fieldsOnly, QJsonObject &json)
     {
-        if(!m_data.remove(itemId))
-            return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
-        return QHttpServerResponse(QHttpServerResponder::StatusCode::Ok);
+        const auto item = std::as_const(data).constFind(itemId);
+        if(item == data.constEnd())
+            return QHttpServerResponder::StatusCode::NoContent;
+
+        //updated on a copy so a rejected body leaves the published item untouched
+        //a patch skips fields it cannot take, but not the ones a full pool refused
+        const auto before = item.value();
+        auto updated = before;
+        const auto refusals = InternedFields<T>::Refusals();
+        if(fieldsOnly)
+            updated.UpdateFields(body);
+        else if(!updated.Update(body))
+            return RefusalStatus(refusals);
+        if(InternedFields<T>::Refusals() != refusals)
+            return QHttpServerResponder::StatusCode::InsufficientStorage;
+
+        const auto &after = data.insert(itemId, updated).value();
+        json = after.ToJSON();
+        Record(fieldsOnly ? "patch" : "put", itemId, &before, &after, json);
+        return QHttpServerResponder::StatusCode::Ok;
     }
 
-private:
+    bool RemoveIn(IdMap<K, T> &data, K itemId)
+    {
+        //checked first so a miss does not detach the shared map
+        const auto item = std::as_const(data).constFind(itemId);
+        if(item == data.constEnd())
+            return false;
+
+        const auto before = item.value();
+        data.remove(itemId);
+        Record("delete", itemId, &before, nullptr);
+        return true;
+    }
+
+    //a body that could not be read is the client's fault, unless a pool of interned values was full
+    static QHttpServerResponder::StatusCode RefusalStatus(quint64 refusalsBefore)
+    {
+        return InternedFields<T>::Refusals() != refusalsBefore
+            ? QHttpServerResponder::StatusCode::InsufficientStorage
+            : QHttpServerResponder::StatusCode::BadRequest;
+    }
+
+    //nothing is mutated while the attached log cannot make it durable
+    bool Writable() const
+    {
+        return !m_log || !m_log->Failed();
+    }
+
+    //a mutation waiting for its version to be published, before is empty for a creation and after for a deletion
+    struct Change
+    {
+        K id;
+        std::optional<T> before;
+        std::optional<T> after;
+        quint64 sequence;
+    };
+
+    //with a log the new version is staged and published only once its records are durable, so readers,
+    //listeners and the cache never see a mutation that could still be lost, a failed log discards it
+    //without one it is published at once
+    template<typename Function>
+    auto Mutate(Function &&mutation)
+    {
+        if(!m_log)
+        {
+            auto changes = QList<Change>{};
+            auto result = m_store.Write([this, &mutation, &changes](IdMap<K, T> &data)
+            {
+                auto mutated = mutation(data);
+                changes.swap(m_changes);
+                Notify(changes);
+                return mutated;
+            });
+            Invalidate(changes);
+            return result;
+        }
+
+        auto tag = quint64{0};
+        auto result = m_store.Stage(std::forward<Function>(mutation), [this, &tag](){ return tag = m_log->LastSequence(); });
+        //queued ahead of the waiter Commit adds, so the version is published before the response is released
+        m_log->WhenDurable(tag, [this, tag](bool durable)
+        {
+            if(durable)
+                Publish(tag);
+            else
+                Discard(tag);
+        });
+        return result;
+    }
+
+    void Publish(quint64 tag)
+    {
+        auto changes = QList<Change>{};
+        m_store.Publish(tag, [this, &changes](quint64 published)
+        {
+            auto count = qsizetype{0};
+            while(count < m_changes.size() && m_changes.at(count).sequence <= published)
+                ++count;
+            changes = m_changes.first(count);
+            m_changes.remove(0, count);
+            Notify(changes);
+        });
+        Invalidate(changes);
+    }
+
+    //the changes of the discarded versions are all logged after the newest version kept
+    void Discard(quint64 tag)
+    {
+        m_store.Discard(tag, [this](quint64 kept)
+        {
+            m_changes.removeIf([kept](const Change &change){ return change.sequence > kept; });
+        });
+    }
+
+    //runs inside the mutation, the change waits in m_changes until its version is published
+    void Record(const QString &op, K itemId, const T *before, const T *after, const QJsonObject &item = QJsonObject{})
+    {
+        const auto sequence = m_log ? m_log->Append(op, itemId, item) : quint64{0};
+        m_changes.append(Change{itemId, before ? std::optional<T>(*before) : std::nullopt, after ? std::optional<T>(*after) : std::nullopt, sequence});
+    }
+
+    void Notify(const QList<Change> &changes)
+    {
+        for(const auto &change: changes)
+        {
+            const auto *before = change.before.has_value() ? &change.before.value() : nullptr;
+            const auto *after = change.after.has_value() ? &change.after.value() : nullptr;
+            for(const auto &listener: m_listeners)
+                listener(change.id, before, after);
+        }
+    }
+
+    //follows the publish, an update only stales the pages holding the item, a creation or deletion shifts them all
+    void Invalidate(const QList<Change> &changes)
+    {
+        for(const auto &change: changes)
+        {
+            if(change.before.has_value() && change.after.has_value())
+                m_cache.InvalidateItem(change.id);
+            else
+                m_cache.InvalidateMembership(change.id);
+        }
+    }
 
-    IdMap<K, T> m_data;
+    void CompactLog()
+    {
+        m_store.Exclusive([this](const IdMap<K, T> &data)
+        {
+            //the copy shares the map, serialization happens on the log's writer thread
+            m_log->Compact([data]()
+            {
+                if constexpr(BinaryCodec<T>::Supported)
+                    return SerializeBinarySnapshot(data);
+                else
+                {
+                    auto array = QJsonArray{};
+                    for(const auto &item: data)
+                        array.append(item.ToJSON());
+                    return QJsonDocument(array).toJson(QJsonDocument::Compact);
+                }
+            });
+            return true;
+        });
+    }
+
+    //cache invalidation always follows the publish of the new snapshot
+    SnapshotStore<K, T> m_store;
     std::unique_ptr<FactoryFromJSON<T>> m_factory;
+    mutable ResponseCache<K> m_cache;
+    QList<ChangeListener> m_listeners;
+    QList<Change> m_changes; //under the store's write lock
+    //last, so a log owned here stops its writer and runs the pending callbacks while the rest is still alive
+    std::shared_ptr<WriteAheadLog> m_log;
 };
 
 template<typename K = qint64>
@@ -142,35 +680,105 @@ public:
     explicit SessionAPI(const IdMap<K, SessionEntry> &sessions, std::unique_ptr<FactoryFromJSON<SessionEntry>> factory) :
         m_sessions(sessions),
         m_factory(std::move(factory))
-    {}
+    {
+        for(const auto &session: m_sessions)
+            IndexToken(session);
+    }
 
+    //what a token stands for
+    struct Session
+    {
+        K id;
+        bool admin;
+    };
+
+    //player sessions, whatever the body says they never get the admin role
     QHttpServerResponse RegisterSession(const QHttpServerRequest &request)
     {
-        const auto optionalJson = ByteArrayToJSONObject(request.body());
+        const auto &headers = request.headers();
+        const auto optionalJson = BodyToJSONObject<SessionEntry>(request.body(), BodyFormat(headers));
         if(!optionalJson.has_value())
             return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
         const auto optionalItem = m_factory->FromJSON(optionalJson.value());
         if(!optionalItem.has_value())
             return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
 
+        //sessions are registered from every server loop while others look tokens up
+        auto locker = QWriteLocker(&m_lock);
         const auto session = m_sessions.insert(optionalItem.value().id, optionalItem.value());
         session.value().StartSession();
-        return QHttpServerResponse(session.value().ToJSON());
+        IndexToken(session.value());
+        return FormattedResponse(session.value().ToJSON(), ResponseFormat(headers));
     }
 
-    bool Authorize(const QHttpServerRequest &request) const
+    //admin sessions only come from the operator, token is generated when none is given
+    QUuid RegisterAdminSession(std::optional<QUuid> token = std::nullopt)
     {
-        const auto optionalToken = GetTokenFromRequest(request);
+        auto entry = SessionEntry();
+        entry.admin = true;
+        entry.StartSession();
+        if(token.has_value())
+            entry.token = token;
+
+        auto locker = QWriteLocker(&m_lock);
+        const auto session = m_sessions.insert(entry.id, entry);
+        IndexToken(session.value());
+        return session.value().token.value();
+    }
+
+    //token is parsed once per request, lookup is a single hash probe
+    std::optional<Session> FindSession(const QHttpServerRequest &request) const
+    {
+        return FindSession(request.headers());
+    }
+
+    std::optional<Session> FindSession(const QList<QPair<QByteArray, QByteArray>> &headers) const
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Auth);
+        const auto optionalToken = GetTokenUuidFromHeaders(headers);
         if(!optionalToken.has_value())
-            return false;
+            return std::nullopt;
+
+        auto locker = QReadLocker(&m_lock);
+        const auto session = m_tokenIndex.constFind(optionalToken.value());
+        if(session == m_tokenIndex.constEnd())
+            return std::nullopt;
+
+        return session.value();
+    }
+
+    std::optional<K> FindSessionId(const QHttpServerRequest &request) const
+    {
+        return FindSessionId(request.headers());
+    }
+
+    std::optional<K> FindSessionId(const QList<QPair<QByteArray, QByteArray>> &headers) const
+    {
+        const auto session = FindSession(headers);
+        return session.has_value() ? std::optional<K>(session.value().id) : std::nullopt;
+    }
+
+    bool Authorize(const QHttpServerRequest &request) const
+    {
+        return FindSessionId(request).has_value();
+    }
 
-        const auto optionalSession = std::find(m_sessions.begin(), m_sessions.end(), optionalToken.value());
-        return optionalSession != m_sessions.end() && optionalSession.value() == optionalToken.value();
+    bool Authorize(const QList<QPair<QByteArray, QByteArray>> &headers) const
+    {
+        return FindSessionId(headers).has_value();
     }
 
 private:
 
+    void IndexToken(const SessionEntry &session)
+    {
+        if(session.token.has_value())
+            m_tokenIndex.insert(session.token.value(), Session{session.id, session.admin});
+    }
+
+    mutable QReadWriteLock m_lock;
     IdMap<K, SessionEntry> m_sessions;
+    QHash<QUuid, Session> m_tokenIndex;
     std::unique_ptr<FactoryFromJSON<SessionEntry>> m_factory;
 };
 
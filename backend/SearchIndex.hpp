@@ -0,0 +1,634 @@
+#ifndef SEARCHINDEX_HPP
+#define SEARCHINDEX_HPP
+
+#include<QMap>
+#include<QReadWriteLock>
+#include<QVarLengthArray>
+#include<algorithm>
+#include<array>
+#include<limits>
+#include<vector>
+
+#include"RestAPI.hpp"
+
+//ids of the documents holding one term, ascending, as varint deltas in blocks
+//the first and last id of every block sit in the block table, so cursors skip blocks without decoding them
+//an edit re-encodes only its block, blocks split once they outgrow MAX_BLOCK
+class PostingList
+{
+    struct Block
+    {
+        qint64 first;
+        qint64 last;
+        qsizetype offset;
+        qsizetype count;
+    };
+
+public:
+
+    static constexpr qsizetype BLOCK_SIZE = 128;
+    static constexpr qsizetype MAX_BLOCK = 2 * BLOCK_SIZE;
+
+    class Cursor
+    {
+    public:
+
+        explicit Cursor(const PostingList &list) :
+            m_list(&list)
+        {
+            Load(0);
+        }
+
+        bool AtEnd() const
+        {
+            return m_block >= m_list->m_blocks.size();
+        }
+
+        qint64 Id() const
+        {
+            return m_ids[m_index];
+        }
+
+        void Next()
+        {
+            if(++m_index == m_count)
+                Load(m_block + 1);
+        }
+
+        //moves to the first id not below target
+        void SkipTo(qint64 target)
+        {
+            if(AtEnd() || Id() >= target)
+                return;
+
+            const auto &blocks = m_list->m_blocks;
+            if(blocks[m_block].last < target)
+            {
+                const auto block = std::partition_point(blocks.cbegin() + m_block + 1, blocks.cend(),
+                                                        [target](const Block &block){ return block.last < target; });
+                Load(block - blocks.cbegin());
+                if(AtEnd())
+                    return;
+            }
+            m_index = std::lower_bound(m_ids.cbegin() + m_index, m_ids.cbegin() + m_count, target) - m_ids.cbegin();
+        }
+
+        //0-based position in the whole list
+        void Seek(qsizetype position)
+        {
+            const auto &blocks = m_list->m_blocks;
+            auto block = qsizetype{0};
+            for(; block < blocks.size() && position >= blocks[block].count; ++block)
+                position -= blocks[block].count;
+            Load(block);
+            if(!AtEnd())
+                m_index = position;
+        }
+
+    private:
+
+        void Load(qsizetype block)
+        {
+            m_block = block;
+            m_index = 0;
+            m_count = AtEnd() ? 0 : m_list->Decode(block, m_ids.data());
+        }
+
+        const PostingList *m_list;
+        qsizetype m_block = 0;
+        qsizetype m_index = 0;
+        qsizetype m_count = 0;
+        std::array<qint64, MAX_BLOCK> m_ids;
+    };
+
+    qsizetype size() const
+    {
+        return m_size;
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    //encoded bytes plus the block table
+    qsizetype ByteSize() const
+    {
+        return m_bytes.size() + m_blocks.size() * qsizetype(sizeof(Block));
+    }
+
+    //new ids are usually the highest so far, those only append a delta
+    bool Insert(qint64 id)
+    {
+        if(m_blocks.isEmpty() || id > m_blocks.last().last)
+        {
+            if(m_blocks.isEmpty() || m_blocks.last().count >= BLOCK_SIZE)
+                m_blocks.append(Block{id, id, m_bytes.size(), 1});
+            else
+            {
+                auto &block = m_blocks.last();
+                AppendVarint(m_bytes, quint64(id) - quint64(block.last));
+                block.last = id;
+                ++block.count;
+            }
+            ++m_size;
+            return true;
+        }
+
+        const auto block = BlockOf(id);
+        auto ids = QVarLengthArray<qint64, MAX_BLOCK + 1>(m_blocks[block].count);
+        Decode(block, ids.data());
+        const auto position = std::lower_bound(ids.begin(), ids.end(), id);
+        if(position != ids.end() && *position == id)
+            return false;
+
+        ids.insert(position, id);
+        Replace(block, ids.constData(), ids.size());
+        ++m_size;
+        return true;
+    }
+
+    bool Remove(qint64 id)
+    {
+        if(m_blocks.isEmpty() || id < m_blocks.first().first || id > m_blocks.last().last)
+            return false;
+
+        const auto block = BlockOf(id);
+        if(id > m_blocks[block].last)
+            return false;
+
+        auto ids = QVarLengthArray<qint64, MAX_BLOCK + 1>(m_blocks[block].count);
+        Decode(block, ids.data());
+        const auto position = std::lower_bound(ids.begin(), ids.end(), id);
+        if(position == ids.end() || *position != id)
+            return false;
+
+        ids.erase(position);
+        Replace(block, ids.constData(), ids.size());
+        --m_size;
+        return true;
+    }
+
+    void AppendTo(QList<qint64> &ids) const
+    {
+        for(auto cursor = Cursor(*this); !cursor.AtEnd(); cursor.Next())
+            ids.append(cursor.Id());
+    }
+
+private:
+
+    static void AppendVarint(QByteArray &bytes, quint64 value)
+    {
+        while(value >= 0x80)
+        {
+            bytes.append(char(value | 0x80));
+            value >>= 7;
+        }
+        bytes.append(char(value));
+    }
+
+    static quint64 ReadVarint(const char *&from)
+    {
+        auto value = quint64{0};
+        for(auto shift = 0;; shift += 7)
+        {
+            const auto byte = quint8(*from++);
+            value |= quint64(byte & 0x7f) << shift;
+            if(byte < 0x80)
+                return value;
+        }
+    }
+
+    //last block starting at or below id, the first block for lower ids
+    qsizetype BlockOf(qint64 id) const
+    {
+        const auto block = std::upper_bound(m_blocks.cbegin(), m_blocks.cend(), id,
+                                            [](qint64 id, const Block &block){ return id < block.first; });
+        return qMax(qsizetype{0}, qsizetype(block - m_blocks.cbegin()) - 1);
+    }
+
+    qsizetype Decode(qsizetype block, qint64 *ids) const
+    {
+        const auto &entry = m_blocks[block];
+        const auto *from = m_bytes.constData() + entry.offset;
+        auto id = entry.first;
+        ids[0] = id;
+        for(qsizetype i = 1; i < entry.count; ++i)
+        {
+            id = qint64(quint64(id) + ReadVarint(from));
+            ids[i] = id;
+        }
+        return entry.count;
+    }
+
+    //re-encodes one block from ids, an empty block is dropped and an overfull one split in two
+    void Replace(qsizetype block, const qint64 *ids, qsizetype count)
+    {
+        const auto begin = m_blocks[block].offset;
+        const auto end = block + 1 < m_blocks.size() ? m_blocks[block + 1].offset : m_bytes.size();
+
+        auto bytes = QByteArray{};
+        auto entries = QVarLengthArray<Block, 2>{};
+        const auto chunk = count > MAX_BLOCK ? (count + 1) / 2 : count;
+        for(qsizetype start = 0; start < count; start += chunk)
+        {
+            const auto size = qMin(chunk, count - start);
+            entries.append(Block{ids[start], ids[start + size - 1], begin + bytes.size(), size});
+            for(auto i = start + 1; i < start + size; ++i)
+                AppendVarint(bytes, quint64(ids[i]) - quint64(ids[i - 1]));
+        }
+
+        m_bytes.replace(begin, end - begin, bytes);
+        const auto shift = bytes.size() - (end - begin);
+        for(auto i = block + 1; i < m_blocks.size(); ++i)
+            m_blocks[i].offset += shift;
+
+        m_blocks.remove(block);
+        for(qsizetype i = 0; i < entries.size(); ++i)
+            m_blocks.insert(block + i, entries[i]);
+    }
+
+    QByteArray m_bytes;
+    QList<Block> m_blocks;
+    qsizetype m_size = 0;
+};
+
+//the searchable text of an item, types without a specialization are not indexed
+template<typename T>
+struct SearchText
+{
+    static constexpr bool Supported = false;
+};
+
+template<>
+struct SearchText<Question>
+{
+    static constexpr bool Supported = true;
+
+    static const QString &Of(const Question &question)
+    {
+        return question.questionText;
+    }
+};
+
+template<>
+struct SearchText<Category>
+{
+    static constexpr bool Supported = true;
+
+    static const QString &Of(const Category &category)
+    {
+        return category.categoryText;
+    }
+};
+
+//inverted index from case folded words to the ids of the texts holding them
+//terms are kept sorted, so a prefix is one contiguous run of the dictionary
+class TextIndex
+{
+public:
+
+    //shorter prefixes expand to most of the dictionary, every request would merge all of it
+    static constexpr qsizetype MIN_PREFIX_LENGTH = 3;
+
+    struct Result
+    {
+        QList<qint64> ids;
+        qsizetype total = 0;
+    };
+
+    //runs of letters and digits, case folded, visit gets every token and the position right after it
+    template<typename Visit>
+    static void ForEachToken(QStringView text, Visit &&visit)
+    {
+        auto token = QString{};
+        for(qsizetype i = 0; i < text.size();)
+        {
+            auto codePoint = char32_t(text[i].unicode());
+            auto width = qsizetype{1};
+            if(text[i].isHighSurrogate() && i + 1 < text.size() && text[i + 1].isLowSurrogate())
+            {
+                codePoint = QChar::surrogateToUcs4(text[i], text[i + 1]);
+                width = 2;
+            }
+
+            if(QChar::isLetterOrNumber(codePoint))
+            {
+                const auto folded = QChar::toCaseFolded(codePoint);
+                if(QChar::requiresSurrogates(folded))
+                {
+                    token.append(QChar(QChar::highSurrogate(folded)));
+                    token.append(QChar(QChar::lowSurrogate(folded)));
+                }
+                else
+                    token.append(QChar(char16_t(folded)));
+            }
+            else if(!token.isEmpty())
+            {
+                visit(token, i);
+                token.clear();
+            }
+            i += width;
+        }
+        if(!token.isEmpty())
+            visit(token, text.size());
+    }
+
+    //distinct tokens, sorted
+    static QList<QString> Tokens(QStringView text)
+    {
+        auto tokens = QList<QString>{};
+        ForEachToken(text, [&tokens](const QString &token, qsizetype){ tokens.append(token); });
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+        return tokens;
+    }
+
+    //before is null for a creation, after is null for a deletion, only the changed words are touched
+    void Apply(qint64 id, const QString *before, const QString *after)
+    {
+        if(before && after && *before == *after)
+            return;
+
+        const auto removed = before ? Tokens(*before) : QList<QString>{};
+        const auto added = after ? Tokens(*after) : QList<QString>{};
+        auto locker = QWriteLocker(&m_lock);
+        auto from = removed.cbegin();
+        auto to = added.cbegin();
+        while(from != removed.cend() || to != added.cend())
+        {
+            if(to == added.cend() || (from != removed.cend() && *from < *to))
+                RemovePosting(*from++, id);
+            else if(from == removed.cend() || *to < *from)
+                m_terms[*to++].Insert(id);
+            else
+            {
+                ++from;
+                ++to;
+            }
+        }
+    }
+
+    //every word of query has to match, a word directly followed by * matches every term it prefixes
+    //ids come in ascending order, offset and limit cut the page out of all matches
+    //nullopt for a query without words or with a prefix shorter than MIN_PREFIX_LENGTH
+    std::optional<Result> Search(QStringView query, qsizetype offset, qsizetype limit) const
+    {
+        auto words = QList<QString>{};
+        auto prefixes = QList<QString>{};
+        ForEachToken(query, [query, &words, &prefixes](const QString &token, qsizetype end)
+        {
+            if(end < query.size() && query[end] == u'*')
+                prefixes.append(token);
+            else
+                words.append(token);
+        });
+        if(words.isEmpty() && prefixes.isEmpty())
+            return std::nullopt;
+        for(const auto &prefix: prefixes)
+        {
+            if(prefix.size() < MIN_PREFIX_LENGTH)
+                return std::nullopt;
+        }
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+
+        auto locker = QReadLocker(&m_lock);
+        auto result = Result{};
+        auto cursors = std::vector<TermCursor>{};
+        cursors.reserve(words.size() + prefixes.size());
+        for(const auto &word: words)
+        {
+            const auto term = m_terms.constFind(word);
+            if(term == m_terms.constEnd())
+                return result;
+            cursors.emplace_back(term.value());
+        }
+
+        //a single exact word knows its count, the page is found through the block table
+        if(prefixes.isEmpty() && words.size() == 1)
+        {
+            const auto &postings = m_terms.constFind(words.first()).value();
+            result.total = postings.size();
+            auto cursor = PostingList::Cursor(postings);
+            cursor.Seek(offset);
+            for(; !cursor.AtEnd() && result.ids.size() < limit; cursor.Next())
+                result.ids.append(cursor.Id());
+            return result;
+        }
+
+        for(const auto &prefix: prefixes)
+        {
+            auto terms = QVarLengthArray<const PostingList *, 8>{};
+            for(auto term = m_terms.lowerBound(prefix); term != m_terms.constEnd() && term.key().startsWith(prefix); ++term)
+                terms.append(&term.value());
+            if(terms.isEmpty())
+                return result;
+
+            if(terms.size() == 1)
+                cursors.emplace_back(*terms.first());
+            else
+            {
+                auto ids = QList<qint64>{};
+                for(const auto *postings: terms)
+                    postings->AppendTo(ids);
+                std::sort(ids.begin(), ids.end());
+                ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+                cursors.emplace_back(std::move(ids));
+            }
+        }
+
+        //leapfrog join led by the rarest term, the others only skip forward
+        std::sort(cursors.begin(), cursors.end(), [](const TermCursor &left, const TermCursor &right){ return left.Size() < right.Size(); });
+        auto &lead = cursors.front();
+        while(!lead.AtEnd())
+        {
+            auto candidate = lead.Id();
+            auto matched = true;
+            for(size_t i = 1; i < cursors.size(); ++i)
+            {
+                cursors[i].SkipTo(candidate);
+                if(cursors[i].AtEnd())
+                    return result;
+                if(cursors[i].Id() != candidate)
+                {
+                    candidate = cursors[i].Id();
+                    matched = false;
+                    break;
+                }
+            }
+
+            if(!matched)
+            {
+                lead.SkipTo(candidate);
+                continue;
+            }
+            if(result.total >= offset && result.ids.size() < limit)
+                result.ids.append(candidate);
+            ++result.total;
+            lead.Next();
+        }
+        return result;
+    }
+
+    qsizetype TermCount() const
+    {
+        auto locker = QReadLocker(&m_lock);
+        return m_terms.size();
+    }
+
+    //encoded posting lists, without the dictionary
+    qsizetype PostingBytes() const
+    {
+        auto locker = QReadLocker(&m_lock);
+        auto bytes = qsizetype{0};
+        for(const auto &postings: m_terms)
+            bytes += postings.ByteSize();
+        return bytes;
+    }
+
+private:
+
+    //one term of a query, the postings of a word or the merged ids of every term under a prefix
+    class TermCursor
+    {
+    public:
+
+        explicit TermCursor(const PostingList &postings) :
+            m_postings(std::in_place, postings),
+            m_size(postings.size())
+        {}
+
+        explicit TermCursor(QList<qint64> &&ids) :
+            m_ids(std::move(ids)),
+            m_size(m_ids.size())
+        {}
+
+        qsizetype Size() const
+        {
+            return m_size;
+        }
+
+        bool AtEnd() const
+        {
+            return m_postings.has_value() ? m_postings->AtEnd() : m_index >= m_ids.size();
+        }
+
+        qint64 Id() const
+        {
+            return m_postings.has_value() ? m_postings->Id() : m_ids[m_index];
+        }
+
+        void Next()
+        {
+            if(m_postings.has_value())
+                m_postings->Next();
+            else
+                ++m_index;
+        }
+
+        void SkipTo(qint64 target)
+        {
+            if(m_postings.has_value())
+                m_postings->SkipTo(target);
+            else
+                m_index = std::lower_bound(m_ids.cbegin() + m_index, m_ids.cend(), target) - m_ids.cbegin();
+        }
+
+    private:
+
+        std::optional<PostingList::Cursor> m_postings;
+        QList<qint64> m_ids;
+        qsizetype m_index = 0;
+        qsizetype m_size;
+    };
+
+    void RemovePosting(const QString &token, qint64 id)
+    {
+        const auto term = m_terms.find(token);
+        if(term == m_terms.end())
+            return;
+        term.value().Remove(id);
+        if(term.value().isEmpty())
+            m_terms.erase(term);
+    }
+
+    mutable QReadWriteLock m_lock;
+    QMap<QString, PostingList> m_terms;
+};
+
+//word and prefix search over the texts of one CRUDAPI, kept current through its change listener
+template<typename T>
+class SearchAPI
+{
+    static_assert(SearchText<T>::Supported, "SearchAPI needs a SearchText specialization");
+
+public:
+
+    static constexpr qsizetype DEFAULT_PAGE = 1;
+    static constexpr qsizetype DEFAULT_PAGE_SIZE = 8;
+    static constexpr qsizetype MAX_PAGE_SIZE = 100;
+
+    explicit SearchAPI(CRUDAPI<qint64, T> &items) :
+        m_items(items)
+    {
+        m_items.AddChangeListener([this](const qint64 &id, const T *before, const T *after)
+        {
+            m_index.Apply(id, before ? &SearchText<T>::Of(*before) : nullptr, after ? &SearchText<T>::Of(*after) : nullptr);
+        });
+    }
+
+    SearchAPI(const SearchAPI &) = delete;
+    SearchAPI &operator=(const SearchAPI &) = delete;
+
+    //?q=<words>[&page=<n>&per_page=<n>], every word has to match and word* matches by prefix of at least MIN_PREFIX_LENGTH
+    //same page shape as the CRUD lists, items in id order
+    QHttpServerResponse Search(const QHttpServerRequest &request) const
+    {
+        const auto query = request.query();
+        auto pageOk = true;
+        auto perPageOk = true;
+        const auto page = query.hasQueryItem("page")
+            ?   query.queryItemValue("page").toLongLong(&pageOk) : DEFAULT_PAGE;
+        const auto perPage = query.hasQueryItem("per_page")
+            ?   query.queryItemValue("per_page").toLongLong(&perPageOk) : DEFAULT_PAGE_SIZE;
+        if(!pageOk || !perPageOk || page < 1 || perPage < 1 || perPage > MAX_PAGE_SIZE)
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+        //the offset (page - 1) * perPage has to fit
+        if(page - 1 > std::numeric_limits<qsizetype>::max() / perPage)
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+        auto optionalResult = std::optional<TextIndex::Result>{};
+        {
+            const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+            optionalResult = m_index.Search(query.queryItemValue("q", QUrl::FullyDecoded), (page - 1) * perPage, perPage);
+        }
+        if(!optionalResult.has_value())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::BadRequest);
+
+        const auto &result = optionalResult.value();
+        if(result.ids.isEmpty())
+            return QHttpServerResponse(QHttpServerResponder::StatusCode::NoContent);
+
+        return FormattedResponse(QJsonObject
+            {
+                {"page", page},
+                {"per_page", perPage},
+                {"total", result.total},
+                {"total_pages", (result.total + perPage - 1) / perPage},
+                {"data", m_items.ItemsToJSON(result.ids)}
+            }, ResponseFormat(request.headers()));
+    }
+
+    const TextIndex &Index() const
+    {
+        return m_index;
+    }
+
+private:
+
+    CRUDAPI<qint64, T> &m_items;
+    TextIndex m_index;
+};
+
+#endif // SEARCHINDEX_HPP
@@ -0,0 +1,325 @@
+#ifndef SNAPSHOTSTORE_HPP
+#define SNAPSHOTSTORE_HPP
+
+#include<QMutex>
+#include<atomic>
+#include<limits>
+
+#include"Metrics.hpp"
+#include"Structs.hpp"
+
+//epoch based reclamation shared by every snapshot store
+//readers publish the epoch they entered in, retired versions are freed once no reader is older
+class EpochDomain
+{
+public:
+
+    static constexpr quint64 IDLE = std::numeric_limits<quint64>::max();
+    static constexpr int MAX_READER_THREADS = 256;
+
+    static EpochDomain &Instance()
+    {
+        static auto domain = EpochDomain{};
+        return domain;
+    }
+
+    class Guard
+    {
+    public:
+
+        explicit Guard(EpochDomain &domain) :
+            m_domain(domain)
+        {
+            m_domain.Enter();
+        }
+
+        ~Guard()
+        {
+            m_domain.Leave();
+        }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+
+        EpochDomain &m_domain;
+    };
+
+    quint64 Advance()
+    {
+        return m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    }
+
+    quint64 OldestActive() const
+    {
+        if(m_overflowReaders.load(std::memory_order_seq_cst) > 0)
+            return 0;
+
+        auto oldest = IDLE;
+        for(const auto &slot: m_slots)
+            oldest = qMin(oldest, slot.epoch.load(std::memory_order_seq_cst));
+        return oldest;
+    }
+
+private:
+
+    EpochDomain() = default;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<quint64> epoch{IDLE};
+        std::atomic<bool> owned{false};
+    };
+
+    //one slot per reader thread, handed back when the thread exits
+    struct ThreadSlot
+    {
+        EpochDomain *domain = nullptr;
+        int index = -1;
+        int depth = 0;
+
+        ~ThreadSlot()
+        {
+            if(domain && index >= 0)
+                domain->m_slots[index].owned.store(false, std::memory_order_release);
+        }
+    };
+
+    static ThreadSlot &CurrentThreadSlot()
+    {
+        thread_local auto slot = ThreadSlot{};
+        return slot;
+    }
+
+    void Enter()
+    {
+        auto &threadSlot = CurrentThreadSlot();
+        if(threadSlot.depth++ > 0)
+            return;
+
+        if(threadSlot.index < 0)
+            Acquire(threadSlot);
+
+        if(threadSlot.index < 0)
+        {
+            //more reader threads than slots, block reclamation while they read
+            m_overflowReaders.fetch_add(1, std::memory_order_seq_cst);
+            return;
+        }
+
+        m_slots[threadSlot.index].epoch.store(m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+
+    void Leave()
+    {
+        auto &threadSlot = CurrentThreadSlot();
+        if(--threadSlot.depth > 0)
+            return;
+
+        if(threadSlot.index < 0)
+            m_overflowReaders.fetch_sub(1, std::memory_order_release);
+        else
+            m_slots[threadSlot.index].epoch.store(IDLE, std::memory_order_release);
+    }
+
+    void Acquire(ThreadSlot &threadSlot)
+    {
+        for(auto i = 0; i < MAX_READER_THREADS; ++i)
+        {
+            auto expected = false;
+            if(m_slots[i].owned.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+            {
+                threadSlot.domain = this;
+                threadSlot.index = i;
+                return;
+            }
+        }
+    }
+
+    Slot m_slots[MAX_READER_THREADS];
+    std::atomic<quint64> m_epoch{1};
+    std::atomic<int> m_overflowReaders{0};
+};
+
+//versioned immutable snapshots of an IdMap
+//readers never lock, writers are serialized and publish a copy-on-write version
+//Write publishes at once, Stage keeps the version back until Publish or Discard, the two do not mix while stages are pending
+template<typename K = qint64, typename T = void>
+class SnapshotStore
+{
+    struct Version
+    {
+        IdMap<K, T> data;
+        quint64 number;
+    };
+
+public:
+
+    class ReadSnapshot
+    {
+    public:
+
+        explicit ReadSnapshot(EpochDomain &domain, const std::atomic<Version *> &current) :
+            m_guard(domain),
+            m_version(current.load(std::memory_order_seq_cst))
+        {}
+
+        const IdMap<K, T> &operator*() const
+        {
+            return m_version->data;
+        }
+
+        const IdMap<K, T> *operator->() const
+        {
+            return &m_version->data;
+        }
+
+        quint64 Number() const
+        {
+            return m_version->number;
+        }
+
+    private:
+
+        EpochDomain::Guard m_guard;
+        const Version *m_version;
+    };
+
+    explicit SnapshotStore(const IdMap<K, T> &data) :
+        m_current(new Version{data, 1})
+    {}
+
+    ~SnapshotStore()
+    {
+        delete m_current.load(std::memory_order_relaxed);
+        for(const auto &retired: m_retired)
+            delete retired.version;
+        for(const auto &staged: m_staged)
+            delete staged.version;
+    }
+
+    SnapshotStore(const SnapshotStore &) = delete;
+    SnapshotStore &operator=(const SnapshotStore &) = delete;
+
+    ReadSnapshot Read() const
+    {
+        return ReadSnapshot(EpochDomain::Instance(), m_current);
+    }
+
+    //mutation runs on a private copy, chunk sharing means untouched data is not duplicated until it is written
+    template<typename Function>
+    auto Write(Function &&mutation)
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+        auto locker = QMutexLocker(&m_writeMutex);
+        auto *current = m_current.load(std::memory_order_relaxed);
+        auto *next = new Version{current->data, current->number + 1};
+        auto result = mutation(next->data);
+        PublishVersion(next);
+        return result;
+    }
+
+    //like Write, but the new version is only staged: readers keep the published one and later stages build on it
+    //tag runs after the mutation, still under the write lock, and must not shrink from one stage to the next
+    template<typename Function, typename Tag>
+    auto Stage(Function &&mutation, Tag &&tag)
+    {
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+        auto locker = QMutexLocker(&m_writeMutex);
+        const auto *latest = Latest();
+        auto *next = new Version{latest->data, latest->number + 1};
+        auto result = mutation(next->data);
+        m_staged.append(Staged{next, quint64(tag())});
+        return result;
+    }
+
+    //publishes the newest staged version tagged at most tag, then hands its tag to published under the write lock
+    //the staged versions it supersedes were never visible, so they are freed at once
+    template<typename Function>
+    void Publish(quint64 tag, Function &&published)
+    {
+        auto locker = QMutexLocker(&m_writeMutex);
+        if(m_staged.isEmpty() || m_staged.first().tag > tag)
+            return;
+
+        while(m_staged.size() > 1 && m_staged.at(1).tag <= tag)
+            delete m_staged.takeFirst().version;
+        const auto staged = m_staged.takeFirst();
+        PublishVersion(staged.version);
+        published(staged.tag);
+    }
+
+    //drops the staged versions tagged tag or later, later stages build on what is left
+    //kept gets the tag of the newest staged version left, 0 when none is
+    template<typename Function>
+    void Discard(quint64 tag, Function &&kept)
+    {
+        auto locker = QMutexLocker(&m_writeMutex);
+        while(!m_staged.isEmpty() && m_staged.last().tag >= tag)
+            delete m_staged.takeLast().version;
+        kept(m_staged.isEmpty() ? quint64{0} : m_staged.last().tag);
+    }
+
+    //runs with writers excluded, for work that must line up with a point in the mutation order, staged versions included
+    template<typename Function>
+    auto Exclusive(Function &&function)
+    {
+        auto locker = QMutexLocker(&m_writeMutex);
+        return function(std::as_const(Latest()->data));
+    }
+
+    //runs with writers excluded on the version readers see
+    template<typename Function>
+    auto ExclusivePublished(Function &&function)
+    {
+        auto locker = QMutexLocker(&m_writeMutex);
+        return function(std::as_const(m_current.load(std::memory_order_relaxed)->data));
+    }
+
+private:
+
+    struct Retired
+    {
+        Version *version;
+        quint64 epoch;
+    };
+
+    struct Staged
+    {
+        Version *version;
+        quint64 tag;
+    };
+
+    const Version *Latest() const
+    {
+        return m_staged.isEmpty() ? m_current.load(std::memory_order_relaxed) : m_staged.last().version;
+    }
+
+    void PublishVersion(Version *next)
+    {
+        auto *current = m_current.load(std::memory_order_relaxed);
+        m_current.store(next, std::memory_order_seq_cst);
+        m_retired.append(Retired{current, EpochDomain::Instance().Advance()});
+        Reclaim();
+    }
+
+    void Reclaim()
+    {
+        const auto oldest = EpochDomain::Instance().OldestActive();
+        m_retired.removeIf([oldest](const Retired &retired)
+        {
+            if(retired.epoch > oldest)
+                return false;
+            delete retired.version;
+            return true;
+        });
+    }
+
+    std::atomic<Version *> m_current;
+    QMutex m_writeMutex;
+    QList<Retired> m_retired;
+    QList<Staged> m_staged;
+};
+
+#endif // SNAPSHOTSTORE_HPP
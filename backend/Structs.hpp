@@ -3,9 +3,15 @@
 
 #include<QJsonObject>
 #include<QJsonArray>
+#include<QReadWriteLock>
+#include<QSharedDataPointer>
+#include<QtAlgorithms>
 #include<optional>
+#include<algorithm>
 
 #include"Utility.hpp"
+#include"JSONFields.hpp"
+#include"InternPool.hpp"
 
 struct JSONable
 {
@@ -54,12 +60,39 @@ QList<T> FromJSONArray(const QJsonArray &jsonArray)
     return list;
 }
 
+//factory generated from the field descriptors, every writable field has to be present
+//T gives the factory access to a private default constructor that only takes a fresh id
+template<typename T>
+struct DescribedFactory : public FactoryFromJSON<T>
+{
+    std::optional<T> FromJSON(const QJsonObject &json) const override
+    {
+        if(!HasWritableFields<T>(json))
+            return std::nullopt;
+
+        auto item = T{};
+        if(!ReadFields(item, json))
+            return std::nullopt;
+        return item;
+    }
+};
+
 struct Answer : public JSONable, public Updatable
 {
     qint64 id; //qint8
     QString answerText;
     bool isTrue;
 
+    static constexpr auto Fields()
+    {
+        return std::make_tuple
+            (
+                ReadOnlyField("id", &Answer::id),
+                Field("answerText", &Answer::answerText),
+                Field("isTrue", &Answer::isTrue)
+            );
+    }
+
     explicit Answer(const QString &answerText,
                     const bool isTrue) :
         id(NextId()),
@@ -69,55 +102,35 @@ struct Answer : public JSONable, public Updatable
 
     QJsonObject ToJSON() const override
     {
-        return QJsonObject
-            {
-                {"id", id},
-                {"answerText", answerText},
-                {"isTrue", isTrue}
-            };
+        return FieldsToJSON(*this);
     }
 
     bool Update(const QJsonObject &json) override
     {
-        if(!json.contains("answerText")
-            || !json.contains("isTrue"))
-            return false;
-
-        answerText = json.value("answerText").toString();
-        isTrue = json.value("isTrue").toBool();
-        return true;
+        return UpdateAllFields(*this, json);
     }
 
     void UpdateFields(const QJsonObject &json) override
     {
-        if(json.contains("answerText"))
-            answerText = json.value("answerText").toString();
-        if(json.contains("isTrue"))
-            isTrue = json.value("isTrue").toBool();
+        UpdatePresentFields(*this, json);
     }
 
 private:
+    friend struct DescribedFactory<Answer>;
+
+    Answer() :
+        id(NextId()),
+        isTrue(false)
+    {}
+
     static qint64 NextId()
     {
-        static auto lastId = qint64{1};
-        return lastId++;
+        return IdSequence<Answer>::Next();
     }
 };
 
-struct AnswerFactory : public FactoryFromJSON<Answer>
-{
-    std::optional<Answer> FromJSON(const QJsonObject &json) const override
-    {
-        if(!json.contains("answerText")
-            || !json.contains("isTrue"))
-            return std::nullopt;
-        return Answer
-            (
-                json.value("answerText").toString(),
-                json.value("isTrue").toBool()
-            );
-    }
-};
+struct AnswerFactory : public DescribedFactory<Answer>
+{};
 
 struct Category : public JSONable, public Updatable
 {
@@ -125,6 +138,16 @@ struct Category : public JSONable, public Updatable
     QString categoryText;
     QUrl iconUrl;
 
+    static constexpr auto Fields()
+    {
+        return std::make_tuple
+            (
+                ReadOnlyField("id", &Category::id),
+                Field("categoryText", &Category::categoryText),
+                Field("iconUrl", &Category::iconUrl)
+            );
+    }
+
     explicit Category(const QString &categoryText,
                       const QUrl &iconUrl) :
         id(NextId()),
@@ -134,56 +157,246 @@ struct Category : public JSONable, public Updatable
 
     QJsonObject ToJSON() const override
     {
-        return QJsonObject
-        {
-            {"id", id},
-            {"categoryText", categoryText},
-            {"iconUrl", iconUrl.toString()}
-        };
+        return FieldsToJSON(*this);
     }
 
     bool Update(const QJsonObject &json) override
     {
-        if(!json.contains("categoryText")
-            || !json.contains("iconUrl"))
-            return false;
-
-        categoryText = json.value("categoryText").toString();
-        iconUrl.setPath(json.value("iconUrl").toString());
-        return true;
+        return UpdateAllFields(*this, json);
     }
 
     void UpdateFields(const QJsonObject &json) override
     {
-        if(json.contains("categoryText"))
-            categoryText = json.value("categoryText").toString();
-        if(json.contains("iconUrl"))
-            iconUrl.setPath(json.value("iconUrl").toString());
+        UpdatePresentFields(*this, json);
     }
 
 private:
+    friend struct DescribedFactory<Category>;
+
+    Category() :
+        id(NextId())
+    {}
+
     static qint64 NextId()
     {
-        static auto lastId = qint64{1};
-        return lastId++;
+        return IdSequence<Category>::Next();
     }
 };
 
-struct CategoryFactory : public FactoryFromJSON<Category>
+struct CategoryFactory : public DescribedFactory<Category>
+{};
+
+//questions refer to the categories of the category store by id
+//the directory follows that store through its change listener and never makes a category of its own
+//a question keeps the id of a deleted category, it goes out as {"id": <id>} from then on
+class CategoryDirectory
 {
-    std::optional<Category> FromJSON(const QJsonObject &json) const override
+public:
+
+    static CategoryDirectory &Instance()
+    {
+        static auto directory = CategoryDirectory{};
+        return directory;
+    }
+
+    //after is null once the category is deleted
+    void Apply(qint64 id, const Category *after)
     {
-        if(!json.contains("categoryText")
-            || !json.contains("iconUrl"))
+        auto locker = QWriteLocker(&m_lock);
+        const auto existing = m_categories.constFind(id);
+        if(existing != m_categories.constEnd())
+        {
+            m_ids.remove(KeyOf(existing.value()), id);
+            m_categories.erase(existing);
+        }
+        if(!after)
+            return;
+
+        m_categories.insert(id, *after);
+        m_ids.insert(KeyOf(*after), id);
+    }
+
+    std::optional<Category> Find(qint64 id) const
+    {
+        auto locker = QReadLocker(&m_lock);
+        const auto category = m_categories.constFind(id);
+        if(category == m_categories.constEnd())
             return std::nullopt;
+        return category.value();
+    }
+
+    //the lowest id of the categories with this text and icon
+    std::optional<qint64> FindId(const QString &categoryText, const QString &iconUrl) const
+    {
+        auto locker = QReadLocker(&m_lock);
+        const auto ids = m_ids.values(CategoryKey{categoryText, iconUrl});
+        if(ids.isEmpty())
+            return std::nullopt;
+        return *std::min_element(ids.constBegin(), ids.constEnd());
+    }
+
+private:
+
+    using CategoryKey = QPair<QString, QString>;
+
+    CategoryDirectory() = default;
+
+    static CategoryKey KeyOf(const Category &category)
+    {
+        return CategoryKey{category.categoryText, category.iconUrl.toString()};
+    }
+
+    mutable QReadWriteLock m_lock;
+    QHash<qint64, Category> m_categories;
+    QMultiHash<CategoryKey, qint64> m_ids;
+};
+
+//answer texts repeat a lot ("True", "False", numbers), each distinct text is stored once
+using AnswerTextPool = InternPool<QString, QString>;
+
+//a category reference goes out as the full category object
+//it comes in by id, or by text and icon of an existing category, an unknown category is refused
+struct CategoryRefCodec
+{
+    static QJsonValue ToJSON(qint64 categoryId)
+    {
+        const auto category = CategoryDirectory::Instance().Find(categoryId);
+        if(!category.has_value())
+            return QJsonObject{{"id", categoryId}};
+        return category.value().ToJSON();
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, qint64 categoryId)
+    {
+        const auto category = CategoryDirectory::Instance().Find(categoryId);
+        if(category.has_value())
+        {
+            writer.Write(category.value());
+            return;
+        }
+        writer.BeginObject();
+        writer.Key("id");
+        writer.Integer(categoryId);
+        writer.EndObject();
+    }
+
+    //an id the category sequence handed out stays valid after its category is deleted,
+    //so persisted questions that refer to it are still recovered
+    static bool FromJSON(const QJsonValue &json, qint64 &categoryId)
+    {
+        const auto object = json.toObject();
+        if(object.value("id").isDouble())
+        {
+            const auto id = object.value("id").toInteger();
+            if(!CategoryDirectory::Instance().Find(id).has_value() && !IdSequence<Category>::Issued(id))
+                return false;
+            categoryId = id;
+            return true;
+        }
+
+        const auto id = CategoryDirectory::Instance().FindId(object.value("categoryText").toString(), object.value("iconUrl").toString());
+        if(!id.has_value())
+            return false;
+        categoryId = id.value();
+        return true;
+    }
+};
 
-        auto iconUrl = QUrl{json.value("iconUrl").toString()};
-        return Category
+struct AnswerTextCodec
+{
+    static QJsonValue ToJSON(quint32 answerText)
+    {
+        return AnswerTextPool::Instance().At(answerText);
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, quint32 answerText)
+    {
+        writer.String(AnswerTextPool::Instance().At(answerText));
+    }
+};
+
+//compact storage form of an Answer, the text is a reference into AnswerTextPool
+struct AnswerRecord
+{
+    qint64 id;
+    quint32 answerText;
+    bool isTrue;
+
+    static constexpr auto Fields()
+    {
+        return std::make_tuple
             (
-                json.value("categoryText").toString(),
-                iconUrl
+                ReadOnlyField("id", &AnswerRecord::id),
+                ReadOnlyField<AnswerTextCodec>("answerText", &AnswerRecord::answerText),
+                SecretField("isTrue", &AnswerRecord::isTrue)
             );
     }
+
+    //nullopt when the text is new and the pool is full
+    static std::optional<AnswerRecord> FromAnswer(const Answer &answer)
+    {
+        const auto answerText = AnswerTextPool::Instance().Intern(answer.answerText, [&answer](){ return answer.answerText; });
+        if(!answerText.has_value())
+            return std::nullopt;
+        return AnswerRecord{answer.id, answerText.value(), answer.isTrue};
+    }
+
+    const QString &AnswerText() const
+    {
+        return AnswerTextPool::Instance().At(answerText);
+    }
+
+    QJsonObject ToJSON() const
+    {
+        return FieldsToJSON(*this);
+    }
+};
+
+static std::optional<QList<AnswerRecord>> ToAnswerRecords(const QList<Answer> &answers)
+{
+    auto records = QList<AnswerRecord>{};
+    records.reserve(answers.size());
+    for(const auto &answer: answers)
+    {
+        const auto record = AnswerRecord::FromAnswer(answer);
+        if(!record.has_value())
+            return std::nullopt;
+        records.append(record.value());
+    }
+    return records;
+}
+
+//answers come in as full Answer objects and are stored as records
+//public masks leave out which answers are right
+struct AnswerRecordsCodec
+{
+    static QJsonValue ToJSON(const QList<AnswerRecord> &answers, FieldMask fields = ALL_FIELDS)
+    {
+        auto answersJson = QJsonArray{};
+        for(const auto &answer: answers)
+            answersJson.append(FieldsToJSON(answer, fields));
+        return answersJson;
+    }
+
+    template<typename Writer>
+    static void Write(Writer &writer, const QList<AnswerRecord> &answers, FieldMask fields = ALL_FIELDS)
+    {
+        writer.BeginArray();
+        for(const auto &answer: answers)
+            WriteFields(writer, answer, fields);
+        writer.EndArray();
+    }
+
+    static bool FromJSON(const QJsonValue &json, QList<AnswerRecord> &answers)
+    {
+        const auto records = ToAnswerRecords(FromJSONArray<Answer, AnswerFactory>(json.toArray()));
+        if(!records.has_value())
+            return false;
+        answers = records.value();
+        return true;
+    }
 };
 
 struct Question : public JSONable, public Updatable
@@ -191,100 +404,104 @@ struct Question : public JSONable, public Updatable
     qint64 id;
     QString questionText;
 
-    Category category;
-    QList<Answer> answers;
+    qint64 categoryId;
+    QList<AnswerRecord> answers;
+
+    static constexpr auto Fields()
+    {
+        return std::make_tuple
+            (
+                ReadOnlyField("id", &Question::id),
+                Field("questionText", &Question::questionText),
+                Field<CategoryRefCodec>("category", &Question::categoryId),
+                Field<AnswerRecordsCodec>("answers", &Question::answers)
+            );
+    }
 
     explicit Question(const QString &questionText,
-                      const Category &category,
-                      const QList<Answer> &answers) :
+                      qint64 categoryId,
+                      const QList<AnswerRecord> &answers) :
         id(NextId()),
         questionText(questionText),
-        category(category),
+        categoryId(categoryId),
         answers(answers)
     {}
 
     QJsonObject ToJSON() const override
     {
-        return QJsonObject
-            {
-                {"id", id},
-                {"questionText", questionText},
-                {"category", category.ToJSON()},
-                {"answers", ToJSONArray(answers)}
-            };
+        return FieldsToJSON(*this);
     }
 
     bool Update(const QJsonObject &json) override
     {
-        if(!json.contains("questionText")
-            || !json.contains("category")
-            || !json.contains("answers"))
-            return false;
-
-        questionText = json.value("questionText").toString();
-        const auto categoryFactory = CategoryFactory{};
-        const auto categoryOptional = categoryFactory.FromJSON(json.value("category").toObject());
-        if(!categoryOptional.has_value())
-            return false;
-        category = categoryOptional.value();
-        answers = FromJSONArray<Answer, AnswerFactory>(json.value("answers").toArray());
-
-        return true;
+        return UpdateAllFields(*this, json);
     }
 
     void UpdateFields(const QJsonObject &json) override
     {
-        if(json.contains("questionText"))
-            questionText = json.value("questionText").toString();
-        if(json.contains("category"))
-        {
-            const auto categoryFactory = CategoryFactory{};
-            const auto categoryOptional = categoryFactory.FromJSON(json.value("category").toObject());
-            if(categoryOptional.has_value())
-                category = categoryOptional.value();
-        }
-        if(json.contains("answers"))
-            answers = FromJSONArray<Answer, AnswerFactory>(json.value("answers").toArray());
+        UpdatePresentFields(*this, json);
     }
 
 private:
+    friend struct DescribedFactory<Question>;
+
+    //only filled in by the factory, categoryId is never read before it is set
+    Question() :
+        id(NextId()),
+        categoryId(0)
+    {}
+
     static qint64 NextId()
     {
-        static auto lastId = qint64{1};
-        return lastId++;
+        return IdSequence<Question>::Next();
     }
 };
 
-struct QuestionFactory : public FactoryFromJSON<Question>
+struct QuestionFactory : public DescribedFactory<Question>
+{};
+
+//types with fields interned into capped pools, a body refused because a pool is full is answered with 507
+template<typename T>
+struct InternedFields
 {
-    std::optional<Question> FromJSON(const QJsonObject &json) const override
+    static constexpr bool Supported = false;
+
+    static quint64 Refusals()
     {
-        if(!json.contains("questionText")
-            || !json.contains("category")
-            || !json.contains("answers"))
-            return std::nullopt;
+        return 0;
+    }
+};
 
-        const auto categoryFactory = CategoryFactory{};
-        const auto categoryOptional = categoryFactory.FromJSON(json.value("category").toObject());
-        if(!categoryOptional.has_value())
-            return std::nullopt;
+template<>
+struct InternedFields<Question>
+{
+    static constexpr bool Supported = true;
 
-        const auto category = categoryOptional.value();
-        return Question
-            (
-                json.value("questionText").toString(),
-                category,
-                FromJSONArray<Answer, AnswerFactory>(json.value("answers").toArray())
-                );
+    //refusals on the calling thread, read before and after a body is turned into a question
+    static quint64 Refusals()
+    {
+        return AnswerTextPool::Refusals();
     }
 };
 
 //
 //
+//players get sessions on request, only admin sessions may change categories and questions
 struct SessionEntry : public JSONable
 {
     qint64 id;
     std::optional<QUuid> token;
+    bool admin = false;
+
+    static constexpr auto Fields()
+    {
+        return std::make_tuple
+            (
+                ReadOnlyField("id", &SessionEntry::id),
+                ReadOnlyField("token", &SessionEntry::token),
+                ReadOnlyField("admin", &SessionEntry::admin)
+            );
+    }
 
     explicit SessionEntry() :
         id(NextId())
@@ -302,17 +519,25 @@ struct SessionEntry : public JSONable
 
     QJsonObject ToJSON() const override
     {
-        return token    ? QJsonObject
+        return token    ? FieldsToJSON(*this)
+                        : QJsonObject{};
+    }
+
+    template<typename Writer>
+    void WriteJSON(Writer &writer) const
+    {
+        if(token)
+            WriteFields(writer, *this);
+        else
         {
-            {"id", id},
-            {"token", token->toString(QUuid::StringFormat::WithoutBraces)}
+            writer.BeginObject();
+            writer.EndObject();
         }
-                        : QJsonObject{};
     }
 
-    bool operator==(const QString &other) const
+    bool operator==(const QUuid &other) const
     {
-        return token.has_value() && (token.value() == QUuid::fromString(other)); //TODOREAD
+        return token.has_value() && (token.value() == other);
     }
 
 private:
@@ -324,25 +549,164 @@ private:
 
     static qint64 NextId()
     {
-        static auto lastId = qint64{1};
-        return lastId++;
+        return IdSequence<SessionEntry>::Next();
     }
 };
 
 struct SessionEntryFactory : public FactoryFromJSON<SessionEntry>
 {
-    std::optional<SessionEntry> FromJSON(const QJsonObject &json) const override
+    //nothing is taken from the body, admin sessions are only made by SessionAPI::RegisterAdminSession
+    std::optional<SessionEntry> FromJSON(const QJsonObject &) const override
     {
-        return SessionEntry(); //TODO AUTH?
+        return SessionEntry();
     }
 };
 
+//items by integer id in key order, ids from NextId() are dense so every 64 consecutive ids share one chunk
+//a chunk keeps a bitmask of live slots and, out of line, only its live items, so a sparse id costs one item and not a chunk
+//chunks are implicitly shared, a copied map duplicates only the chunks it writes to afterwards
+//item counts per chunk are kept in a fenwick tree, so positional access and a write are both O(log chunks)
 template<typename K = qint64, typename T = void>
-class IdMap : public QMap<K, T>
+class IdMap
 {
+    static_assert(std::is_integral_v<K>, "IdMap keys are integer ids");
+
+    static constexpr int CHUNK_BITS = 6;
+    static constexpr qsizetype CHUNK_SIZE = qsizetype{1} << CHUNK_BITS;
+
+    //values[i] is the item of the i-th set bit of live
+    struct Chunk : public QSharedData
+    {
+        quint64 live = 0;
+        QList<T> values;
+    };
+
+    struct ChunkRef
+    {
+        K number;
+        QSharedDataPointer<Chunk> chunk;
+    };
+
 public:
+
+    using key_type = K;
+    using mapped_type = T;
+
+    class const_iterator
+    {
+    public:
+
+        const_iterator() = default;
+
+        const_iterator(const IdMap *map, qsizetype chunk, int slot) :
+            m_map(map),
+            m_chunk(chunk),
+            m_slot(slot)
+        {
+            Load();
+        }
+
+        const K &key() const
+        {
+            return m_key;
+        }
+
+        const T &value() const
+        {
+            return *m_value;
+        }
+
+        const T &operator*() const
+        {
+            return *m_value;
+        }
+
+        const T *operator->() const
+        {
+            return m_value;
+        }
+
+        const_iterator &operator++()
+        {
+            const auto live = m_map->m_chunks.at(m_chunk).chunk->live & HigherSlots(m_slot);
+            if(live)
+                m_slot = qCountTrailingZeroBits(live);
+            else
+            {
+                //empty chunks are dropped, so the next one always has a live slot
+                ++m_chunk;
+                m_slot = m_chunk < m_map->m_chunks.size() ? qCountTrailingZeroBits(m_map->m_chunks.at(m_chunk).chunk->live) : 0;
+            }
+            Load();
+            return *this;
+        }
+
+        bool operator==(const const_iterator &other) const
+        {
+            return m_chunk == other.m_chunk && m_slot == other.m_slot;
+        }
+
+        bool operator!=(const const_iterator &other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+
+        void Load()
+        {
+            if(m_chunk >= m_map->m_chunks.size())
+                return;
+            const auto &ref = m_map->m_chunks.at(m_chunk);
+            m_key = K(qint64(ref.number) * CHUNK_SIZE + m_slot);
+            m_value = &ref.chunk->values.at(Rank(ref.chunk->live, m_slot));
+        }
+
+        const IdMap *m_map = nullptr;
+        qsizetype m_chunk = 0;
+        int m_slot = 0;
+        K m_key{};
+        const T *m_value = nullptr;
+    };
+
+    //what insert hands back, the item stays valid until the map is modified again
+    class iterator
+    {
+    public:
+
+        iterator(K key, T *value) :
+            m_key(key),
+            m_value(value)
+        {}
+
+        const K &key() const
+        {
+            return m_key;
+        }
+
+        T &value() const
+        {
+            return *m_value;
+        }
+
+        T &operator*() const
+        {
+            return *m_value;
+        }
+
+        T *operator->() const
+        {
+            return m_value;
+        }
+
+    private:
+
+        K m_key;
+        T *m_value;
+    };
+
     IdMap() = default;
-    explicit IdMap(const FactoryFromJSON<T> &factory, const QJsonArray &array) : QMap<K, T>()
+    explicit IdMap(const FactoryFromJSON<T> &factory, const QJsonArray &array)
     {
         for(const auto &json: array)
         {
@@ -350,56 +714,497 @@ public:
             {
                 const auto optional = factory.FromJSON(json.toObject());
                 if(optional.has_value())
-                    QMap<K, T>::insert(optional.value().id, optional.value());
+                    insert(optional.value().id, optional.value());
+            }
+        }
+    }
+
+    qsizetype size() const
+    {
+        return m_size;
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    bool contains(const K &key) const
+    {
+        const auto chunk = FindChunk(ChunkNumber(key));
+        return chunk >= 0 && (m_chunks.at(chunk).chunk->live >> Slot(key)) & 1;
+    }
+
+    const_iterator constFind(const K &key) const
+    {
+        const auto chunk = FindChunk(ChunkNumber(key));
+        if(chunk < 0 || !((m_chunks.at(chunk).chunk->live >> Slot(key)) & 1))
+            return constEnd();
+        return const_iterator(this, chunk, Slot(key));
+    }
+
+    const_iterator constBegin() const
+    {
+        return m_chunks.isEmpty() ? constEnd() : const_iterator(this, 0, qCountTrailingZeroBits(m_chunks.first().chunk->live));
+    }
+
+    const_iterator constEnd() const
+    {
+        return const_iterator(this, m_chunks.size(), 0);
+    }
+
+    const_iterator begin() const
+    {
+        return constBegin();
+    }
+
+    const_iterator end() const
+    {
+        return constEnd();
+    }
+
+    const T &first() const
+    {
+        return *constBegin();
+    }
+
+    const T &last() const
+    {
+        return m_chunks.last().chunk->values.last();
+    }
+
+    K firstKey() const
+    {
+        return constBegin().key();
+    }
+
+    K lastKey() const
+    {
+        const auto &ref = m_chunks.last();
+        return K(qint64(ref.number) * CHUNK_SIZE + (CHUNK_SIZE - 1) - qCountLeadingZeroBits(ref.chunk->live));
+    }
+
+    //every item in key order
+    QList<T> values() const
+    {
+        auto values = QList<T>{};
+        values.reserve(m_size);
+        for(const auto &ref: m_chunks)
+            values.append(ref.chunk->values);
+        return values;
+    }
+
+    //first item with a key greater than key
+    const_iterator upperBound(const K &key) const
+    {
+        const auto number = ChunkNumber(key);
+        auto chunk = LowerChunk(number);
+        if(chunk < m_chunks.size() && m_chunks.at(chunk).number == number)
+        {
+            const auto live = m_chunks.at(chunk).chunk->live & HigherSlots(Slot(key));
+            if(live)
+                return const_iterator(this, chunk, qCountTrailingZeroBits(live));
+            ++chunk;
+        }
+        if(chunk >= m_chunks.size())
+            return constEnd();
+        return const_iterator(this, chunk, qCountTrailingZeroBits(m_chunks.at(chunk).chunk->live));
+    }
+
+    //O(log n) positional access, descending the count tree to the chunk and skipping set bits inside it
+    const_iterator ConstIteratorAt(qsizetype index) const
+    {
+        if(index < 0 || index >= m_size)
+            return constEnd();
+
+        auto before = qsizetype{0};
+        const auto chunk = ChunkAt(index, before);
+        auto live = m_chunks.at(chunk).chunk->live;
+        for(auto skip = index - before; skip > 0; --skip)
+            live &= live - 1;
+        return const_iterator(this, chunk, qCountTrailingZeroBits(live));
+    }
+
+    iterator insert(const K &key, const T &value)
+    {
+        const auto number = ChunkNumber(key);
+        auto chunk = LowerChunk(number);
+        if(chunk == m_chunks.size() || m_chunks.at(chunk).number != number)
+        {
+            m_chunks.insert(chunk, ChunkRef{number, QSharedDataPointer<Chunk>(new Chunk)});
+            if(chunk == m_chunks.size() - 1)
+                AppendCount(0);
+            else
+                RebuildCounts();
+        }
+
+        //writing through the non const pointer detaches a chunk still shared with another copy
+        auto &data = *m_chunks[chunk].chunk;
+        const auto slot = Slot(key);
+        const auto rank = Rank(data.live, slot);
+        if(!((data.live >> slot) & 1))
+        {
+            data.live |= quint64{1} << slot;
+            data.values.insert(rank, value);
+            ++m_size;
+            AddCount(chunk, 1);
+        }
+        else
+            data.values[rank] = value;
+        return iterator(key, &data.values[rank]);
+    }
+
+    qsizetype remove(const K &key)
+    {
+        const auto chunk = FindChunk(ChunkNumber(key));
+        const auto slot = Slot(key);
+        if(chunk < 0 || !((m_chunks.at(chunk).chunk->live >> slot) & 1))
+            return 0;
+
+        --m_size;
+        if(m_chunks.at(chunk).chunk->live == quint64{1} << slot)
+        {
+            //the last item of its chunk, the chunk goes without being detached first
+            m_chunks.remove(chunk);
+            if(chunk == m_chunks.size())
+                m_counts.removeLast();
+            else
+                RebuildCounts();
+            return 1;
+        }
+
+        auto &data = *m_chunks[chunk].chunk;
+        data.values.remove(Rank(data.live, slot));
+        data.live &= ~(quint64{1} << slot);
+        AddCount(chunk, -1);
+        return 1;
+    }
+
+    void clear()
+    {
+        m_chunks.clear();
+        m_counts.clear();
+        m_size = 0;
+    }
+
+private:
+
+    static K ChunkNumber(const K &key)
+    {
+        return K(qint64(key) >> CHUNK_BITS);
+    }
+
+    static int Slot(const K &key)
+    {
+        return int(qint64(key) & (CHUNK_SIZE - 1));
+    }
+
+    static quint64 HigherSlots(int slot)
+    {
+        return slot == CHUNK_SIZE - 1 ? 0 : ~quint64{0} << (slot + 1);
+    }
+
+    //live slots below slot, the position of slot's item in the chunk
+    static qsizetype Rank(quint64 live, int slot)
+    {
+        return qPopulationCount(live & ((quint64{1} << slot) - 1));
+    }
+
+    //position of the first chunk not below number
+    qsizetype LowerChunk(const K &number) const
+    {
+        //dense ids leave no gaps in the directory, so the position is usually a subtraction
+        if(!m_chunks.isEmpty())
+        {
+            const auto guess = qint64(number) - qint64(m_chunks.first().number);
+            if(guess >= 0 && guess < m_chunks.size() && m_chunks.at(guess).number == number)
+                return guess;
+        }
+        return std::lower_bound(m_chunks.cbegin(), m_chunks.cend(), number,
+                                [](const ChunkRef &ref, const K &number){ return ref.number < number; }) - m_chunks.cbegin();
+    }
+
+    qsizetype FindChunk(const K &number) const
+    {
+        const auto chunk = LowerChunk(number);
+        return chunk < m_chunks.size() && m_chunks.at(chunk).number == number ? chunk : -1;
+    }
+
+    //node n of the tree (stored at n - 1) sums the counts of chunks n - lowbit(n) up to n - 1
+    void AddCount(qsizetype chunk, qsizetype delta)
+    {
+        for(auto node = chunk + 1; node <= m_counts.size(); node += node & -node)
+            m_counts[node - 1] += delta;
+    }
+
+    //items in the chunks ahead of chunk
+    qsizetype CountBefore(qsizetype chunk) const
+    {
+        auto count = qsizetype{0};
+        for(auto node = chunk; node > 0; node -= node & -node)
+            count += m_counts.at(node - 1);
+        return count;
+    }
+
+    //a chunk appended at the end, the dense id case, only needs its own node
+    void AppendCount(qsizetype count)
+    {
+        const auto node = m_counts.size() + 1;
+        m_counts.append(count + CountBefore(node - 1) - CountBefore(node - (node & -node)));
+    }
+
+    //a chunk was inserted or dropped in the middle and the positions after it moved, built again in O(chunks)
+    void RebuildCounts()
+    {
+        m_counts.resize(m_chunks.size());
+        for(auto chunk = qsizetype{0}; chunk < m_chunks.size(); ++chunk)
+            m_counts[chunk] = qPopulationCount(m_chunks.at(chunk).chunk->live);
+        for(auto node = qsizetype{1}; node <= m_counts.size(); ++node)
+        {
+            const auto parent = node + (node & -node);
+            if(parent <= m_counts.size())
+                m_counts[parent - 1] += m_counts.at(node - 1);
+        }
+    }
+
+    //chunk holding the item at index, before gets the items ahead of that chunk
+    qsizetype ChunkAt(qsizetype index, qsizetype &before) const
+    {
+        auto step = qsizetype{1};
+        while(step * 2 <= m_counts.size())
+            step *= 2;
+
+        auto node = qsizetype{0};
+        before = 0;
+        for(; step > 0; step /= 2)
+        {
+            if(node + step <= m_counts.size() && before + m_counts.at(node + step - 1) <= index)
+            {
+                node += step;
+                before += m_counts.at(node - 1);
             }
         }
+        return node;
     }
+
+    QList<ChunkRef> m_chunks;
+    QList<qsizetype> m_counts;
+    qsizetype m_size = 0;
 };
 
+//the page is rendered from the container on demand, which has to stay alive and unchanged meanwhile
 template<typename T>
 class PaginatedData : public JSONable
 {
+    using ConstIterator = decltype(std::declval<const T &>().ConstIteratorAt(0));
+
 public:
 
+    using KeyType = typename T::key_type;
+
     static constexpr qsizetype DEFAULT_PAGE = 1;
     static constexpr qsizetype DEFAULT_PAGE_SIZE = 8;
+    static constexpr qsizetype MAX_PAGE_SIZE = 100;
 
-    explicit PaginatedData(const T &container, qsizetype page = DEFAULT_PAGE, qsizetype size = DEFAULT_PAGE_SIZE)
+    explicit PaginatedData(const T &container, qsizetype page = DEFAULT_PAGE, qsizetype size = DEFAULT_PAGE_SIZE,
+                           FieldMask fields = ALL_FIELDS) :
+        m_container(container),
+        m_fields(fields)
     {
         const auto containerSize = container.size();
         const auto pageIndex = page - 1;
-        const auto pageSize = qMin(size, containerSize);
+        const auto pageSize = qMax(qsizetype{1}, qMin(size, containerSize));
         const auto totalPages = (containerSize % pageSize) == 0
                                     ? (containerSize / pageSize)
                                     : (containerSize / pageSize) + 1;
 
-        m_valid = containerSize > (pageIndex * pageSize);
+        m_valid = pageIndex < totalPages;
 
         if(!m_valid)
-        {
-            m_json = QJsonObject{};
             return;
-        }
+
+        m_page = pageIndex + 1;
+        m_pageSize = pageSize;
+        m_totalPages = totalPages;
+        m_begin.emplace(container.ConstIteratorAt(pageIndex * pageSize));
+        auto iterator = m_begin.value();
+        m_firstKey = iterator.key();
+        for(; m_count < pageSize && iterator != container.constEnd(); ++m_count, ++iterator)
+            m_lastKey = iterator.key();
+    }
+
+    QJsonObject ToJSON() const
+    {
+        if(!m_valid)
+            return QJsonObject{};
 
         auto data = QJsonArray{};
-        auto iterator = container.begin();
-        std::advance(iterator, std::min(pageIndex * pageSize, containerSize)); //TODO
-        for(qsizetype i = 0; i < pageSize && iterator != container.end(); ++i, ++iterator)
-            data.push_back(iterator->ToJSON());
+        auto iterator = m_begin.value();
+        for(qsizetype i = 0; i < m_count; ++i, ++iterator)
+            data.push_back(ProjectedToJSON(*iterator, m_fields));
 
-        m_json = QJsonObject
+        return QJsonObject
         {
-            {"page", pageIndex + 1},
-            {"per_page", pageSize},
-            {"total", containerSize},
-            {"total_pages", totalPages},
+            {"page", m_page},
+            {"per_page", m_pageSize},
+            {"total", m_container.size()},
+            {"total_pages", m_totalPages},
             {"data", data}
         };
     }
 
+    //same document as ToJSON without building it first
+    template<typename Writer>
+    void WriteJSON(Writer &writer) const
+    {
+        writer.BeginObject();
+        if(m_valid)
+        {
+            writer.Key("page");
+            writer.Integer(m_page);
+            writer.Key("per_page");
+            writer.Integer(m_pageSize);
+            writer.Key("total");
+            writer.Integer(m_container.size());
+            writer.Key("total_pages");
+            writer.Integer(m_totalPages);
+            writer.Key("data");
+            writer.BeginArray();
+            auto iterator = m_begin.value();
+            for(qsizetype i = 0; i < m_count; ++i, ++iterator)
+                WriteProjectedItem(writer, *iterator, m_fields);
+            writer.EndArray();
+        }
+        writer.EndObject();
+    }
+
+    constexpr bool IsValid() const
+    {
+        return m_valid;
+    }
+
+    //key range of the page, used for cache invalidation
+    KeyType FirstKey() const
+    {
+        return m_firstKey;
+    }
+
+    KeyType LastKey() const
+    {
+        return m_lastKey;
+    }
+
+private:
+
+    const T &m_container;
+    FieldMask m_fields;
+    std::optional<ConstIterator> m_begin;
+    qsizetype m_count = 0;
+    qsizetype m_page = 0;
+    qsizetype m_pageSize = 0;
+    qsizetype m_totalPages = 0;
+    bool m_valid;
+    KeyType m_firstKey{};
+    KeyType m_lastKey{};
+};
+
+//keyset pagination, the page starts right after a key so no offset is ever walked
+//rendered on demand like PaginatedData
+template<typename T>
+class CursorPaginatedData : public JSONable
+{
+    using ConstIterator = typename T::const_iterator;
+
+public:
+
+    using KeyType = typename T::key_type;
+
+    explicit CursorPaginatedData(const T &container, const std::optional<KeyType> &afterKey, qsizetype size,
+                                 FieldMask fields = ALL_FIELDS) :
+        m_container(container),
+        m_fields(fields),
+        m_size(size)
+    {
+        m_begin = afterKey.has_value()
+            ? container.upperBound(afterKey.value())
+            : container.constBegin();
+
+        m_valid = m_begin != container.constEnd();
+
+        if(!m_valid)
+            return;
+
+        auto iterator = m_begin;
+        m_firstKey = iterator.key();
+        for(; m_count < size && iterator != container.constEnd(); ++m_count, ++iterator)
+            m_lastKey = iterator.key();
+        m_hasNext = iterator != container.constEnd();
+    }
+
+    static QString EncodeCursor(const KeyType &key)
+    {
+        return QString::fromLatin1(QByteArray::number(key)
+                                       .toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals));
+    }
+
+    static std::optional<KeyType> DecodeCursor(const QString &cursor)
+    {
+        const auto decoded = QByteArray::fromBase64Encoding(cursor.toLatin1(), QByteArray::Base64UrlEncoding);
+        if(!decoded)
+            return std::nullopt;
+
+        auto ok = false;
+        const auto key = static_cast<KeyType>(decoded.decoded.toLongLong(&ok));
+        if(!ok)
+            return std::nullopt;
+
+        return key;
+    }
+
     QJsonObject ToJSON() const
     {
-        return m_json;
+        if(!m_valid)
+            return QJsonObject{};
+
+        auto data = QJsonArray{};
+        auto iterator = m_begin;
+        for(qsizetype i = 0; i < m_count; ++i, ++iterator)
+            data.push_back(ProjectedToJSON(*iterator, m_fields));
+
+        return QJsonObject
+        {
+            {"per_page", m_size},
+            {"total", m_container.size()},
+            {"data", data},
+            {"next_cursor", m_hasNext
+                                ? QJsonValue(EncodeCursor(m_lastKey))
+                                : QJsonValue(QJsonValue::Null)}
+        };
+    }
+
+    template<typename Writer>
+    void WriteJSON(Writer &writer) const
+    {
+        writer.BeginObject();
+        if(m_valid)
+        {
+            writer.Key("per_page");
+            writer.Integer(m_size);
+            writer.Key("total");
+            writer.Integer(m_container.size());
+            writer.Key("data");
+            writer.BeginArray();
+            auto iterator = m_begin;
+            for(qsizetype i = 0; i < m_count; ++i, ++iterator)
+                WriteProjectedItem(writer, *iterator, m_fields);
+            writer.EndArray();
+            writer.Key("next_cursor");
+            if(m_hasNext)
+                writer.String(EncodeCursor(m_lastKey));
+            else
+                writer.Null();
+        }
+        writer.EndObject();
     }
 
     constexpr bool IsValid() const
@@ -407,10 +1212,28 @@ public:
         return m_valid;
     }
 
+    //key range of the page, used for cache invalidation
+    KeyType FirstKey() const
+    {
+        return m_firstKey;
+    }
+
+    KeyType LastKey() const
+    {
+        return m_lastKey;
+    }
+
 private:
 
-    QJsonObject m_json;
+    const T &m_container;
+    FieldMask m_fields;
+    ConstIterator m_begin;
+    qsizetype m_size;
+    qsizetype m_count = 0;
+    bool m_hasNext = false;
     bool m_valid;
+    KeyType m_firstKey{};
+    KeyType m_lastKey{};
 };
 
 #endif // STRUCTS_HPP
@@ -0,0 +1,115 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include<QFuture>
+#include<QPromise>
+#include<QTimer>
+#include<QHttpServerResponse>
+#include<functional>
+#include<memory>
+#include<vector>
+
+#include"APIUtility.hpp"
+
+//hashed timer wheel driven by one timer of the owning thread's event loop
+//pending callbacks cost a slot entry each, no thread is held while they wait
+class TimerWheel
+{
+public:
+
+    static constexpr qint64 TICK_MS = 50;
+    static constexpr qint64 SLOT_COUNT = 512;
+
+    //every server thread runs its own event loop, so every thread gets its own wheel
+    static TimerWheel &ForCurrentThread()
+    {
+        thread_local auto wheel = TimerWheel{};
+        return wheel;
+    }
+
+    void Schedule(qint64 delayMs, std::function<void()> callback)
+    {
+        const auto ticks = qMax(qint64{1}, (delayMs + TICK_MS - 1) / TICK_MS);
+        const auto slot = (m_cursor + ticks) % SLOT_COUNT;
+        m_slots[slot].push_back(Entry{(ticks - 1) / SLOT_COUNT, std::move(callback)});
+
+        if(m_pending++ == 0)
+            m_timer.start();
+    }
+
+    qsizetype Pending() const
+    {
+        return m_pending;
+    }
+
+private:
+
+    struct Entry
+    {
+        qint64 rounds;
+        std::function<void()> callback;
+    };
+
+    TimerWheel() :
+        m_slots(SLOT_COUNT)
+    {
+        m_timer.setInterval(TICK_MS);
+        m_timer.setTimerType(Qt::PreciseTimer);
+        QObject::connect(&m_timer, &QTimer::timeout, [this](){ Tick(); });
+    }
+
+    void Tick()
+    {
+        m_cursor = (m_cursor + 1) % SLOT_COUNT;
+
+        auto due = std::vector<std::function<void()>>{};
+        auto &slot = m_slots[m_cursor];
+        for(auto entry = slot.begin(); entry != slot.end();)
+        {
+            if(entry->rounds-- > 0)
+            {
+                ++entry;
+                continue;
+            }
+            due.push_back(std::move(entry->callback));
+            entry = slot.erase(entry);
+        }
+
+        m_pending -= due.size();
+        if(m_pending == 0)
+            m_timer.stop();
+
+        //run after the bookkeeping so callbacks may schedule again
+        for(const auto &callback: due)
+            callback();
+    }
+
+    std::vector<std::vector<Entry>> m_slots;
+    qint64 m_cursor = 0;
+    qsizetype m_pending = 0;
+    QTimer m_timer;
+};
+
+//the response is only built when the delay elapses, on the thread that scheduled it
+template<typename Function>
+static QFuture<QHttpServerResponse> DelayedResponse(qint64 delayMs, Function makeResponse)
+{
+    if(delayMs <= 0)
+        return ReadyResponse(makeResponse());
+
+    auto promise = std::make_shared<QPromise<QHttpServerResponse>>();
+    auto future = promise->future();
+    promise->start();
+    TimerWheel::ForCurrentThread().Schedule
+        (
+            delayMs,
+            [promise, makeResponse]()
+            {
+                promise->addResult(makeResponse());
+                promise->finish();
+            }
+        );
+    return future;
+}
+
+#endif // TIMERWHEEL_HPP
@@ -2,6 +2,7 @@
 #define UTILITY_HPP
 
 #include<type_traits>
+#include<atomic>
 
 template<bool B, typename T = void>
 using enable_if_t = typename std::enable_if<B, T>::type; //where
@@ -9,5 +10,35 @@ using enable_if_t = typename std::enable_if<B, T>::type; //where
 template<typename Base, typename Derived>
 inline constexpr bool is_base_of_v = std::is_base_of<Base, Derived>::value;
 
+//per type id counter, ids restored from disk are reserved so new ones never collide
+template<typename T>
+struct IdSequence
+{
+    static long long Next()
+    {
+        return Counter().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void Reserve(long long id)
+    {
+        auto current = Counter().load(std::memory_order_relaxed);
+        while(current <= id && !Counter().compare_exchange_weak(current, id + 1, std::memory_order_relaxed))
+        {}
+    }
+
+    //ids start at 1, everything below the next one was handed out
+    static bool Issued(long long id)
+    {
+        return id >= 1 && id < Counter().load(std::memory_order_relaxed);
+    }
+
+private:
+
+    static std::atomic<long long> &Counter()
+    {
+        static auto counter = std::atomic<long long>{1};
+        return counter;
+    }
+};
 
 #endif // UTILITY_HPP
@@ -0,0 +1,436 @@
+#ifndef WRITEAHEADLOG_HPP
+#define WRITEAHEADLOG_HPP
+
+#include<QDir>
+#include<QFile>
+#include<QJsonDocument>
+#include<QMutex>
+#include<QSaveFile>
+#include<QThread>
+#include<QWaitCondition>
+#include<cstring>
+#include<functional>
+#include<map>
+
+#ifdef Q_OS_WIN
+#include<io.h>
+#else
+#include<unistd.h>
+#endif
+
+#include"BinarySnapshot.hpp"
+
+//ids nested in an item that its factory hands out fresh, put back from the persisted json
+template<typename T>
+struct PersistedIds
+{
+    static void Restore(T &, const QJsonObject &)
+    {}
+};
+
+//answers are logged in order, graded games refer to them by id
+template<>
+struct PersistedIds<Question>
+{
+    static void Restore(Question &question, const QJsonObject &json)
+    {
+        const auto answers = json.value("answers").toArray();
+        if(answers.size() != question.answers.size())
+            return;
+
+        for(qsizetype i = 0; i < answers.size(); ++i)
+        {
+            const auto answer = answers.at(i).toObject();
+            if(!answer.contains("id"))
+                continue;
+            question.answers[i].id = answer.value("id").toInteger();
+            IdSequence<Answer>::Reserve(question.answers[i].id);
+        }
+    }
+};
+
+//item from its persisted json, keeping the persisted ids
+template<typename K = qint64, typename T = void>
+static std::optional<T> RestoreItem(const FactoryFromJSON<T> &factory, const QJsonObject &json)
+{
+    if(!json.contains("id"))
+        return std::nullopt;
+
+    auto optionalItem = factory.FromJSON(json);
+    if(!optionalItem.has_value())
+        return std::nullopt;
+
+    optionalItem.value().id = static_cast<K>(json.value("id").toInteger());
+    IdSequence<T>::Reserve(optionalItem.value().id);
+    PersistedIds<T>::Restore(optionalItem.value(), json);
+    return optionalItem;
+}
+
+//append-only log of CRUD mutations
+//records are framed as [length][fnv-1a checksum][compact json], a torn tail is dropped on replay
+//a single writer thread drains every record queued since its last fsync and makes them durable with one fsync
+//a log that cannot be opened, written or synced is failed: waiters are told nothing reached disk
+//and nothing more is queued until the process restarts and recovers it
+class WriteAheadLog
+{
+public:
+
+    static constexpr qint64 DEFAULT_COMPACT_EVERY = 4096;
+
+    struct Options
+    {
+        bool groupCommit = true;
+        qint64 compactEvery = DEFAULT_COMPACT_EVERY;
+    };
+
+    explicit WriteAheadLog(const QString &directory, const QString &name, Options options = Options{}) :
+        m_logPath(QDir(directory).filePath(name + ".wal")),
+        m_snapshotPath(QDir(directory).filePath(name + ".snapshot")),
+        m_options(options)
+    {
+        QDir().mkpath(directory);
+    }
+
+    ~WriteAheadLog()
+    {
+        {
+            auto locker = QMutexLocker(&m_mutex);
+            m_stopping = true;
+            m_wakeWriter.wakeOne();
+        }
+        if(m_writer)
+            m_writer->wait();
+    }
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    //snapshot replaces the initial data when present, then the log is replayed on top
+    template<typename K = qint64, typename T = void>
+    IdMap<K, T> Recover(const FactoryFromJSON<T> &factory, const IdMap<K, T> &initial)
+    {
+        auto data = QFile::exists(m_snapshotPath)
+            ? LoadSnapshot<K, T>(factory, m_snapshotPath)
+            : initial;
+
+        const auto replayed = Replay([&factory, &data](const QJsonObject &record)
+        {
+            const auto id = static_cast<K>(record.value("id").toInteger());
+            if(record.value("op").toString() == "delete")
+            {
+                data.remove(id);
+                return;
+            }
+            const auto optionalItem = RestoreItem<K, T>(factory, record.value("item").toObject());
+            if(optionalItem.has_value())
+                data.insert(optionalItem.value().id, optionalItem.value());
+        });
+        qDebug() << "Recovered" << data.size() << "items," << replayed << "log records from" << m_logPath;
+
+        Start();
+        return data;
+    }
+
+    //binary snapshots are mapped, json ones are what types without a BinaryCodec compact to
+    template<typename K = qint64, typename T = void>
+    static IdMap<K, T> LoadSnapshot(const FactoryFromJSON<T> &factory, const QString &path)
+    {
+        auto file = QFile{path};
+        if(!file.open(QIODevice::ReadOnly))
+            return IdMap<K, T>{};
+
+        if(IsBinarySnapshot(file.peek(sizeof(SNAPSHOT_MAGIC))))
+        {
+            if constexpr(BinaryCodec<T>::Supported)
+                return MappedSnapshot<K, T>(path).ToIdMap();
+            else
+                return IdMap<K, T>{};
+        }
+
+        auto data = IdMap<K, T>{};
+        for(const auto &json: QJsonDocument::fromJson(file.readAll()).array())
+        {
+            const auto optionalItem = RestoreItem<K, T>(factory, json.toObject());
+            if(optionalItem.has_value())
+                data.insert(optionalItem.value().id, optionalItem.value());
+        }
+        return data;
+    }
+
+    //returns the sequence number the caller can wait on
+    quint64 Append(const QString &op, qint64 id, const QJsonObject &item = QJsonObject{})
+    {
+        auto record = QJsonObject{{"op", op}, {"id", id}};
+        if(!item.isEmpty())
+            record.insert("item", item);
+
+        auto locker = QMutexLocker(&m_mutex);
+        if(m_failed)
+            return ++m_appended;
+        m_queue.push_back(Command{++m_appended, QJsonDocument(record).toJson(QJsonDocument::Compact), {}});
+        ++m_sinceCompaction;
+        m_wakeWriter.wakeOne();
+        return m_appended;
+    }
+
+    quint64 LastSequence() const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        return m_appended;
+    }
+
+    //callback runs on the writer thread once everything up to sequence is on disk, with false when the log failed first
+    void WhenDurable(quint64 sequence, std::function<void(bool)> callback)
+    {
+        auto durable = true;
+        {
+            auto locker = QMutexLocker(&m_mutex);
+            if(sequence > m_durable && !m_failed)
+            {
+                m_waiters.emplace(sequence, std::move(callback));
+                return;
+            }
+            durable = sequence <= m_durable;
+        }
+        callback(durable);
+    }
+
+    bool Failed() const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        return m_failed;
+    }
+
+    bool CompactionDue() const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        return m_sinceCompaction >= m_options.compactEvery;
+    }
+
+    //must be queued while mutations are excluded so the snapshot matches the log position
+    //serialization itself runs later on the writer thread
+    void Compact(std::function<QByteArray()> serializeSnapshot)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        if(m_failed)
+            return;
+        m_queue.push_back(Command{m_appended, QByteArray{}, std::move(serializeSnapshot)});
+        m_sinceCompaction = 0;
+        m_wakeWriter.wakeOne();
+    }
+
+    qint64 FsyncCount() const
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        return m_fsyncs;
+    }
+
+private:
+
+    struct Command
+    {
+        quint64 sequence;
+        QByteArray record;
+        std::function<QByteArray()> snapshot;
+    };
+
+    static quint32 Checksum(const QByteArray &bytes)
+    {
+        auto hash = quint32{2166136261u};
+        for(const auto byte: bytes)
+        {
+            hash ^= static_cast<quint8>(byte);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    static bool SyncToDisk(QFile &file)
+    {
+        if(!file.flush())
+            return false;
+#ifdef Q_OS_WIN
+        return _commit(file.handle()) == 0;
+#else
+        return ::fsync(file.handle()) == 0;
+#endif
+    }
+
+    //valid prefix of the log is applied, anything after the first bad frame is cut off
+    qint64 Replay(const std::function<void(const QJsonObject &)> &apply)
+    {
+        auto file = QFile{m_logPath};
+        if(!file.open(QIODevice::ReadWrite))
+            return 0;
+
+        auto count = qint64{0};
+        auto validEnd = qint64{0};
+        const auto bytes = file.readAll();
+        while(validEnd + 8 <= bytes.size())
+        {
+            auto length = quint32{};
+            auto checksum = quint32{};
+            memcpy(&length, bytes.constData() + validEnd, sizeof(length));
+            memcpy(&checksum, bytes.constData() + validEnd + 4, sizeof(checksum));
+            if(validEnd + 8 + length > bytes.size())
+                break;
+
+            const auto record = bytes.mid(validEnd + 8, length);
+            if(Checksum(record) != checksum)
+                break;
+
+            const auto json = QJsonDocument::fromJson(record);
+            if(!json.isObject())
+                break;
+
+            apply(json.object());
+            validEnd += 8 + length;
+            ++count;
+        }
+
+        if(validEnd != bytes.size())
+        {
+            qDebug() << "Dropping" << bytes.size() - validEnd << "bytes of torn log tail at offset" << validEnd;
+            file.resize(validEnd);
+        }
+        return count;
+    }
+
+    void Start()
+    {
+        m_file.setFileName(m_logPath);
+        if(!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+        {
+            qDebug() << "Opening log" << m_logPath << "failed";
+            auto locker = QMutexLocker(&m_mutex);
+            m_failed = true;
+            return;
+        }
+
+        m_writer.reset(QThread::create([this](){ Run(); }));
+        m_writer->start();
+    }
+
+    void Run()
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        while(true)
+        {
+            while(m_queue.empty() && !m_stopping)
+                m_wakeWriter.wait(&m_mutex);
+            if(m_queue.empty())
+                break;
+
+            //group commit takes the whole queue, otherwise one record per fsync
+            auto batch = std::vector<Command>{};
+            if(m_options.groupCommit)
+                batch.swap(m_queue);
+            else
+            {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.erase(m_queue.begin());
+            }
+            locker.unlock();
+
+            //written is the last record handed to the file, synced the last one an fsync covered
+            auto written = quint64{0};
+            auto synced = quint64{0};
+            auto healthy = true;
+            for(auto &command: batch)
+            {
+                if(command.snapshot)
+                    healthy = SyncBatch(written, synced) && WriteSnapshot(command.snapshot());
+                else
+                {
+                    healthy = WriteRecord(command.record);
+                    if(healthy)
+                        written = command.sequence;
+                }
+                if(!healthy)
+                    break;
+            }
+            healthy = healthy && SyncBatch(written, synced);
+
+            locker.relock();
+            m_durable = qMax(m_durable, synced);
+            if(!healthy)
+            {
+                //records after the failed one would follow a gap, they are dropped with their waiters
+                qDebug() << "Log" << m_logPath << "failed, mutations are rejected until it is recovered";
+                m_failed = true;
+                m_queue.clear();
+            }
+            auto ready = std::vector<std::pair<std::function<void(bool)>, bool>>{};
+            while(!m_waiters.empty() && (m_waiters.begin()->first <= m_durable || m_failed))
+            {
+                ready.emplace_back(std::move(m_waiters.begin()->second), m_waiters.begin()->first <= m_durable);
+                m_waiters.erase(m_waiters.begin());
+            }
+            locker.unlock();
+
+            for(const auto &[callback, durable]: ready)
+                callback(durable);
+            locker.relock();
+        }
+    }
+
+    bool WriteRecord(const QByteArray &record)
+    {
+        const auto length = static_cast<quint32>(record.size());
+        const auto checksum = Checksum(record);
+        return m_file.write(reinterpret_cast<const char *>(&length), sizeof(length)) == sizeof(length)
+               && m_file.write(reinterpret_cast<const char *>(&checksum), sizeof(checksum)) == sizeof(checksum)
+               && m_file.write(record) == record.size();
+    }
+
+    //makes everything written so far durable, nothing to do when the last fsync already covered it
+    bool SyncBatch(quint64 written, quint64 &synced)
+    {
+        if(written == synced)
+            return true;
+        if(!SyncToDisk(m_file))
+        {
+            qDebug() << "fsync of" << m_logPath << "failed";
+            return false;
+        }
+        synced = written;
+
+        auto locker = QMutexLocker(&m_mutex);
+        ++m_fsyncs;
+        return true;
+    }
+
+    //snapshot is committed atomically before the log it replaces is truncated
+    //a snapshot that cannot be written only keeps the log longer, a log that cannot be truncated is failed
+    bool WriteSnapshot(const QByteArray &snapshot)
+    {
+        auto file = QSaveFile{m_snapshotPath};
+        if(!file.open(QIODevice::WriteOnly) || file.write(snapshot) != snapshot.size() || !file.commit())
+        {
+            qDebug() << "Writing snapshot" << m_snapshotPath << "failed, keeping the log";
+            return true;
+        }
+
+        return m_file.resize(0) && SyncToDisk(m_file);
+    }
+
+    const QString m_logPath;
+    const QString m_snapshotPath;
+    const Options m_options;
+
+    QFile m_file;
+    std::unique_ptr<QThread> m_writer;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeWriter;
+    std::vector<Command> m_queue;
+    std::multimap<quint64, std::function<void(bool)>> m_waiters;
+    quint64 m_appended = 0;
+    quint64 m_durable = 0;
+    qint64 m_sinceCompaction = 0;
+    qint64 m_fsyncs = 0;
+    bool m_stopping = false;
+    bool m_failed = false;
+};
+
+#endif // WRITEAHEADLOG_HPP
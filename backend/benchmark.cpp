@@ -0,0 +1,1076 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSemaphore>
+#include <QTemporaryDir>
+#include <QThread>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include"HeadlessServer.hpp"
+
+//microbenchmarks of the request hot paths on synthetic data
+//every result is one json object per line on stdout:
+//{"suite", "name", "items", "iterations", "ns_per_op", "ops_per_s", ...extra fields}
+//usage: RESTAPIServerBenchmark [--filter <suite/name part>] [--max-items <n>] [--min-time-ms <n>]
+
+struct BenchmarkOptions
+{
+    QString filter;
+    qint64 maxItems = 1000000;
+    qint64 minTimeMs = 200;
+};
+
+static BenchmarkOptions options;
+
+//results flow into here so the measured work cannot be optimized away
+static volatile qint64 sink = 0;
+
+static void Keep(qint64 value)
+{
+    sink = sink + value;
+}
+
+static bool Selected(const QString &suite, const QString &name)
+{
+    return options.filter.isEmpty() || QString("%1/%2").arg(suite, name).contains(options.filter, Qt::CaseInsensitive);
+}
+
+static void Report(const QString &suite, const QString &name, qint64 items, qint64 iterations, qint64 elapsedNs, const QJsonObject &extra = QJsonObject{})
+{
+    auto line = QJsonObject
+        {
+            {"suite", suite},
+            {"name", name},
+            {"items", items},
+            {"iterations", iterations},
+            {"ns_per_op", iterations > 0 ? double(elapsedNs) / iterations : 0.0},
+            {"ops_per_s", elapsedNs > 0 ? iterations * 1e9 / elapsedNs : 0.0}
+        };
+    for(auto field = extra.constBegin(); field != extra.constEnd(); ++field)
+        line.insert(field.key(), field.value());
+
+    fputs(QJsonDocument(line).toJson(QJsonDocument::Compact).append('\n').constData(), stdout);
+    fflush(stdout);
+}
+
+//repeats operation until the minimum time is spent, the first run is the warm-up
+//unless it alone already takes the minimum time
+template<typename Function>
+static void Measure(const QString &suite, const QString &name, qint64 items, Function &&operation, const QJsonObject &extra = QJsonObject{})
+{
+    if(!Selected(suite, name))
+        return;
+
+    auto timer = QElapsedTimer{};
+    timer.start();
+    operation();
+    const auto warmUpNs = timer.nsecsElapsed();
+    if(warmUpNs >= options.minTimeMs * 1000000)
+    {
+        Report(suite, name, items, 1, warmUpNs, extra);
+        return;
+    }
+
+    auto iterations = qint64{0};
+    timer.restart();
+    do
+    {
+        operation();
+        ++iterations;
+    }
+    while(timer.nsecsElapsed() < options.minTimeMs * 1000000);
+    Report(suite, name, items, iterations, timer.nsecsElapsed(), extra);
+}
+
+//for work that consumes its input, setup runs untimed before every round
+//and one round counts as operationsPerRound operations
+template<typename Setup, typename Function>
+static void MeasureRounds(const QString &suite, const QString &name, qint64 items, qint64 operationsPerRound,
+                          Setup &&setup, Function &&operation, const QJsonObject &extra = QJsonObject{})
+{
+    if(!Selected(suite, name))
+        return;
+
+    auto elapsedNs = qint64{0};
+    auto rounds = qint64{0};
+    auto timer = QElapsedTimer{};
+    while(rounds == 0 || elapsedNs < options.minTimeMs * 1000000)
+    {
+        setup();
+        timer.start();
+        operation();
+        elapsedNs += timer.nsecsElapsed();
+        ++rounds;
+    }
+    Report(suite, name, items, rounds * operationsPerRound, elapsedNs, extra);
+}
+
+static QList<qint64> Sizes(qint64 from = 10)
+{
+    auto sizes = QList<qint64>{};
+    for(auto size = from; size <= options.maxItems; size *= 10)
+        sizes.append(size);
+    return sizes;
+}
+
+static Category MakeCategory(qint64 index)
+{
+    return Category(QString("Category %1").arg(index % 16), QUrl(QString("https://example.com/icons/%1.png").arg(index % 16)));
+}
+
+//four answers drawn from a small vocabulary, the first one is right
+static QList<Answer> MakeAnswers(qint64 index)
+{
+    auto answers = QList<Answer>{};
+    for(auto i = 0; i < 4; ++i)
+        answers.append(Answer(QString::number((index + i) % 100), i == 0));
+    return answers;
+}
+
+//questions refer to 16 categories, put into the directory the way the category store's listener does
+static qint64 SharedCategoryId(qint64 index)
+{
+    static const auto ids = []()
+    {
+        auto ids = QList<qint64>{};
+        for(auto i = 0; i < 16; ++i)
+        {
+            const auto category = MakeCategory(i);
+            CategoryDirectory::Instance().Apply(category.id, &category);
+            ids.append(category.id);
+        }
+        return ids;
+    }();
+    return ids.at(index % 16);
+}
+
+static Question MakeQuestion(qint64 index, qint64 categories = 16)
+{
+    return Question(QString("Synthetic question number %1?").arg(index), SharedCategoryId(index % categories), ToAnswerRecords(MakeAnswers(index)).value());
+}
+
+template<typename T, typename Make>
+static QList<T> MakeList(qint64 count, Make make)
+{
+    auto list = QList<T>{};
+    list.reserve(count);
+    for(auto i = qint64{0}; i < count; ++i)
+        list.append(make(i));
+    return list;
+}
+
+template<typename T>
+static IdMap<qint64, T> MakeIdMap(const QList<T> &list)
+{
+    auto data = IdMap<qint64, T>{};
+    for(const auto &item: list)
+        data.insert(item.id, item);
+    return data;
+}
+
+static QList<QPair<QByteArray, QByteArray>> MakeHeaders(qsizetype count, const QByteArray &token)
+{
+    auto headers = QList<QPair<QByteArray, QByteArray>>{};
+    for(qsizetype i = 0; i + 1 < count; ++i)
+        headers.append({QByteArray("X-Header-") + QByteArray::number(i), QByteArray("value ") + QByteArray::number(i)});
+    if(!token.isEmpty())
+        headers.append({"token", token});
+    return headers;
+}
+
+static void JSONBenchmarks()
+{
+    const auto suite = QString("json");
+    for(const auto size: Sizes())
+    {
+        const auto categories = MakeList<Category>(size, MakeCategory);
+        Measure(suite, "ToJSONArray<Category>", size, [&categories]()
+        {
+            Keep(ToJSONArray(categories).size());
+        });
+
+        const auto questions = MakeList<Question>(size, [](qint64 i){ return MakeQuestion(i); });
+        Measure(suite, "ToJSONArray<Question>", size, [&questions]()
+        {
+            Keep(ToJSONArray(questions).size());
+        });
+
+        const auto questionsJson = ToJSONArray(questions);
+        Measure(suite, "FromJSONArray<Question>", size, [&questionsJson]()
+        {
+            Keep(FromJSONArray<Question, QuestionFactory>(questionsJson).size());
+        });
+
+        Measure(suite, "IdMap<Question>(factory, array)", size, [&questionsJson]()
+        {
+            Keep(IdMap<qint64, Question>(QuestionFactory{}, questionsJson).size());
+        });
+
+        const auto bytes = QJsonDocument(questionsJson).toJson(QJsonDocument::Compact);
+        Measure(suite, "ByteArrayToJSONArray<Question>", size, [&bytes]()
+        {
+            Keep(ByteArrayToJSONArray(bytes).value_or(QJsonArray{}).size());
+        }, QJsonObject{{"bytes", bytes.size()}});
+    }
+
+    const auto question = MakeQuestion(0);
+    Measure(suite, "Question::ToJSON", 1, [&question]()
+    {
+        Keep(QJsonDocument(question.ToJSON()).toJson(QJsonDocument::Compact).size());
+    });
+
+    auto buffer = QByteArray{};
+    Measure(suite, "JSONWriter Question", 1, [&question, &buffer]()
+    {
+        buffer.resize(0);
+        JSONWriter(buffer).Write(question);
+        Keep(buffer.size());
+    });
+
+    //one page of 100 questions, through the json tree and written directly
+    const auto pageSize = qint64{100};
+    const auto questions = MakeIdMap(MakeList<Question>(pageSize, [](qint64 i){ return MakeQuestion(i); }));
+    Measure(suite, "PaginatedData<Question> QJsonDocument", pageSize, [&questions, pageSize]()
+    {
+        Keep(QJsonDocument(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize}.ToJSON()).toJson(QJsonDocument::Compact).size());
+    });
+
+    Measure(suite, "PaginatedData<Question> JSONWriter", pageSize, [&questions, &buffer, pageSize]()
+    {
+        buffer.resize(0);
+        JSONWriter(buffer).Write(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize});
+        Keep(buffer.size());
+    });
+
+    Measure(suite, "CachedPayload::FromValue PaginatedData<Question>", pageSize, [&questions, pageSize]()
+    {
+        Keep(CachedPayload::FromValue(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize}).body.size());
+    });
+}
+
+static void ParserBenchmarks()
+{
+    const auto suite = QString("parser");
+    auto question = MakeQuestion(0).ToJSON();
+    question.insert("questionText", QString("Wie heißt die Hauptstadt von \"Österreich\"?\n\u00e9\U0001F600"));
+    auto longQuestion = question;
+    longQuestion.insert("questionText", QString("long question text ").repeated(4096));
+    auto unknownMembers = question;
+    unknownMembers.insert("client", QJsonObject{{"platform", "android"}, {"history", ToJSONArray(MakeList<Category>(64, MakeCategory))}});
+
+    const auto bodies = QList<QPair<QString, QByteArray>>
+        {
+            {"question", QJsonDocument(question).toJson(QJsonDocument::Compact)},
+            {"question, indented", QJsonDocument(question).toJson(QJsonDocument::Indented)},
+            {"question with long text", QJsonDocument(longQuestion).toJson(QJsonDocument::Compact)},
+            {"question with unknown members", QJsonDocument(unknownMembers).toJson(QJsonDocument::Compact)}
+        };
+
+    for(const auto &[name, body]: bodies)
+    {
+        Measure(suite, QString("ByteArrayToJSONObject %1").arg(name), 1, [&body = body]()
+        {
+            Keep(ByteArrayToJSONObject(body).value_or(QJsonObject{}).size());
+        }, QJsonObject{{"bytes", body.size()}});
+
+        Measure(suite, QString("ByteArrayToBodyFields<Question> %1").arg(name), 1, [&body = body]()
+        {
+            Keep(ByteArrayToBodyFields<Question>(body).value_or(QJsonObject{}).size());
+        }, QJsonObject{{"bytes", body.size()}});
+    }
+}
+
+//a stable page compressed once, then served from the cache in the negotiated coding
+static void CompressionBenchmarks()
+{
+    const auto suite = QString("compression");
+    const auto questions = MakeIdMap(MakeList<Question>(1000, [](qint64 i){ return MakeQuestion(i); }));
+    auto cache = ResponseCache<qint64>{};
+    for(const auto perPage: {qint64{8}, qint64{100}})
+    {
+        const auto payload = CachedPayload::FromValue(PaginatedData<IdMap<qint64, Question>>{questions, 1, perPage});
+        for(const auto encoding: {ContentEncoding::Deflate, ContentEncoding::Gzip, ContentEncoding::Zstd})
+        {
+            if(!EncodingSupported(encoding))
+                continue;
+
+            const auto compressed = Compress(payload.body, encoding).value_or(QByteArray{});
+            const auto extra = QJsonObject
+                {
+                    {"bytes", payload.body.size()},
+                    {"compressed_bytes", compressed.size()},
+                    {"ratio", compressed.isEmpty() ? 1.0 : double(payload.body.size()) / compressed.size()}
+                };
+            Measure(suite, QString("Compress %1 page of %2 questions").arg(QString::fromLatin1(EncodingName(encoding))).arg(perPage), perPage, [&payload, encoding]()
+            {
+                Keep(Compress(payload.body, encoding).value_or(QByteArray{}).size());
+            }, extra);
+
+            const auto acceptEncoding = EncodingName(encoding);
+            Measure(suite, QString("ResponseCache::Respond %1 page of %2 questions").arg(QString::fromLatin1(EncodingName(encoding))).arg(perPage), perPage,
+                    [&cache, &payload, &acceptEncoding]()
+            {
+                Keep(int(cache.Respond(payload, QByteArray{}, acceptEncoding).statusCode()));
+            }, extra);
+        }
+
+        Measure(suite, QString("ResponseCache::Respond identity page of %1 questions").arg(perPage), perPage, [&cache, &payload]()
+        {
+            Keep(int(cache.Respond(payload, QByteArray{}, QByteArray{}).statusCode()));
+        }, QJsonObject{{"bytes", payload.body.size()}});
+    }
+}
+
+//the same page and body in both wire formats, sizes go into the extra fields
+static void WireFormatBenchmarks()
+{
+    const auto suite = QString("wire");
+    const auto pageSize = qint64{100};
+    const auto questions = MakeIdMap(MakeList<Question>(pageSize, [](qint64 i){ return MakeQuestion(i); }));
+    const auto question = MakeQuestion(0).ToJSON();
+    const auto formats = {qMakePair(QString("json"), WireFormat::JSON), qMakePair(QString("cbor"), WireFormat::CBOR)};
+
+    for(const auto &[name, format]: formats)
+    {
+        const auto page = CachedPayload::FromValue(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize}, format);
+        Measure(suite, QString("encode page of %1 questions %2").arg(pageSize).arg(name), pageSize, [&questions, pageSize, format = format]()
+        {
+            Keep(CachedPayload::FromValue(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize}, format).body.size());
+        }, QJsonObject{{"bytes", page.body.size()}});
+
+        Measure(suite, QString("decode page of %1 questions %2").arg(pageSize).arg(name), pageSize, [&page, format = format]()
+        {
+            if(format == WireFormat::CBOR)
+                Keep(QCborValue::fromCbor(page.body).toMap().size());
+            else
+                Keep(QJsonDocument::fromJson(page.body).object().size());
+        }, QJsonObject{{"bytes", page.body.size()}});
+
+        const auto body = format == WireFormat::CBOR
+            ? QCborValue::fromJsonValue(question).toCbor()
+            : QJsonDocument(question).toJson(QJsonDocument::Compact);
+        Measure(suite, QString("BodyToJSONObject<Question> %1").arg(name), 1, [&body, format = format]()
+        {
+            Keep(BodyToJSONObject<Question>(body, format).value_or(QJsonObject{}).size());
+        }, QJsonObject{{"bytes", body.size()}});
+    }
+}
+
+//a lobby page with and without a sparse fieldset, and filtered pages against a client side scan of every page
+static void ListQueryBenchmarks()
+{
+    const auto suite = QString("list query");
+    const auto pageSize = qint64{100};
+    const auto lobbyFields = FieldMaskOf<Question>({"id", "questionText"}).value();
+    for(const auto size: Sizes(1000))
+    {
+        const auto questions = MakeIdMap(MakeList<Question>(size, [](qint64 i){ return MakeQuestion(i); }));
+        for(const auto &[name, fields]: {qMakePair(QString("all fields"), ALL_FIELDS), qMakePair(QString("fields=id,questionText"), lobbyFields)})
+        {
+            const auto bytes = CachedPayload::FromValue(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize, fields}).body.size();
+            Measure(suite, QString("page of %1 questions, %2").arg(pageSize).arg(name), size, [&questions, pageSize, fields = fields]()
+            {
+                Keep(CachedPayload::FromValue(PaginatedData<IdMap<qint64, Question>>{questions, 1, pageSize, fields}).body.size());
+            }, QJsonObject{{"bytes", bytes}});
+        }
+
+        //one of the 16 categories
+        const auto categoryId = questions.first().categoryId;
+        const auto filter = ItemFilter<Question>{categoryId, QString{}};
+        Measure(suite, QString("first page of category=<id>, server side"), size, [&questions, &filter, pageSize]()
+        {
+            const auto view = FilteredView<IdMap<qint64, Question>>{questions, [&filter](const Question &question){ return filter.Matches(question); }};
+            Keep(CachedPayload::FromValue(PaginatedData<FilteredView<IdMap<qint64, Question>>>{view, 1, pageSize}).body.size());
+        });
+
+        //what a client did before: fetch every page, parse it and keep the matching items
+        if(size <= 100000)
+        {
+            Measure(suite, QString("first page of category=<id>, client side scan"), size, [&questions, categoryId, pageSize]()
+            {
+                auto bytes = qint64{0};
+                auto matches = QJsonArray{};
+                for(auto page = qint64{1}; matches.size() < pageSize; ++page)
+                {
+                    const auto paginatedData = PaginatedData<IdMap<qint64, Question>>{questions, page, pageSize};
+                    if(!paginatedData.IsValid())
+                        break;
+                    const auto body = CachedPayload::FromValue(paginatedData).body;
+                    bytes += body.size();
+                    for(const auto &item: QJsonDocument::fromJson(body).object().value("data").toArray())
+                    {
+                        if(item.toObject().value("category").toObject().value("id").toInteger() == categoryId)
+                            matches.append(item);
+                    }
+                }
+                Keep(bytes + matches.size());
+            });
+        }
+    }
+}
+
+//the index is fed the way SearchAPI feeds it, words are in every text, numbers in one each
+static void SearchBenchmarks()
+{
+    const auto suite = QString("search");
+    const auto pageSize = qint64{8};
+    for(const auto size: Sizes(1000))
+    {
+        auto index = TextIndex{};
+        auto texts = QList<QString>{};
+        texts.reserve(size);
+        auto timer = QElapsedTimer{};
+        timer.start();
+        for(auto i = qint64{0}; i < size; ++i)
+        {
+            texts.append(MakeQuestion(i).questionText);
+            index.Apply(i, nullptr, &texts.last());
+        }
+        if(Selected(suite, "TextIndex build"))
+            Report(suite, "TextIndex build", size, size, timer.nsecsElapsed(),
+                   QJsonObject{{"terms", index.TermCount()}, {"posting_bytes", index.PostingBytes()}});
+
+        const auto rare = QString::number(size / 2);
+        const auto queries = QList<QPair<QString, QString>>
+            {
+                {QString("one word in every text, first page"), QString("question")},
+                {QString("one word in every text, middle page"), QString("question")},
+                {QString("common and rare word"), QString("number %1").arg(rare)},
+                {QString("prefix of numbers"), QString("number %1*").arg(rare.left(qMax(TextIndex::MIN_PREFIX_LENGTH, rare.size() - 2)))},
+                {QString("two words in every text"), QString("synthetic question")}
+            };
+        for(const auto &[name, query]: queries)
+        {
+            const auto offset = name.endsWith("middle page") ? size / 2 : 0;
+            const auto total = index.Search(query, offset, pageSize).value().total;
+            Measure(suite, QString("TextIndex::Search %1").arg(name), size, [&index, query = query, offset, pageSize]()
+            {
+                Keep(index.Search(query, offset, pageSize).value().total);
+            }, QJsonObject{{"query", query}, {"total", total}});
+        }
+
+        //rewording moves one text between two number terms, the shared words stay untouched
+        auto random = QRandomGenerator(size);
+        Measure(suite, "TextIndex::Apply reworded text", size, [&index, &texts, &random, size]()
+        {
+            const auto id = random.bounded(size);
+            auto text = QString("Synthetic question number %1?").arg(random.bounded(size));
+            index.Apply(id, &texts[id], &text);
+            texts[id] = std::move(text);
+        });
+    }
+}
+
+//what a lobby moves per change with a subscription, against one poll of the list it would otherwise repeat
+static void LiveBenchmarks()
+{
+    const auto suite = QString("live");
+    const auto categories = MakeIdMap(MakeList<Category>(16, MakeCategory));
+    const auto &before = categories.first();
+    auto after = before;
+    after.categoryText = "Renamed category";
+
+    const auto event = LiveFeed::EncodeEvent(1, after.id, &before, &after).toUtf8();
+    Measure(suite, "LiveFeed::EncodeEvent update of a category", 1, [&before, &after]()
+    {
+        Keep(LiveFeed::EncodeEvent(1, after.id, &before, &after).size());
+    }, QJsonObject{{"bytes", event.size()}});
+
+    const auto page = CachedPayload::FromValue(PaginatedData<IdMap<qint64, Category>>{categories, 1, categories.size()}).body;
+    Measure(suite, "poll of the category list", categories.size(), [&categories]()
+    {
+        Keep(CachedPayload::FromValue(PaginatedData<IdMap<qint64, Category>>{categories, 1, categories.size()}).body.size());
+    }, QJsonObject{{"bytes", page.size()}});
+}
+
+static void PagingBenchmarks()
+{
+    const auto suite = QString("paging");
+    for(const auto size: Sizes(100))
+    {
+        const auto data = MakeIdMap(MakeList<Category>(size, MakeCategory));
+        const auto lastPage = (size + PaginatedData<IdMap<qint64, Category>>::DEFAULT_PAGE_SIZE - 1) / PaginatedData<IdMap<qint64, Category>>::DEFAULT_PAGE_SIZE;
+        for(const auto &[name, page]: {qMakePair(QString("first"), qint64{1}), qMakePair(QString("middle"), lastPage / 2 + 1), qMakePair(QString("last"), lastPage)})
+        {
+            Measure(suite, QString("PaginatedData<IdMap<Category>> %1 page").arg(name), size, [&data, page = page]()
+            {
+                Keep(PaginatedData<IdMap<qint64, Category>>{data, page}.ToJSON().size());
+            });
+        }
+    }
+}
+
+static void AuthBenchmarks()
+{
+    const auto suite = QString("auth");
+    for(const auto size: Sizes())
+    {
+        auto sessions = IdMap<qint64, SessionEntry>{};
+        auto token = QByteArray{};
+        for(auto i = qint64{0}; i < size; ++i)
+        {
+            auto session = SessionEntry{};
+            session.StartSession();
+            sessions.insert(session.id, session);
+            if(i == size / 2)
+                token = session.token.value().toByteArray(QUuid::WithoutBraces);
+        }
+        const auto sessionApi = SessionAPI<qint64>{sessions, std::make_unique<SessionEntryFactory>()};
+
+        const auto known = MakeHeaders(8, token);
+        Measure(suite, "SessionAPI::Authorize known token", size, [&sessionApi, &known]()
+        {
+            Keep(sessionApi.Authorize(known));
+        });
+
+        const auto unknown = MakeHeaders(8, QUuid::createUuid().toByteArray(QUuid::WithoutBraces));
+        Measure(suite, "SessionAPI::Authorize unknown token", size, [&sessionApi, &unknown]()
+        {
+            Keep(sessionApi.Authorize(unknown));
+        });
+    }
+
+    for(const auto count: {1, 8, 32})
+    {
+        const auto headers = MakeHeaders(count, QUuid::createUuid().toByteArray(QUuid::WithoutBraces));
+        Measure(suite, "GetValueFromHeader last header", count, [&headers]()
+        {
+            Keep(GetValueFromHeader(headers, "Token").size());
+        });
+        Measure(suite, "GetValueFromHeader missing header", count, [&headers]()
+        {
+            Keep(GetValueFromHeader(headers, "If-None-Match").size());
+        });
+    }
+}
+
+//limiter cost on the request path, and how it holds up with every server loop hitting it at once
+static void AdmissionBenchmarks()
+{
+    const auto suite = QString("admission");
+    for(const auto &[name, rate]: {qMakePair(QString("admitted"), 1e9), qMakePair(QString("over the limit"), 1.0)})
+    {
+        auto limiter = RateLimiter{rate, 10};
+        auto client = quint64{0};
+        Measure(suite, QString("RateLimiter::Acquire one client, %1").arg(name), 1, [&limiter, &client]()
+        {
+            Keep(limiter.Acquire(client));
+        });
+
+        auto random = QRandomGenerator(1);
+        Measure(suite, QString("RateLimiter::Acquire 10000 clients, %1").arg(name), 10000, [&limiter, &random]()
+        {
+            Keep(limiter.Acquire(quint64(random.bounded(10000)) * 0x9e3779b97f4a7c15ull));
+        });
+    }
+
+    const auto name = QString("RateLimiter::Acquire concurrent clients");
+    if(!Selected(suite, name))
+        return;
+
+    const auto threadCount = qMax(2, QThread::idealThreadCount());
+    auto limiter = RateLimiter{1000, 100};
+    auto stop = std::atomic<bool>{false};
+    auto acquired = std::atomic<qint64>{0};
+    auto admitted = std::atomic<qint64>{0};
+    auto threads = std::vector<std::unique_ptr<QThread>>{};
+    auto timer = QElapsedTimer{};
+    timer.start();
+    for(auto i = 0; i < threadCount; ++i)
+    {
+        threads.emplace_back(QThread::create([&limiter, &stop, &acquired, &admitted, i]()
+        {
+            auto calls = qint64{0};
+            auto passed = qint64{0};
+            for(auto client = quint64(i); !stop.load(std::memory_order_relaxed); client = (client + 1) % 256)
+            {
+                passed += limiter.Acquire(client * 0x9e3779b97f4a7c15ull) == 0;
+                ++calls;
+            }
+            acquired.fetch_add(calls);
+            admitted.fetch_add(passed);
+        }));
+        threads.back()->start();
+    }
+
+    QThread::msleep(options.minTimeMs);
+    stop.store(true);
+    for(const auto &thread: threads)
+        thread->wait();
+    Report(suite, name, 256, acquired.load(), timer.nsecsElapsed(), QJsonObject{{"threads", threadCount}, {"admitted", admitted.load()}});
+}
+
+//readers keep taking snapshots and probing them while one writer keeps replacing items
+static void StoreBenchmarks()
+{
+    const auto suite = QString("store");
+    const auto name = QString("SnapshotStore concurrent read/write");
+    if(!Selected(suite, name))
+        return;
+
+    const auto readerCount = qMax(1, QThread::idealThreadCount() - 1);
+    for(const auto size: Sizes(1000))
+    {
+        auto store = SnapshotStore<qint64, Category>{MakeIdMap(MakeList<Category>(size, MakeCategory))};
+        const auto firstId = store.Read()->firstKey();
+
+        auto stop = std::atomic<bool>{false};
+        auto reads = std::atomic<qint64>{0};
+        auto writes = qint64{0};
+        auto readers = std::vector<std::unique_ptr<QThread>>{};
+        for(auto i = 0; i < readerCount; ++i)
+        {
+            readers.emplace_back(QThread::create([&store, &stop, &reads, firstId, size, i]()
+            {
+                auto local = qint64{0};
+                auto id = firstId + i;
+                while(!stop.load(std::memory_order_relaxed))
+                {
+                    const auto snapshot = store.Read();
+                    Keep(snapshot->contains(firstId + (id++ % size)));
+                    ++local;
+                }
+                reads.fetch_add(local);
+            }));
+            readers.back()->start();
+        }
+
+        auto timer = QElapsedTimer{};
+        timer.start();
+        while(timer.elapsed() < options.minTimeMs)
+        {
+            const auto id = firstId + writes % size;
+            store.Write([id](IdMap<qint64, Category> &data)
+            {
+                data.insert(id, MakeCategory(id));
+                return true;
+            });
+            ++writes;
+        }
+        stop.store(true);
+        for(const auto &reader: readers)
+            reader->wait();
+        const auto elapsedNs = timer.nsecsElapsed();
+
+        Report(suite, name + " reads", size, reads.load(), elapsedNs, QJsonObject{{"threads", readerCount}});
+        Report(suite, name + " writes", size, writes, elapsedNs, QJsonObject{{"threads", 1}});
+    }
+}
+
+//writers wait for durability of every append, as Commit does before responding
+static void LogBenchmarks()
+{
+    const auto suite = QString("wal");
+    const auto writerCount = 8;
+    for(const auto groupCommit: {true, false})
+    {
+        const auto name = QString("WriteAheadLog durable appends, %1").arg(groupCommit ? "group commit" : "fsync per write");
+        if(!Selected(suite, name))
+            continue;
+
+        auto directory = QTemporaryDir{};
+        auto log = WriteAheadLog{directory.path(), "benchmark", WriteAheadLog::Options{groupCommit, std::numeric_limits<qint64>::max()}};
+        log.Recover<qint64, Category>(CategoryFactory{}, IdMap<qint64, Category>{});
+        const auto item = MakeCategory(0).ToJSON();
+
+        auto stop = std::atomic<bool>{false};
+        auto appends = std::atomic<qint64>{0};
+        auto writers = std::vector<std::unique_ptr<QThread>>{};
+        auto timer = QElapsedTimer{};
+        timer.start();
+        for(auto i = 0; i < writerCount; ++i)
+        {
+            writers.emplace_back(QThread::create([&log, &stop, &appends, &item, i]()
+            {
+                auto durable = QSemaphore{};
+                while(!stop.load(std::memory_order_relaxed))
+                {
+                    log.WhenDurable(log.Append("update", i, item), [&durable](bool){ durable.release(); });
+                    durable.acquire();
+                    appends.fetch_add(1, std::memory_order_relaxed);
+                }
+            }));
+            writers.back()->start();
+        }
+
+        QThread::msleep(qMax<qint64>(options.minTimeMs, 1000));
+        stop.store(true);
+        for(const auto &writer: writers)
+            writer->wait();
+
+        Report(suite, name, writerCount, appends.load(), timer.nsecsElapsed(),
+               QJsonObject{{"fsyncs", log.FsyncCount()}, {"appends_per_fsync", double(appends.load()) / qMax<qint64>(1, log.FsyncCount())}});
+    }
+}
+
+//eager mode materializes every record, lazy mode maps the file and looks up a handful of ids
+static void SnapshotBenchmarks()
+{
+    const auto suite = QString("snapshot");
+    auto directory = QTemporaryDir{};
+    for(const auto size: Sizes(1000))
+    {
+        const auto data = MakeIdMap(MakeList<Question>(size, [](qint64 i){ return MakeQuestion(i); }));
+        const auto path = directory.filePath(QString("questions-%1.snapshot").arg(size));
+        WriteBinarySnapshot(data, path);
+        const auto bytes = QFileInfo(path).size();
+
+        Measure(suite, "MappedSnapshot open + ToIdMap (eager)", size, [&path]()
+        {
+            Keep(MappedSnapshot<qint64, Question>(path).ToIdMap().size());
+        }, QJsonObject{{"bytes", bytes}});
+
+        const auto ids = QList<qint64>{data.firstKey(), data.lastKey(), data.ConstIteratorAt(size / 2).key()};
+        Measure(suite, "MappedSnapshot open + Find (lazy)", size, [&path, &ids]()
+        {
+            const auto snapshot = MappedSnapshot<qint64, Question>(path);
+            for(const auto id: ids)
+                Keep(snapshot.Find(id).has_value());
+        }, QJsonObject{{"bytes", bytes}, {"lookups", ids.size()}});
+
+        if(size <= 100000)
+        {
+            const auto jsonPath = directory.filePath(QString("questions-%1.json").arg(size));
+            auto file = QFile{jsonPath};
+            if(file.open(QIODevice::WriteOnly))
+                file.write(QJsonDocument(ToJSONArray(data.values())).toJson(QJsonDocument::Compact));
+            file.close();
+
+            Measure(suite, "TryLoadFromFile json", size, [&jsonPath]()
+            {
+                Keep(TryLoadFromFile<qint64, Question>(QuestionFactory{}, jsonPath).size());
+            }, QJsonObject{{"bytes", QFileInfo(jsonPath).size()}});
+        }
+    }
+}
+
+//the layout before interning: every question owns a full category and full answers
+struct LegacyQuestion
+{
+    qint64 id;
+    QString questionText;
+    Category category;
+    QList<Answer> answers;
+};
+
+static qint64 ReleasedResidentSetSize()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    return ResidentSetSize();
+}
+
+static void MemoryBenchmarks()
+{
+    const auto suite = QString("memory");
+    for(const auto size: Sizes(10000))
+    {
+        if(Selected(suite, "legacy question layout"))
+        {
+            const auto before = ReleasedResidentSetSize();
+            auto timer = QElapsedTimer{};
+            timer.start();
+            auto legacy = QList<LegacyQuestion>{};
+            legacy.reserve(size);
+            for(auto i = qint64{0}; i < size; ++i)
+                legacy.append(LegacyQuestion{i, QString("Synthetic question number %1?").arg(i), MakeCategory(i), MakeAnswers(i)});
+            const auto elapsedNs = timer.nsecsElapsed();
+            const auto bytes = ResidentSetSize() - before;
+            Report(suite, "legacy question layout", size, size, elapsedNs,
+                   QJsonObject{{"rss_bytes", bytes}, {"bytes_per_item", double(bytes) / size}});
+        }
+
+        if(Selected(suite, "interned question layout"))
+        {
+            const auto before = ReleasedResidentSetSize();
+            auto timer = QElapsedTimer{};
+            timer.start();
+            auto questions = MakeList<Question>(size, [](qint64 i){ return MakeQuestion(i); });
+            const auto elapsedNs = timer.nsecsElapsed();
+            const auto bytes = ResidentSetSize() - before;
+            Keep(questions.size());
+            Report(suite, "interned question layout", size, size, elapsedNs,
+                   QJsonObject{{"rss_bytes", bytes}, {"bytes_per_item", double(bytes) / size}});
+        }
+    }
+}
+
+//IdMap against the QMap it replaced, same items and the same access patterns
+static void IdMapBenchmarks()
+{
+    const auto suite = QString("idmap");
+    for(const auto size: Sizes(1000))
+    {
+        const auto questions = MakeList<Question>(size, [](qint64 i){ return MakeQuestion(i); });
+        auto random = QRandomGenerator(size);
+        const auto firstId = questions.first().id;
+
+        const auto memory = [&suite, size](const QString &name, auto build)
+        {
+            if(!Selected(suite, name))
+                return;
+            const auto before = ReleasedResidentSetSize();
+            auto timer = QElapsedTimer{};
+            timer.start();
+            const auto map = build();
+            const auto elapsedNs = timer.nsecsElapsed();
+            const auto bytes = ResidentSetSize() - before;
+            Keep(map.size());
+            Report(suite, name, size, size, elapsedNs, QJsonObject{{"rss_bytes", bytes}, {"bytes_per_item", double(bytes) / size}});
+        };
+        memory("IdMap<Question> insert and memory", [&questions]()
+        {
+            auto map = IdMap<qint64, Question>{};
+            for(const auto &question: questions)
+                map.insert(question.id, question);
+            return map;
+        });
+        memory("QMap<Question> insert and memory", [&questions]()
+        {
+            auto map = QMap<qint64, Question>{};
+            for(const auto &question: questions)
+                map.insert(question.id, question);
+            return map;
+        });
+        //one id per chunk, chunks hold only their live items
+        memory("IdMap<Question> sparse ids insert and memory", [&questions]()
+        {
+            auto map = IdMap<qint64, Question>{};
+            for(const auto &question: questions)
+                map.insert(question.id * 64, question);
+            return map;
+        });
+
+        auto idMap = IdMap<qint64, Question>{};
+        auto qMap = QMap<qint64, Question>{};
+        for(const auto &question: questions)
+        {
+            idMap.insert(question.id, question);
+            qMap.insert(question.id, question);
+        }
+
+        Measure(suite, "IdMap<Question>::constFind", size, [&idMap, &random, firstId, size]()
+        {
+            Keep(idMap.constFind(firstId + random.bounded(size))->id);
+        });
+        Measure(suite, "QMap<Question>::constFind", size, [&qMap, &random, firstId, size]()
+        {
+            Keep(qMap.constFind(firstId + random.bounded(size))->id);
+        });
+
+        Measure(suite, "IdMap<Question> iterate", size, [&idMap]()
+        {
+            auto sum = qint64{0};
+            for(auto item = idMap.constBegin(); item != idMap.constEnd(); ++item)
+                sum += item->id;
+            Keep(sum);
+        });
+        Measure(suite, "QMap<Question> iterate", size, [&qMap]()
+        {
+            auto sum = qint64{0};
+            for(auto item = qMap.constBegin(); item != qMap.constEnd(); ++item)
+                sum += item->id;
+            Keep(sum);
+        });
+
+        //what SnapshotStore::Write does per mutation, copy the published map and change one item
+        Measure(suite, "IdMap<Question> copy and replace one", size, [&idMap, &questions, &random, size]()
+        {
+            auto copy = idMap;
+            const auto &question = questions[random.bounded(size)];
+            Keep(copy.insert(question.id, question).key());
+        });
+        Measure(suite, "QMap<Question> copy and replace one", size, [&qMap, &questions, &random, size]()
+        {
+            auto copy = qMap;
+            const auto &question = questions[random.bounded(size)];
+            Keep(copy.insert(question.id, question).key());
+        });
+    }
+}
+
+static void GameBenchmarks()
+{
+    const auto suite = QString("game");
+    const auto sessionCount = qint64{1000};
+    const auto questionCount = qint64{10};
+
+    const auto questions = MakeList<Question>(1000, [](qint64 i){ return MakeQuestion(i, 1); });
+    const auto categoryId = questions.first().categoryId;
+    auto questionsApi = CRUDAPI<qint64, Question>{MakeIdMap(questions), std::make_unique<QuestionFactory>()};
+    auto quiz = QuizAPI{questionsApi};
+    auto engine = GameEngine{questionsApi, quiz};
+    const auto startBody = QJsonDocument(QJsonObject{{"category", categoryId}, {"count", questionCount}}).toJson();
+
+    //every session answers the first answer of each question it was handed
+    auto submissions = QList<QByteArray>(sessionCount);
+    const auto startGames = [&engine, &startBody, &submissions, sessionCount]()
+    {
+        for(auto session = qint64{0}; session < sessionCount; ++session)
+        {
+            const auto started = QJsonDocument::fromJson(engine.StartGame(session, startBody).data()).object();
+            auto answers = QJsonArray{};
+            for(const auto &question: started.value("data").toArray())
+                answers.append(QJsonArray{question.toObject().value("answers").toArray().at(0).toObject().value("id")});
+            submissions[session] = QJsonDocument(QJsonObject{{"answers", answers}}).toJson(QJsonDocument::Compact);
+        }
+    };
+
+    MeasureRounds(suite, "GameEngine::SubmitAnswers", questionCount, sessionCount, startGames, [&engine, &submissions, sessionCount]()
+    {
+        for(auto session = qint64{0}; session < sessionCount; ++session)
+            Keep(engine.SubmitAnswers(session, submissions[session]).data().size());
+    }, QJsonObject{{"sessions", sessionCount}});
+
+    MeasureRounds(suite, "GameEngine::StartGame", questionCount, sessionCount, [](){}, startGames, QJsonObject{{"sessions", sessionCount}});
+
+    //grading alone, without parsing or the response
+    const auto compiled = CompiledQuestion::FromQuestion(MakeQuestion(0));
+    const auto submitted = QJsonArray{compiled.answerIds[0]};
+    Measure(suite, "CompiledQuestion MaskOf + xor", 1, [&compiled, &submitted]()
+    {
+        Keep((compiled.MaskOf(submitted) ^ compiled.correctMask) == 0);
+    });
+}
+
+static void LeaderboardBenchmarks()
+{
+    const auto suite = QString("leaderboard");
+    for(const auto size: Sizes(1000))
+    {
+        auto ranking = RankingSkipList{};
+        auto random = QRandomGenerator(size);
+        for(auto id = qint64{0}; id < size; ++id)
+            ranking.Set(id, random.bounded(1000000));
+
+        Measure(suite, "RankingSkipList::Set", size, [&ranking, &random, size]()
+        {
+            ranking.Set(random.bounded(size), random.bounded(1000000));
+        });
+
+        Measure(suite, "RankingSkipList::RankOf", size, [&ranking, &random, size]()
+        {
+            Keep(ranking.RankOf(random.bounded(size)).value_or(0));
+        });
+
+        Measure(suite, "RankingSkipList::ConstIteratorAt", size, [&ranking, &random, size]()
+        {
+            Keep(ranking.ConstIteratorAt(random.bounded(size)).key());
+        });
+
+        for(const auto &[name, page]: {qMakePair(QString("top"), qint64{1}), qMakePair(QString("middle"), size / 20)})
+        {
+            Measure(suite, QString("PaginatedData<RankingSkipList> %1 page").arg(name), size, [&ranking, page = page]()
+            {
+                Keep(PaginatedData<RankingSkipList>{ranking, page, 10}.ToJSON().size());
+            });
+        }
+    }
+}
+
+//the same creates as n authorized single requests and as one batch
+static void BatchBenchmarks()
+{
+    const auto suite = QString("batch");
+    auto session = SessionEntry{};
+    session.StartSession();
+    auto sessions = IdMap<qint64, SessionEntry>{};
+    sessions.insert(session.id, session);
+    const auto sessionApi = SessionAPI<qint64>{sessions, std::make_unique<SessionEntryFactory>()};
+    const auto headers = MakeHeaders(8, session.token.value().toByteArray(QUuid::WithoutBraces));
+
+    for(const auto size: Sizes(10))
+    {
+        if(size > CRUDAPI<qint64, Category>::MAX_BATCH_SIZE)
+            break;
+
+        auto bodies = QList<QByteArray>{};
+        auto operations = QJsonArray{};
+        for(auto i = qint64{0}; i < size; ++i)
+        {
+            const auto item = MakeCategory(i).ToJSON();
+            bodies.append(QJsonDocument(item).toJson(QJsonDocument::Compact));
+            operations.append(QJsonObject{{"op", "create"}, {"item", item}});
+        }
+        const auto batchBody = QJsonDocument(operations).toJson(QJsonDocument::Compact);
+
+        auto api = std::unique_ptr<CRUDAPI<qint64, Category>>{};
+        const auto freshApi = [&api]()
+        {
+            api = std::make_unique<CRUDAPI<qint64, Category>>(IdMap<qint64, Category>{}, std::make_unique<CategoryFactory>());
+        };
+
+        MeasureRounds(suite, "single creates", size, size, freshApi, [&api, &sessionApi, &headers, &bodies]()
+        {
+            for(const auto &body: bodies)
+            {
+                if(sessionApi.Authorize(headers))
+                    Keep(int(api->PostItem(body).statusCode()));
+            }
+        });
+
+        MeasureRounds(suite, "batch creates", size, size, freshApi, [&api, &sessionApi, &headers, &batchBody]()
+        {
+            if(sessionApi.Authorize(headers))
+                Keep(api->BatchItems(batchBody).data().size());
+        });
+    }
+}
+
+static void MetricsBenchmarks()
+{
+    const auto suite = QString("metrics");
+    const auto series = RouteSeries("GET", "/benchmark");
+    Measure(suite, "RequestScope + PhaseScope", 1, [series]()
+    {
+        const auto scope = RequestScope(series);
+        const auto phase = PhaseScope(MetricsRegistry::Phase::Store);
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    auto application = QCoreApplication{argc, argv};
+
+    for(auto i = 1; i + 1 < argc; ++i)
+    {
+        if(qstrcmp(argv[i], "--filter") == 0)
+            options.filter = QString::fromLocal8Bit(argv[++i]);
+        else if(qstrcmp(argv[i], "--max-items") == 0)
+            options.maxItems = qMax<qint64>(10, QByteArray(argv[++i]).toLongLong());
+        else if(qstrcmp(argv[i], "--min-time-ms") == 0)
+            options.minTimeMs = qMax<qint64>(1, QByteArray(argv[++i]).toLongLong());
+    }
+
+    JSONBenchmarks();
+    ParserBenchmarks();
+    PagingBenchmarks();
+    CompressionBenchmarks();
+    WireFormatBenchmarks();
+    ListQueryBenchmarks();
+    SearchBenchmarks();
+    LiveBenchmarks();
+    AuthBenchmarks();
+    AdmissionBenchmarks();
+    StoreBenchmarks();
+    LogBenchmarks();
+    SnapshotBenchmarks();
+    MemoryBenchmarks();
+    IdMapBenchmarks();
+    GameBenchmarks();
+    LeaderboardBenchmarks();
+    BatchBenchmarks();
+    MetricsBenchmarks();
+
+    return 0;
+}
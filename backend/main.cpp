@@ -1,33 +1,129 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QElapsedTimer>
 
-#include"APISetup.hpp"
+#include"HeadlessServer.hpp"
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
-    MainWindow w;
-    //
+    auto startupTimer = QElapsedTimer{};
+    startupTimer.start();
+
+    //--convert-snapshot <type> <in.json> <out.snapshot>
+    if(argc == 5 && qstrcmp(argv[1], "--convert-snapshot") == 0)
+        return ConvertAssetToSnapshot(argv[2], argv[3], argv[4]) ? 0 : 1;
+
+    //--headless [--loops <n>], no widgets and n server event loops sharing the port
+    //--admin-token <uuid> fixes the token of the admin session, otherwise a fresh one is printed
+    auto headless = false;
+    auto loopCount = QThread::idealThreadCount();
+    auto adminToken = std::optional<QUuid>{};
+    for(auto i = 1; i < argc; ++i)
+    {
+        if(qstrcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if(qstrcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+            loopCount = qMax(1, QByteArray(argv[++i]).toInt());
+        else if(qstrcmp(argv[i], "--admin-token") == 0 && i + 1 < argc)
+        {
+            const auto token = QUuid::fromString(QLatin1StringView(argv[++i]));
+            if(token.isNull())
+            {
+                qDebug() << "--admin-token is not a uuid";
+                return 1;
+            }
+            adminToken = token;
+        }
+    }
+
+    auto application = headless
+        ? std::make_unique<QCoreApplication>(argc, argv)
+        : std::make_unique<QApplication>(argc, argv);
+
+    auto loadTimer = QElapsedTimer{};
+    loadTimer.start();
 
     auto categoryFactory = std::make_unique<CategoryFactory>();
     auto categories = TryLoadFromFile<qint64, Category>(*categoryFactory, ":/assets/categories.json");//
+    auto categoriesLog = std::make_shared<WriteAheadLog>(DATA_DIR, "categories");
+    categories = categoriesLog->Recover(*categoryFactory, categories);
     auto categoriesApi = CRUDAPI<qint64, Category>{std::move(categories), std::move(categoryFactory)};
+    categoriesApi.AttachLog(categoriesLog);
+    //the directory follows the category store before any question is read, questions find their categories in it
+    categoriesApi.AddChangeListener([](qint64 categoryId, const Category *, const Category *after)
+    {
+        CategoryDirectory::Instance().Apply(categoryId, after);
+    });
+
+    auto questionFactory = std::make_unique<QuestionFactory>();
+    auto questions = TryLoadFromFile<qint64, Question>(*questionFactory, ":/assets/questions.json");//
+    auto questionsLog = std::make_shared<WriteAheadLog>(DATA_DIR, "questions");
+    questions = questionsLog->Recover(*questionFactory, questions);
+    //writes would only ever be rejected, better not to start
+    if(categoriesLog->Failed() || questionsLog->Failed())
+    {
+        qDebug() << "Opening the logs in" << DATA_DIR << "failed";
+        return 1;
+    }
+    auto questionsApi = CRUDAPI<qint64, Question>{std::move(questions), std::move(questionFactory)};
+    questionsApi.AttachLog(questionsLog);
+    //questions embed their category, cached ones are stale once it changes or goes
+    categoriesApi.AddChangeListener([&questionsApi](qint64, const Category *before, const Category *)
+    {
+        if(before)
+            questionsApi.InvalidateCache();
+    });
+    auto quizApi = QuizAPI{questionsApi};
+    auto questionSearch = SearchAPI<Question>{questionsApi};
+    auto categorySearch = SearchAPI<Category>{categoriesApi};
+    auto categoryFeed = LiveFeed{categoriesApi};
+    auto questionFeed = LiveFeed{questionsApi};
+    auto gameEngine = GameEngine{questionsApi, quizApi};
+    auto leaderboard = Leaderboard{};
+    gameEngine.AddScoreListener([&leaderboard](qint64 sessionId, qint64 score) {leaderboard.SetScore(sessionId, score);});
+
+    qDebug() << "Loaded data in" << loadTimer.elapsed() << "ms";
 
     auto sessionFactory = std::make_unique<SessionEntryFactory>();
     auto sessions = TryLoadFromFile<qint64, SessionEntry>(*sessionFactory, ":/assets/sessions.json");//
     auto sessionsApi = SessionAPI<qint64>{std::move(sessions), std::move(sessionFactory)};
+    const auto registeredAdminToken = sessionsApi.RegisterAdminSession(adminToken);
+    if(!adminToken.has_value())
+        qDebug() << "Admin token" << registeredAdminToken.toString(QUuid::StringFormat::WithoutBraces);
 
-    auto httpServer = QHttpServer{};
-    httpServer.route
-        (
-            "/", []()
-            {
-                return "RestAPI server";
-            }
-        );
+    //one set of limits per route group, shared by every server loop
+    auto categoryGuards = CRUDGuards{};
+    auto questionGuards = CRUDGuards{};
+    auto sessionGuard = RouteGuard{DEFAULT_SESSION_LIMITS};
 
-    AddCRUDRoutes(httpServer, "/api/categories/", categoriesApi, sessionsApi);
+    const auto setupRoutes = [&](QHttpServer &httpServer)
+    {
+        httpServer.route
+            (
+                "/", []()
+                {
+                    return "RestAPI server";
+                }
+            );
+
+        AddSearchRoutes(httpServer, "/api/categories/", categorySearch);
+        AddCRUDRoutes(httpServer, "/api/categories/", categoriesApi, sessionsApi, categoryGuards);
+        AddQuizRoutes(httpServer, "/api/questions/", quizApi, sessionsApi);
+        AddSearchRoutes(httpServer, "/api/questions/", questionSearch);
+        AddCRUDRoutes(httpServer, "/api/questions/", questionsApi, sessionsApi, questionGuards);
+        AddSessionRoutes(httpServer, "/api/sessions/", sessionsApi, sessionGuard);
+        AddGameRoutes(httpServer, "/api/games/", gameEngine, sessionsApi);
+        AddLeaderboardRoutes(httpServer, "/api/leaderboard/", leaderboard, sessionsApi);
+        AddLiveRoutes(httpServer, {{"/api/categories/", &categoryFeed}, {"/api/questions/", &questionFeed}});
+        AddMetricsRoutes(httpServer, "/metrics");
+    };
+
+    if(headless)
+        return RunHeadless(*application, loopCount, PORT, setupRoutes, startupTimer);
+
+    auto httpServer = QHttpServer{};
+    setupRoutes(httpServer);
 
     const auto port = httpServer.listen(QHostAddress::Any, PORT);
     if(!port)
@@ -40,6 +136,7 @@ int main(int argc, char *argv[])
     qDebug() << QString("Running on http://%1:").arg(HOST).append("%1/").arg(PORT);
 
     //
+    MainWindow w;
     w.show();
-    return a.exec();
+    return application->exec();
 }
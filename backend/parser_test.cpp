@@ -0,0 +1,171 @@
+#include <QJsonDocument>
+#include <QRandomGenerator>
+#include <cstdio>
+
+#include"JSONBodyParser.hpp"
+#include"Structs.hpp"
+
+//differential test of JSONBodyParser against QJsonDocument::fromJson on mutated request bodies
+//both have to agree on acceptance and on every kept member, the first disagreement fails with the input
+//usage: RESTAPIServerParserTest [--iterations <n>] [--seed <n>]
+
+static qint64 iterations = 200000;
+static quint32 seed = 20241016;
+
+static QByteArray Mutate(QByteArray document, QRandomGenerator &random)
+{
+    static const auto alphabet = QByteArray("\"\\{}[],:u0e-+. \t\n/\x01\x7f\x80\xbf\xc3\xa9\xed\xa0\xef\xbb\xf0\xf4\x9f");
+    const auto edits = 1 + random.bounded(4);
+    for(auto edit = 0; edit < edits && !document.isEmpty(); ++edit)
+    {
+        const auto at = random.bounded(document.size());
+        switch(random.bounded(5))
+        {
+        case 0:
+            document[at] = alphabet[random.bounded(alphabet.size())];
+            break;
+        case 1:
+            document.insert(at, alphabet[random.bounded(alphabet.size())]);
+            break;
+        case 2:
+            document.remove(at, 1 + random.bounded(4));
+            break;
+        case 3:
+            document.truncate(at);
+            break;
+        default:
+            document.insert(at, document.mid(random.bounded(document.size()), 1 + random.bounded(8)));
+        }
+    }
+    return document;
+}
+
+static QList<QByteArray> Seeds()
+{
+    const auto category = Category(QString("Category 0"), QUrl(QString("https://example.com/icons/0.png")));
+    CategoryDirectory::Instance().Apply(category.id, &category);
+    auto question = Question(QString("Wie heißt die Hauptstadt von \"Österreich\"?\n\u00e9\U0001F600"),
+                             category.id,
+                             ToAnswerRecords({Answer(QString("Wien"), true), Answer(QString("Graz"), false), Answer(QString("Linz"), false)}).value()).ToJSON();
+    auto longQuestion = question;
+    longQuestion.insert("questionText", QString("long question text ").repeated(64));
+    auto unknownMembers = question;
+    unknownMembers.insert("client", QJsonObject{{"platform", "android"}, {"history", QJsonArray{1, 2.5, "three", QJsonObject{{"four", true}}}}});
+
+    auto seeds = QList<QByteArray>
+        {
+            QJsonDocument(question).toJson(QJsonDocument::Compact),
+            QJsonDocument(question).toJson(QJsonDocument::Indented),
+            QJsonDocument(longQuestion).toJson(QJsonDocument::Compact),
+            QJsonDocument(unknownMembers).toJson(QJsonDocument::Compact)
+        };
+    seeds.append(R"({"a":[1,-0,0.5,1e308,1e309,1e-400,-12345678901234567890,9223372036854775807],"b":{"c":[true,false,null,{}]},"a":"dup"})");
+    seeds.append(R"({"questionText":"\ud83d\ude00 \ud800 \udc00 \u0000 \/\b\f\r\t","category":{"categoryText":"x","iconUrl":"y"},"answers":[]})");
+    seeds.append(QByteArray("\xef\xbb\xbf { \"questionText\" : \"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\" } "));
+
+    //a special byte at every offset around the 16 and 32 byte blocks of the vector scans
+    for(auto offset = 0; offset < 70; ++offset)
+    {
+        auto text = QByteArray(offset, 'x');
+        text.append("\\n\xc3\xa9");
+        text.append(QByteArray(40, 'y'));
+        seeds.append(QByteArray(R"({"questionText":")") + text + R"("})");
+    }
+    return seeds;
+}
+
+static QByteArray Printable(const QByteArray &input)
+{
+    return "base64 " + input.toBase64() + ", text " + input.toPercentEncoding(" \"{}[],:");
+}
+
+//every scan has to stop exactly where the byte by byte check stops
+static bool CheckStringRuns(QRandomGenerator &random)
+{
+    for(auto round = 0; round < 20000; ++round)
+    {
+        auto buffer = QByteArray(random.bounded(100), 'a');
+        for(auto &c: buffer)
+        {
+            if(random.bounded(40) == 0)
+                c = char(random.bounded(256));
+        }
+
+        for(auto from = qsizetype{0}; from <= buffer.size(); ++from)
+        {
+            auto expected = buffer.constData() + from;
+            for(; expected != buffer.constEnd(); ++expected)
+            {
+                const auto c = uchar(*expected);
+                if(c == '"' || c == '\\' || c < 0x20 || c >= 0x80)
+                    break;
+            }
+            if(JSONBodyParser::ScanStringRun(buffer.constData() + from, buffer.constEnd()) != expected)
+            {
+                fprintf(stderr, "ScanStringRun stops early or late from offset %lld in %s\n", qint64(from), Printable(buffer).constData());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool CheckDifferential(QRandomGenerator &random)
+{
+    const auto seeds = Seeds();
+    const auto &names = WritableFieldNames<Question>();
+    auto accepted = qint64{0};
+    for(auto i = qint64{0}; i < iterations; ++i)
+    {
+        const auto &seedDocument = seeds[random.bounded(seeds.size())];
+        const auto input = i % 8 == 0 ? seedDocument : Mutate(seedDocument, random);
+
+        auto error = QJsonParseError{};
+        const auto document = QJsonDocument::fromJson(input, &error);
+        auto expected = std::optional<QJsonObject>{};
+        if(!error.error && document.isObject())
+            expected = document.object();
+        accepted += expected.has_value();
+
+        auto filtered = std::optional<QJsonObject>{};
+        if(expected.has_value())
+        {
+            filtered = QJsonObject{};
+            for(const auto &field: names)
+            {
+                if(expected.value().contains(field))
+                    filtered.value().insert(field, expected.value().value(field));
+            }
+        }
+
+        if(JSONBodyParser(input).ParseObject() != expected)
+        {
+            fprintf(stderr, "parsers disagree on the whole object (QJsonDocument %s) for %s\n",
+                    expected.has_value() ? "accepts" : "rejects", Printable(input).constData());
+            return false;
+        }
+        if(JSONBodyParser(input, &names).ParseObject() != filtered)
+        {
+            fprintf(stderr, "parsers disagree on the writable members of Question for %s\n", Printable(input).constData());
+            return false;
+        }
+    }
+    printf("%lld inputs, %lld accepted, no disagreement\n", iterations, accepted);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    for(auto i = 1; i + 1 < argc; ++i)
+    {
+        if(qstrcmp(argv[i], "--iterations") == 0)
+            iterations = qMax<qint64>(1, QByteArray(argv[++i]).toLongLong());
+        else if(qstrcmp(argv[i], "--seed") == 0)
+            seed = QByteArray(argv[++i]).toUInt();
+    }
+
+    auto random = QRandomGenerator(seed);
+    if(!CheckStringRuns(random) || !CheckDifferential(random))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <QMutex>
+#include <QRandomGenerator>
+#include <QThread>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include"SnapshotStore.hpp"
+
+//concurrent read/write stress test of SnapshotStore
+//every write moves all items to the next version and adds or drops two items, some go through Stage and Publish
+//with a discarded stage in between, readers check each snapshot they get:
+//it is one whole version, numbers never go back, and no item in it has been destroyed
+//afterwards only the items of the current version may be alive, and none once the store is gone
+//usage: RESTAPIServerSnapshotTest [--writes <n>] [--readers <n>]
+
+static qint64 writes = 20000;
+static int readerCount = qMax(2, QThread::idealThreadCount() - 1);
+
+//counts itself and marks its memory when destroyed, so a reader touching a reclaimed item sees it
+struct Cell
+{
+    static constexpr quint64 LIVE = 0x11fe11fe11fe11feull;
+    static constexpr quint64 DEAD = 0xdeaddeaddeaddeadull;
+    static inline std::atomic<qint64> alive{0};
+
+    qint64 id = 0;
+    qint64 version = 0;
+    quint64 magic = LIVE;
+
+    Cell() :
+        Cell(0, 0)
+    {}
+
+    Cell(qint64 id, qint64 version) :
+        id(id),
+        version(version)
+    {
+        alive.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Cell(const Cell &other) :
+        Cell(other.id, other.version)
+    {}
+
+    Cell &operator=(const Cell &other)
+    {
+        id = other.id;
+        version = other.version;
+        return *this;
+    }
+
+    ~Cell()
+    {
+        //volatile, so the store is not dropped as dead
+        *static_cast<volatile quint64 *>(&magic) = DEAD;
+        alive.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+//two dense runs of ids with a gap, the toggled ids open and drop a chunk in the gap and one past the end
+static constexpr qint64 RUN_LENGTH = 128;
+static constexpr qint64 SECOND_RUN = 256;
+static constexpr qint64 MIDDLE_TOGGLE = 200;
+static constexpr qint64 END_TOGGLE = 100000;
+
+//ids of the version written as write number version, in key order
+static QList<qint64> ExpectedIds(qint64 version)
+{
+    auto ids = QList<qint64>{};
+    for(auto id = qint64{0}; id < RUN_LENGTH; ++id)
+        ids.append(id);
+    if(version % 2 == 1)
+        ids.append(MIDDLE_TOGGLE);
+    for(auto id = SECOND_RUN; id < SECOND_RUN + RUN_LENGTH; ++id)
+        ids.append(id);
+    if(version % 2 == 1)
+        ids.append(END_TOGGLE);
+    return ids;
+}
+
+class Failures
+{
+public:
+
+    bool Any() const
+    {
+        return m_failed.load(std::memory_order_relaxed);
+    }
+
+    //keeps the first message only
+    void Fail(const QByteArray &message)
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        if(!m_failed.exchange(true))
+            m_message = message;
+    }
+
+    QByteArray Message()
+    {
+        auto locker = QMutexLocker(&m_mutex);
+        return m_message;
+    }
+
+private:
+
+    std::atomic<bool> m_failed{false};
+    QMutex m_mutex;
+    QByteArray m_message;
+};
+
+static bool CheckSnapshot(const SnapshotStore<qint64, Cell>::ReadSnapshot &snapshot, quint64 &lastNumber, QRandomGenerator &random, Failures &failures)
+{
+    const auto number = snapshot.Number();
+    if(number < lastNumber)
+    {
+        failures.Fail(QByteArray("snapshot number went back from ") + QByteArray::number(lastNumber) + " to " + QByteArray::number(number));
+        return false;
+    }
+    lastNumber = number;
+
+    //the store starts at number 1 with version 0
+    const auto version = qint64(number) - 1;
+    const auto ids = ExpectedIds(version);
+    const auto where = QByteArray(" in snapshot ") + QByteArray::number(number);
+    if(snapshot->size() != ids.size())
+    {
+        failures.Fail("size " + QByteArray::number(snapshot->size()) + ", expected " + QByteArray::number(ids.size()) + where);
+        return false;
+    }
+
+    auto index = qsizetype{0};
+    for(auto item = snapshot->constBegin(); item != snapshot->constEnd(); ++item, ++index)
+    {
+        if(index >= ids.size() || item.key() != ids.at(index))
+        {
+            failures.Fail("unexpected id " + QByteArray::number(item.key()) + " at position " + QByteArray::number(index) + where);
+            return false;
+        }
+        if(item->magic != Cell::LIVE)
+        {
+            failures.Fail("item " + QByteArray::number(item.key()) + " read after it was destroyed" + where);
+            return false;
+        }
+        if(item->id != item.key() || item->version != version)
+        {
+            failures.Fail("item " + QByteArray::number(item.key()) + " holds version " + QByteArray::number(item->version)
+                          + ", a torn write" + where);
+            return false;
+        }
+    }
+    if(index != ids.size())
+    {
+        failures.Fail("iteration ended after " + QByteArray::number(index) + " items" + where);
+        return false;
+    }
+
+    const auto position = qsizetype(random.bounded(int(ids.size())));
+    if(snapshot->ConstIteratorAt(position).key() != ids.at(position))
+    {
+        failures.Fail("positional access at " + QByteArray::number(position) + " finds id " + QByteArray::number(snapshot->ConstIteratorAt(position).key()) + where);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    for(auto i = 1; i + 1 < argc; ++i)
+    {
+        if(qstrcmp(argv[i], "--writes") == 0)
+            writes = qMax<qint64>(1, QByteArray(argv[++i]).toLongLong());
+        else if(qstrcmp(argv[i], "--readers") == 0)
+            readerCount = qMax(1, QByteArray(argv[++i]).toInt());
+    }
+
+    auto failures = Failures{};
+    {
+        auto initial = IdMap<qint64, Cell>{};
+        for(const auto id: ExpectedIds(0))
+            initial.insert(id, Cell(id, 0));
+        auto store = SnapshotStore<qint64, Cell>{initial};
+        initial.clear();
+
+        auto stop = std::atomic<bool>{false};
+        auto reads = std::atomic<qint64>{0};
+        auto readers = std::vector<std::unique_ptr<QThread>>{};
+        for(auto i = 0; i < readerCount; ++i)
+        {
+            readers.emplace_back(QThread::create([&store, &stop, &reads, &failures, i]()
+            {
+                auto random = QRandomGenerator(quint32(i + 1));
+                auto lastNumber = quint64{0};
+                auto local = qint64{0};
+                while(!stop.load(std::memory_order_relaxed) && !failures.Any())
+                {
+                    if(!CheckSnapshot(store.Read(), lastNumber, random, failures))
+                        break;
+                    ++local;
+                }
+                reads.fetch_add(local);
+            }));
+            readers.back()->start();
+        }
+
+        for(auto version = qint64{1}; version <= writes && !failures.Any(); ++version)
+        {
+            const auto mutation = [version](IdMap<qint64, Cell> &data)
+            {
+                for(const auto id: ExpectedIds(version))
+                    data.insert(id, Cell(id, version));
+                if(version % 2 == 0)
+                {
+                    data.remove(MIDDLE_TOGGLE);
+                    data.remove(END_TOGGLE);
+                }
+                return true;
+            };
+            if(version % 3 != 0)
+            {
+                store.Write(mutation);
+                continue;
+            }
+
+            //every third version is staged behind one that is discarded, readers must never see the latter
+            store.Stage(mutation, [version](){ return quint64(version); });
+            store.Stage([](IdMap<qint64, Cell> &data){ data.clear(); return true; }, [version](){ return quint64(version) + 1; });
+            store.Discard(quint64(version) + 1, [](quint64){});
+            store.Publish(quint64(version), [](quint64){});
+        }
+        stop.store(true);
+        for(const auto &reader: readers)
+            reader->wait();
+
+        if(failures.Any())
+        {
+            fprintf(stderr, "%s\n", failures.Message().constData());
+            return 1;
+        }
+
+        //a write with no reader left reclaims every retired version
+        store.Write([](IdMap<qint64, Cell> &){ return true; });
+        const auto current = store.Read()->size();
+        if(Cell::alive.load() != current)
+        {
+            fprintf(stderr, "%lld items alive after the last write, the current version holds %lld\n", Cell::alive.load(), qint64(current));
+            return 1;
+        }
+        printf("%lld writes, %lld reads by %d readers, every snapshot whole\n", writes, reads.load(), readerCount);
+    }
+
+    if(Cell::alive.load() != 0)
+    {
+        fprintf(stderr, "%lld items alive after the store is gone\n", Cell::alive.load());
+        return 1;
+    }
+    return 0;
+}